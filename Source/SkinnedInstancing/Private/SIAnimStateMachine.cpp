@@ -0,0 +1,171 @@
+#include "SIAnimStateMachine.h"
+#include "SIInstanceStore.h"
+#include "SkinnedInstancing.h"
+#include "Async/ParallelFor.h"
+
+namespace
+{
+	const int32 GStateMachineChunkSize = 1024;
+
+	bool TestCondition(ESIAnimConditionOp Op, float Parameter, float Value)
+	{
+		switch (Op)
+		{
+		case ESIAnimConditionOp::Less:		return Parameter < Value;
+		case ESIAnimConditionOp::Greater:	return Parameter > Value;
+		case ESIAnimConditionOp::Equal:		return Parameter == Value;
+		case ESIAnimConditionOp::NotEqual:	return Parameter != Value;
+		case ESIAnimConditionOp::IsTrue:	return Parameter != 0;
+		case ESIAnimConditionOp::IsFalse:	return Parameter == 0;
+		}
+		return false;
+	}
+}
+
+USIAnimStateMachine::USIAnimStateMachine(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+}
+
+void USIAnimStateMachine::PostLoad()
+{
+	Super::PostLoad();
+
+	Compile();
+}
+
+#if WITH_EDITOR
+void USIAnimStateMachine::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+
+	Compile();
+}
+#endif
+
+void USIAnimStateMachine::Compile()
+{
+	CompiledStates.Reset(States.Num());
+	CompiledTransitions.Reset();
+	CompiledConditions.Reset();
+
+	for (const FSIAnimState& State : States)
+	{
+		FCompiledState& CompiledState = CompiledStates.AddDefaulted_GetRef();
+		CompiledState.FirstTransition = CompiledTransitions.Num();
+
+		for (const FSIAnimTransition& Transition : State.Transitions)
+		{
+			const int32 TargetState = States.IndexOfByPredicate([&](const FSIAnimState& Other) { return Other.Name == Transition.TargetState; });
+			if (TargetState == INDEX_NONE)
+			{
+				UE_LOG(LogSkinnedInstancing, Warning, TEXT("%s: transition from %s to unknown state %s is ignored"),
+					*GetPathName(), *State.Name.ToString(), *Transition.TargetState.ToString());
+				continue;
+			}
+
+			FCompiledTransition& CompiledTransition = CompiledTransitions.AddDefaulted_GetRef();
+			CompiledTransition.TargetState = TargetState;
+			CompiledTransition.FadeTime = Transition.FadeTime;
+			CompiledTransition.bWaitForSequenceEnd = Transition.bWaitForSequenceEnd;
+			CompiledTransition.FirstCondition = CompiledConditions.Num();
+			CompiledTransition.NumConditions = Transition.Conditions.Num();
+
+			for (const FSIAnimCondition& Condition : Transition.Conditions)
+			{
+				// a condition on an unknown parameter never holds
+				const int32 Parameter = FindParameter(Condition.Parameter);
+				if (Parameter == INDEX_NONE)
+				{
+					UE_LOG(LogSkinnedInstancing, Warning, TEXT("%s: transition from %s tests unknown parameter %s"),
+						*GetPathName(), *State.Name.ToString(), *Condition.Parameter.ToString());
+				}
+
+				CompiledConditions.Add({ Parameter, Condition.Op, Condition.Value });
+			}
+		}
+
+		CompiledState.NumTransitions = CompiledTransitions.Num() - CompiledState.FirstTransition;
+	}
+}
+
+const USIAnimStateMachine::FCompiledTransition* USIAnimStateMachine::FindTransition(int32 State, const FSIInstanceStore& Instances, int32 Index) const
+{
+	const FCompiledState& CompiledState = CompiledStates[State];
+
+	// the newest sequence the player was given is the one of the current state
+	const FAnimtionPlayer::Sequence& Seq = Instances.Players[Index].GetNextSeq();
+
+	for (int32 TransitionIndex = 0; TransitionIndex < CompiledState.NumTransitions; TransitionIndex++)
+	{
+		const FCompiledTransition& Transition = CompiledTransitions[CompiledState.FirstTransition + TransitionIndex];
+		if (Transition.bWaitForSequenceEnd && Seq.Time < Seq.Length - Transition.FadeTime)
+			continue;
+
+		bool bPassed = true;
+		for (int32 ConditionIndex = 0; ConditionIndex < Transition.NumConditions && bPassed; ConditionIndex++)
+		{
+			const FCompiledCondition& Condition = CompiledConditions[Transition.FirstCondition + ConditionIndex];
+			bPassed = Instances.StateParameters.IsValidIndex(Condition.Parameter)
+				&& TestCondition(Condition.Op, Instances.StateParameters[Condition.Parameter][Index], Condition.Value);
+		}
+
+		if (bPassed)
+			return &Transition;
+	}
+
+	return nullptr;
+}
+
+int32 USIAnimStateMachine::Evaluate(const FSIInstanceStore& Instances, TArray<FStateChange>& OutChanges) const
+{
+	const int32 NumInstances = Instances.Num();
+	OutChanges.SetNumUninitialized(NumInstances, false);
+
+	if (NumInstances == 0 || CompiledStates.Num() == 0)
+	{
+		OutChanges.Reset();
+		return 0;
+	}
+
+	const int32 NumChunks = FMath::DivideAndRoundUp(NumInstances, GStateMachineChunkSize);
+	TArray<int32> NumChangesPerChunk;
+	NumChangesPerChunk.AddZeroed(NumChunks);
+
+	ParallelFor(NumChunks, [&](int32 ChunkIndex)
+	{
+		const int32 Start = ChunkIndex * GStateMachineChunkSize;
+		const int32 End = FMath::Min(Start + GStateMachineChunkSize, NumInstances);
+
+		int32 NumChanges = 0;
+		for (int32 Index = Start; Index < End; Index++)
+		{
+			FStateChange& Change = OutChanges[Index];
+			Change = FStateChange();
+
+			const int32 State = Instances.AnimStates[Index];
+			if (!CompiledStates.IsValidIndex(State))
+			{
+				Change.State = 0;
+				NumChanges++;
+				continue;
+			}
+
+			if (const FCompiledTransition* Transition = FindTransition(State, Instances, Index))
+			{
+				Change.State = Transition->TargetState;
+				Change.FadeTime = Transition->FadeTime;
+				NumChanges++;
+			}
+		}
+
+		NumChangesPerChunk[ChunkIndex] = NumChanges;
+	}, NumChunks == 1);
+
+	int32 NumChanges = 0;
+	for (int32 ChunkChanges : NumChangesPerChunk)
+	{
+		NumChanges += ChunkChanges;
+	}
+	return NumChanges;
+}
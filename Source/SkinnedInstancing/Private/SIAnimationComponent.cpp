@@ -1,6 +1,13 @@
 #include "SIAnimationComponent.h"
 #include "BonePose.h"
 #include "SIAnimationData.h"
+#include "SkinnedInstancing.h"
+#include "SIStats.h"
+#include "Misc/ScopeRWLock.h"
+
+DECLARE_CYCLE_STAT(TEXT("Bake Animation Data"), STAT_SIBakeAnimationData, STATGROUP_SkinnedInstancing);
+DECLARE_CYCLE_STAT(TEXT("Bake Root Motion"), STAT_SIBakeRootMotion, STATGROUP_SkinnedInstancing);
+DECLARE_MEMORY_STAT(TEXT("CPU Bone Palette Memory"), STAT_SICPUBonePaletteMemory, STATGROUP_SkinnedInstancing);
 
 #pragma optimize( "", off )
 
@@ -12,6 +19,18 @@ USIAnimationComponent::USIAnimationComponent(const FObjectInitializer& ObjectIni
 	PrimaryComponentTick.TickGroup = TG_PrePhysics;
 
 	AnimationData = nullptr;
+	bKeepCPUBonePalette = false;
+	bCompactCPUBonePalette = false;
+
+	FSIAnimationPaletteTier HalfRate;
+	HalfRate.RateDivisor = 2;
+	HalfRate.MinLOD = 2;
+	PaletteTiers.Add(HalfRate);
+
+	FSIAnimationPaletteTier QuarterRate;
+	QuarterRate.RateDivisor = 4;
+	QuarterRate.MinLOD = 3;
+	PaletteTiers.Add(QuarterRate);
 }
 
 UAnimSequence * USIAnimationComponent::GetSequence(int Id)
@@ -21,10 +40,80 @@ UAnimSequence * USIAnimationComponent::GetSequence(int Id)
 	return AnimSequences[Id];
 }
 
+int32 USIAnimationComponent::GetPaletteTierMemorySize(int Tier) const
+{
+	if (!AnimationData)
+		return 0;
+	return (int32)AnimationData->GetPaletteTierMemorySize(Tier);
+}
+
+void USIAnimationComponent::GetResourceSizeEx(FResourceSizeEx& CumulativeResourceSize)
+{
+	Super::GetResourceSizeEx(CumulativeResourceSize);
+
+	if (AnimationData)
+	{
+		CumulativeResourceSize.AddDedicatedSystemMemoryBytes(AnimationData->GetResourceSize());
+		CumulativeResourceSize.AddDedicatedVideoMemoryBytes(AnimationData->GetBufferSize());
+	}
+
+	CumulativeResourceSize.AddDedicatedSystemMemoryBytes(RootMotionTracks.GetAllocatedSize());
+	for (const FSIRootMotionTrack& Track : RootMotionTracks)
+	{
+		CumulativeResourceSize.AddDedicatedSystemMemoryBytes(Track.GetAllocatedSize());
+	}
+
+	CumulativeResourceSize.AddDedicatedSystemMemoryBytes(NotifyTracks.GetAllocatedSize());
+	for (const FSINotifyTrack& Track : NotifyTracks)
+	{
+		CumulativeResourceSize.AddDedicatedSystemMemoryBytes(Track.GetAllocatedSize());
+	}
+
+	FRWScopeLock Lock(CPUBonePaletteLock, SLT_ReadOnly);
+	if (CPUBonePalette.IsValid())
+	{
+		CumulativeResourceSize.AddDedicatedSystemMemoryBytes(CPUBonePalette->GetAllocatedSize());
+	}
+}
+
+bool USIAnimationComponent::ReadCPUBonePalette(TFunctionRef<void(const FSIBonePalette&)> Func) const
+{
+	FRWScopeLock Lock(CPUBonePaletteLock, SLT_ReadOnly);
+	if (!CPUBonePalette.IsValid())
+		return false;
+
+	Func(*CPUBonePalette);
+	return true;
+}
+
 USIAnimationComponent::~USIAnimationComponent()
 {
 }
 
+void USIAnimationComponent::OnRegister()
+{
+	Super::OnRegister();
+
+	BakeRootMotion();
+	BakeNotifies();
+
+	// in server mode the palette is not baked with the render state, hit tests and bone queries still need it
+	if (bKeepCPUBonePalette && SIIsServerMode() && Skeleton && AnimSequences.Num() > 0 && AnimSequences[0])
+	{
+		CreateCPUBonePalette();
+	}
+}
+
+void USIAnimationComponent::OnUnregister()
+{
+	Super::OnUnregister();
+
+	if (SIIsServerMode())
+	{
+		SetCPUBonePalette(nullptr);
+	}
+}
+
 void USIAnimationComponent::BeginPlay()
 {
 	Super::BeginPlay();
@@ -40,7 +129,7 @@ void USIAnimationComponent::CreateRenderState_Concurrent()
 	if (Skeleton && AnimSequences.Num() > 0 && AnimSequences[0])
 	{
 		// No need to create the mesh object if we aren't actually rendering anything (see UPrimitiveComponent::Attach)
-		if (FApp::CanEverRender() && ShouldComponentAddToScene())
+		if (!SIIsServerMode() && ShouldComponentAddToScene())
 		{
 			CreateAnimationData();
 		}
@@ -62,11 +151,13 @@ void USIAnimationComponent::DestroyRenderState_Concurrent()
 		BeginCleanup(AnimationData);
 		AnimationData = nullptr;
 	}
+
+	SetCPUBonePalette(nullptr);
 }
 
 namespace
 {
-	void UpdateBoneData(TArray<FMatrix>& BoneMatrices, int SequenceOffset, UAnimSequence* AnimSequence, const FBoneContainer* BoneContainer)
+	void UpdateBoneData(TArray<FMatrix>& BoneMatrices, TArray<FBox>& FrameBoneBounds, int SequenceOffset, UAnimSequence* AnimSequence, const FBoneContainer* BoneContainer)
 	{
 		FCompactPose OutPose;
 		FBlendedCurve OutCurve;
@@ -82,7 +173,8 @@ namespace
 		for (int FrameIndex = 0; FrameIndex < NumFrames; FrameIndex++)
 		{
 			float Time = FrameIndex * Interval;
-			AnimSequence->GetBonePose(/*out*/ OutPose, /*out*/OutCurve, FAnimExtractContext(Time));
+			// root motion sequences are baked in place, instances are moved by their root motion track instead
+			AnimSequence->GetBonePose(/*out*/ OutPose, /*out*/OutCurve, FAnimExtractContext(Time, AnimSequence->bEnableRootMotion));
 
 			TArray<FTransform> ComponentSpaceTransforms;
 
@@ -114,26 +206,59 @@ namespace
 				checkSlow(!SpaceBase->ContainsNaN());
 			}
 
+			FBox& FrameBounds = FrameBoneBounds[SequenceOffset / NumBones + FrameIndex];
+			FrameBounds.Init();
+
 			for (int BoneIndex = 0; BoneIndex < NumBones; BoneIndex++)
 			{
 				int PoseDataOffset = SequenceOffset + NumBones * FrameIndex + BoneIndex;
 				BoneMatrices[PoseDataOffset] = ComponentSpaceTransforms[BoneIndex].ToMatrixWithScale();
+				FrameBounds += ComponentSpaceTransforms[BoneIndex].GetLocation();
 			}
 		}
 	}
-}
 
-void USIAnimationComponent::CreateAnimationData()
-{
-	TArray<UAnimSequence*> AnimSequencesExist;
-	for (int i = 0; i < AnimSequences.Num(); i++)
+	FBox GetRefPoseBoneBounds(const FReferenceSkeleton& RefSkeleton)
 	{
-		if (AnimSequences[i])
+		const TArray<FTransform>& RefBonePose = RefSkeleton.GetRefBonePose();
+
+		TArray<FTransform> ComponentSpaceTransforms;
+		ComponentSpaceTransforms.AddUninitialized(RefBonePose.Num());
+
+		FBox Result(ForceInit);
+		for (int32 BoneIndex = 0; BoneIndex < RefBonePose.Num(); BoneIndex++)
 		{
-			AnimSequencesExist.Add(AnimSequences[i]);
+			const int32 ParentIndex = RefSkeleton.GetParentIndex(BoneIndex);
+			ComponentSpaceTransforms[BoneIndex] = (ParentIndex == INDEX_NONE) ? RefBonePose[BoneIndex] : RefBonePose[BoneIndex] * ComponentSpaceTransforms[ParentIndex];
+			Result += ComponentSpaceTransforms[BoneIndex].GetLocation();
 		}
+		return Result;
 	}
 
+	void UpdateTierBoneData(TArray<FMatrix>& BoneMatrices, const FSIAnimationData::FPaletteTier& FullRateTier,
+		const FSIAnimationData::FPaletteTier& Tier, int SequenceIndex, int NumBones)
+	{
+		// coarse tiers are a subset of the full rate frames, no need to sample the sequence again
+		const int NumFullRateFrames = FullRateTier.SequenceLength[SequenceIndex];
+		const int NumFrames = Tier.SequenceLength[SequenceIndex];
+
+		for (int FrameIndex = 0; FrameIndex < NumFrames; FrameIndex++)
+		{
+			int SourceFrame = FMath::Min(FrameIndex * (int)Tier.RateDivisor, NumFullRateFrames - 1);
+			int SourceOffset = FullRateTier.SequenceOffset[SequenceIndex] + SourceFrame * NumBones;
+			int DestOffset = Tier.SequenceOffset[SequenceIndex] + FrameIndex * NumBones;
+			FMemory::Memcpy(&BoneMatrices[DestOffset], &BoneMatrices[SourceOffset], NumBones * sizeof(FMatrix));
+		}
+	}
+}
+
+void USIAnimationComponent::CreateAnimationData()
+{
+	SCOPE_CYCLE_COUNTER(STAT_SIBakeAnimationData);
+
+	TArray<UAnimSequence*> AnimSequencesExist;
+	GetExistingSequences(AnimSequencesExist);
+
 	if (AnimSequencesExist.Num() < 0)
 		return;
 
@@ -142,37 +267,195 @@ void USIAnimationComponent::CreateAnimationData()
 	int NumBones = Skeleton->GetReferenceSkeleton().GetRawBoneNum();
 
 	FBoneContainer BoneContainer;
-	TArray<FBoneIndexType> RequiredBones;
-	for (int i = 0; i < NumBones; i++)
-		RequiredBones.Add(i);
-	BoneContainer.InitializeTo(RequiredBones, FCurveEvaluationOption(), *Skeleton);
+	InitBoneContainer(BoneContainer);
 
-	int NumBoneMatrices = 0;
 	TArray<int> SequenceLengths;
 	SequenceLengths.AddZeroed(AnimSequencesExist.Num());
 	for (int i = 0; i < AnimSequencesExist.Num(); i++)
 	{
 		SequenceLengths[i] = AnimSequencesExist[i]->GetNumberOfFrames();
-		NumBoneMatrices += SequenceLengths[i] * NumBones;
 	}
 
-	AnimationData->Init(NumBones, SequenceLengths);
+	AnimationData->Init(NumBones, SequenceLengths, PaletteTiers);
 
 	TArray<FMatrix>* BoneMatrices = new TArray<FMatrix>();
-	BoneMatrices->AddUninitialized(NumBoneMatrices);
+	BoneMatrices->AddUninitialized(AnimationData->GetNumMatrices());
+
+	const FSIAnimationData::FPaletteTier& FullRateTier = AnimationData->GetPaletteTier(0);
+	TArray<FBox> FrameBoneBounds;
+	FrameBoneBounds.AddUninitialized(FullRateTier.NumMatrices / NumBones);
 
-	int SequenceOffset = 0;
 	for (int i = 0; i < AnimSequencesExist.Num(); i++)
 	{
-		FName SavedRetargetSource = AnimSequencesExist[i]->RetargetSource;
-		if (RetargetSource.IsValid())
-			AnimSequencesExist[i]->RetargetSource = RetargetSource;
-		UpdateBoneData(*BoneMatrices, SequenceOffset, AnimSequencesExist[i], &BoneContainer);
-		SequenceOffset += AnimSequencesExist[i]->GetNumberOfFrames() * NumBones;
-		AnimSequencesExist[i]->RetargetSource = SavedRetargetSource;
+		BakeSequence(*BoneMatrices, FrameBoneBounds, FullRateTier.SequenceOffset[i], AnimSequencesExist[i], BoneContainer);
+
+		for (int Tier = 1; Tier < AnimationData->GetNumPaletteTiers(); Tier++)
+		{
+			UpdateTierBoneData(*BoneMatrices, FullRateTier, AnimationData->GetPaletteTier(Tier), i, NumBones);
+		}
+	}
+
+	AnimationData->SetBoneBounds(MoveTemp(FrameBoneBounds), GetRefPoseBoneBounds(Skeleton->GetReferenceSkeleton()));
+
+	for (int Tier = 0; Tier < AnimationData->GetNumPaletteTiers(); Tier++)
+	{
+		UE_LOG(LogSkinnedInstancing, Log, TEXT("%s: palette tier %d (1/%d rate, LOD %d+) uses %d KB"),
+			*GetPathName(), Tier, AnimationData->GetPaletteTier(Tier).RateDivisor, AnimationData->GetPaletteTier(Tier).MinLOD,
+			(int32)(AnimationData->GetPaletteTierMemorySize(Tier) / 1024));
+	}
+
+	if (bKeepCPUBonePalette)
+	{
+		// the full rate tier comes first in the baked matrices
+		TSharedPtr<FSIBonePalette, ESPMode::ThreadSafe> NewPalette = MakeShared<FSIBonePalette, ESPMode::ThreadSafe>();
+		NewPalette->NumBones = NumBones;
+		NewPalette->SequenceOffset = FullRateTier.SequenceOffset;
+		NewPalette->Matrices.Append(BoneMatrices->GetData(), FullRateTier.NumMatrices);
+		SetCPUBonePalette(NewPalette);
 	}
 
 	AnimationData->Update(BoneMatrices);
 }
 
+void USIAnimationComponent::CreateCPUBonePalette()
+{
+	SCOPE_CYCLE_COUNTER(STAT_SIBakeAnimationData);
+
+	TArray<UAnimSequence*> AnimSequencesExist;
+	GetExistingSequences(AnimSequencesExist);
+
+	const int NumBones = Skeleton->GetReferenceSkeleton().GetRawBoneNum();
+
+	FBoneContainer BoneContainer;
+	InitBoneContainer(BoneContainer);
+
+	// same layout as the full rate tier of the GPU palette
+	TSharedPtr<FSIBonePalette, ESPMode::ThreadSafe> NewPalette = MakeShared<FSIBonePalette, ESPMode::ThreadSafe>();
+	NewPalette->NumBones = NumBones;
+
+	int NumFrames = 0;
+	for (UAnimSequence* AnimSequence : AnimSequencesExist)
+	{
+		NewPalette->SequenceOffset.Add(NumFrames * NumBones);
+		NumFrames += AnimSequence->GetNumberOfFrames();
+	}
+
+	NewPalette->Matrices.AddUninitialized(NumFrames * NumBones);
+	TArray<FBox> FrameBoneBounds;
+	FrameBoneBounds.AddUninitialized(NumFrames);
+
+	for (int i = 0; i < AnimSequencesExist.Num(); i++)
+	{
+		BakeSequence(NewPalette->Matrices, FrameBoneBounds, NewPalette->SequenceOffset[i], AnimSequencesExist[i], BoneContainer);
+	}
+
+	SetCPUBonePalette(NewPalette);
+}
+
+void USIAnimationComponent::GetExistingSequences(TArray<UAnimSequence*>& OutSequences) const
+{
+	for (int i = 0; i < AnimSequences.Num(); i++)
+	{
+		if (AnimSequences[i])
+		{
+			OutSequences.Add(AnimSequences[i]);
+		}
+	}
+}
+
+void USIAnimationComponent::InitBoneContainer(FBoneContainer& OutBoneContainer) const
+{
+	int NumBones = Skeleton->GetReferenceSkeleton().GetRawBoneNum();
+
+	TArray<FBoneIndexType> RequiredBones;
+	for (int i = 0; i < NumBones; i++)
+		RequiredBones.Add(i);
+	OutBoneContainer.InitializeTo(RequiredBones, FCurveEvaluationOption(), *Skeleton);
+}
+
+void USIAnimationComponent::BakeSequence(TArray<FMatrix>& BoneMatrices, TArray<FBox>& FrameBoneBounds, int SequenceOffset,
+	UAnimSequence* AnimSequence, const FBoneContainer& BoneContainer)
+{
+	FName SavedRetargetSource = AnimSequence->RetargetSource;
+	if (RetargetSource.IsValid())
+		AnimSequence->RetargetSource = RetargetSource;
+	UpdateBoneData(BoneMatrices, FrameBoneBounds, SequenceOffset, AnimSequence, &BoneContainer);
+	AnimSequence->RetargetSource = SavedRetargetSource;
+}
+
+void USIAnimationComponent::SetCPUBonePalette(const TSharedPtr<FSIBonePalette, ESPMode::ThreadSafe>& NewPalette)
+{
+	if (NewPalette.IsValid())
+	{
+		NewPalette->UpdateMaxBoneDistance();
+		if (bCompactCPUBonePalette)
+			NewPalette->Compact();
+		INC_MEMORY_STAT_BY(STAT_SICPUBonePaletteMemory, NewPalette->GetAllocatedSize());
+	}
+
+	FRWScopeLock Lock(CPUBonePaletteLock, SLT_Write);
+	if (CPUBonePalette.IsValid())
+	{
+		DEC_MEMORY_STAT_BY(STAT_SICPUBonePaletteMemory, CPUBonePalette->GetAllocatedSize());
+	}
+	CPUBonePalette = NewPalette;
+}
+
+void USIAnimationComponent::BakeRootMotion()
+{
+	SCOPE_CYCLE_COUNTER(STAT_SIBakeRootMotion);
+
+	RootMotionTracks.Reset(AnimSequences.Num());
+
+	for (UAnimSequence* AnimSequence : AnimSequences)
+	{
+		FSIRootMotionTrack& Track = RootMotionTracks[RootMotionTracks.AddDefaulted()];
+		if (!AnimSequence || !AnimSequence->bEnableRootMotion)
+			continue;
+
+		// same frames as the full rate palette
+		const int NumFrames = AnimSequence->GetNumberOfFrames();
+		Track.Length = AnimSequence->SequenceLength;
+		Track.Interval = (NumFrames > 1) ? (AnimSequence->SequenceLength / (NumFrames - 1)) : MINIMUM_ANIMATION_LENGTH;
+		Track.Translations.Reserve(NumFrames);
+		Track.Rotations.Reserve(NumFrames);
+
+		const FTransform FirstFrame = AnimSequence->ExtractRootTrackTransform(0.0f, nullptr);
+		for (int FrameIndex = 0; FrameIndex < NumFrames; FrameIndex++)
+		{
+			const FTransform Root = AnimSequence->ExtractRootTrackTransform(FrameIndex * Track.Interval, nullptr).GetRelativeTransform(FirstFrame);
+			Track.Translations.Add(Root.GetTranslation());
+			Track.Rotations.Add(Root.GetRotation());
+		}
+	}
+}
+
+void USIAnimationComponent::BakeNotifies()
+{
+	NotifyTracks.Reset(AnimSequences.Num());
+
+	for (UAnimSequence* AnimSequence : AnimSequences)
+	{
+		FSINotifyTrack& Track = NotifyTracks[NotifyTracks.AddDefaulted()];
+		if (!AnimSequence || AnimSequence->Notifies.Num() == 0)
+			continue;
+
+		TArray<const FAnimNotifyEvent*> Events;
+		for (const FAnimNotifyEvent& Event : AnimSequence->Notifies)
+		{
+			Events.Add(&Event);
+		}
+		Events.Sort([](const FAnimNotifyEvent& A, const FAnimNotifyEvent& B) { return A.GetTriggerTime() < B.GetTriggerTime(); });
+
+		Track.Length = AnimSequence->SequenceLength;
+		Track.Times.Reserve(Events.Num());
+		Track.Names.Reserve(Events.Num());
+		for (const FAnimNotifyEvent* Event : Events)
+		{
+			Track.Times.Add(Event->GetTriggerTime());
+			Track.Names.Add(Event->NotifyName);
+		}
+	}
+}
+
 #pragma optimize( "", on )
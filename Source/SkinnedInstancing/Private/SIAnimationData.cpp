@@ -1,11 +1,99 @@
 #include "SIAnimationData.h"
+#include "SIAnimationComponent.h"
 #include "Matrix3x4.h"
 #include "RHI.h"
 #include "RenderingThread.h"
+#include "SIStats.h"
+#include "HAL/ThreadSafeCounter.h"
+
+DECLARE_MEMORY_STAT(TEXT("Bone Palette Memory"), STAT_SIBonePaletteMemory, STATGROUP_SkinnedInstancing);
+DECLARE_CYCLE_STAT(TEXT("Upload Bone Palette"), STAT_SIUploadBonePalette, STATGROUP_SkinnedInstancing);
 
 #pragma optimize( "", off )
 
+namespace
+{
+	/** 0 is never handed out, so it can stand for no palette. */
+	FThreadSafeCounter GPaletteGeneration;
+}
+
+FMatrix FSIBonePalette::Sample(const FSIMeshInstanceData::FAnimData* AnimDatas, int32 BoneIndex, bool bAnimationBlend, bool bFrameLerp) const
+{
+	FMatrix Result(ForceInitToZero);
+
+	const int32 NumLayers = bAnimationBlend ? 2 : 1;
+	for (int32 Layer = 0; Layer < NumLayers; Layer++)
+	{
+		const FSIMeshInstanceData::FAnimData& AnimData = AnimDatas[Layer];
+		if (!SequenceOffset.IsValidIndex(AnimData.Sequence))
+			continue;
+
+		// weights are quantized like the packed animation words the shader reads
+		const float BlendWeight = bAnimationBlend ? (uint32)(AnimData.BlendWeight * 1000) * 0.001f : 1.0f;
+		const float FrameLerp = bFrameLerp ? (uint32)(AnimData.FrameLerp * 1000) * 0.001f : 0.0f;
+		if (BlendWeight <= 0)
+			continue;
+
+		const uint32 BoneOffset = SequenceOffset[AnimData.Sequence] + BoneIndex;
+		FMatrix Bone = GetBone(BoneOffset + AnimData.PrevFrame * NumBones);
+
+		if (FrameLerp > 0)
+		{
+			const FMatrix Next = GetBone(BoneOffset + AnimData.NextFrame * NumBones);
+			Bone = Bone * (1.0f - FrameLerp) + Next * FrameLerp;
+		}
+
+		Result += Bone * BlendWeight;
+	}
+
+	return Result;
+}
+
+void FSICompactBone::Encode(const FMatrix& Bone)
+{
+	const FTransform Transform(Bone);
+
+	// q and -q are the same rotation, keep w positive
+	FQuat Quat = Transform.GetRotation().GetNormalized();
+	if (Quat.W < 0)
+		Quat = FQuat(-Quat.X, -Quat.Y, -Quat.Z, -Quat.W);
+
+	Rotation[0] = (int16)FMath::RoundToInt(Quat.X * MAX_int16);
+	Rotation[1] = (int16)FMath::RoundToInt(Quat.Y * MAX_int16);
+	Rotation[2] = (int16)FMath::RoundToInt(Quat.Z * MAX_int16);
+	Rotation[3] = (int16)FMath::RoundToInt(Quat.W * MAX_int16);
+	Translation = Transform.GetTranslation();
+	Scale = Transform.GetScale3D().GetAbsMax();
+}
+
+FMatrix FSICompactBone::Decode() const
+{
+	const FQuat Quat = FQuat(Rotation[0], Rotation[1], Rotation[2], Rotation[3]).GetNormalized();
+	return FTransform(Quat, Translation, FVector(Scale)).ToMatrixWithScale();
+}
+
+void FSIBonePalette::Compact()
+{
+	CompactBones.SetNumUninitialized(Matrices.Num());
+	for (int32 i = 0; i < Matrices.Num(); i++)
+	{
+		CompactBones[i].Encode(Matrices[i]);
+	}
+	Matrices.Empty();
+}
+
+void FSIBonePalette::UpdateMaxBoneDistance()
+{
+	float MaxDistSquared = 0;
+	for (const FMatrix& Bone : Matrices)
+	{
+		MaxDistSquared = FMath::Max(MaxDistSquared, Bone.GetOrigin().SizeSquared());
+	}
+	MaxBoneDistance = FMath::Sqrt(MaxDistSquared);
+}
+
 FSIAnimationData::FSIAnimationData()
+	: RefPoseBoneBounds(ForceInit)
 {
 }
 
@@ -24,27 +112,120 @@ void FSIAnimationData::Release()
 
 void FSIAnimationData::ReleaseData_RenderThread()
 {
+	DEC_MEMORY_STAT_BY(STAT_SIBonePaletteMemory, BufferBytes);
+	BufferBytes = 0;
 	VertexBufferRHI.SafeRelease();
 	VertexBufferSRV.SafeRelease();
 }
 
-void FSIAnimationData::Init(int InNumBones, const TArray<int>& InSequenceLength)
+void FSIAnimationData::Init(int InNumBones, const TArray<int>& InSequenceLength, const TArray<FSIAnimationPaletteTier>& InPaletteTiers)
 {
 	NumBones = InNumBones;
+	Generation = (uint32)GPaletteGeneration.Increment();
+
+	PaletteTiers.Empty(InPaletteTiers.Num() + 1);
 
-	SequenceLength.Empty();
-	SequenceLength.Append(InSequenceLength);
+	// tier 0 is the full rate palette
+	FPaletteTier& FullRateTier = PaletteTiers[PaletteTiers.AddDefaulted()];
+	FullRateTier.RateDivisor = 1;
+	FullRateTier.MinLOD = 0;
 
-	SequenceOffset.Empty();
-	SequenceOffset.AddZeroed(InSequenceLength.Num());
+	for (const FSIAnimationPaletteTier& Desc : InPaletteTiers)
+	{
+		if (Desc.RateDivisor < 2)
+			continue;
+
+		FPaletteTier& Tier = PaletteTiers[PaletteTiers.AddDefaulted()];
+		Tier.RateDivisor = Desc.RateDivisor;
+		Tier.MinLOD = FMath::Max(Desc.MinLOD, 1);
+	}
 
-	const uint32 FrameSize = NumBones * 3 * sizeof(FVector4);
+	// all tiers live in the same buffer, one after the other
 	int Offset = 0;
-	for (int SequenceIndex = 0; SequenceIndex < SequenceLength.Num(); SequenceIndex++)
+	for (FPaletteTier& Tier : PaletteTiers)
+	{
+		Tier.SequenceLength.Empty(InSequenceLength.Num());
+		Tier.SequenceOffset.Empty(InSequenceLength.Num());
+		Tier.NumMatrices = 0;
+
+		for (int SequenceIndex = 0; SequenceIndex < InSequenceLength.Num(); SequenceIndex++)
+		{
+			const int FullRateLength = InSequenceLength[SequenceIndex];
+			const int Length = FMath::DivideAndRoundUp(FMath::Max(FullRateLength - 1, 0), (int)Tier.RateDivisor) + 1;
+
+			Tier.SequenceOffset.Add(Offset);
+			Tier.SequenceLength.Add(Length);
+			Tier.NumMatrices += Length * NumBones;
+			Offset += Length * NumBones;
+		}
+	}
+}
+
+int32 FSIAnimationData::GetPaletteTierForLOD(int32 LODIndex) const
+{
+	int32 Result = 0;
+	for (int32 Tier = 1; Tier < PaletteTiers.Num(); Tier++)
+	{
+		if (LODIndex >= PaletteTiers[Tier].MinLOD && PaletteTiers[Tier].RateDivisor > PaletteTiers[Result].RateDivisor)
+			Result = Tier;
+	}
+	return Result;
+}
+
+void FSIAnimationData::SetBoneBounds(TArray<FBox>&& InFrameBoneBounds, const FBox& InRefPoseBoneBounds)
+{
+	check(InFrameBoneBounds.Num() * NumBones == PaletteTiers[0].NumMatrices);
+
+	FrameBoneBounds = MoveTemp(InFrameBoneBounds);
+	RefPoseBoneBounds = InRefPoseBoneBounds;
+}
+
+FBox FSIAnimationData::GetPlayedBoneBounds(const FSIMeshInstanceData::FAnimData* AnimDatas) const
+{
+	FBox Result(ForceInit);
+	if (!HasBoneBounds())
+		return Result;
+
+	const FPaletteTier& FullRateTier = PaletteTiers[0];
+	for (int32 Layer = 0; Layer < 2; Layer++)
+	{
+		const FSIMeshInstanceData::FAnimData& AnimData = AnimDatas[Layer];
+		if ((Layer > 0 && AnimData.BlendWeight <= 0) || !FullRateTier.SequenceOffset.IsValidIndex(AnimData.Sequence))
+			continue;
+
+		// frame bounds are stored in palette order, one box per NumBones matrices
+		const int32 FirstFrame = FullRateTier.SequenceOffset[AnimData.Sequence] / NumBones;
+		Result += FrameBoneBounds[FirstFrame + AnimData.PrevFrame];
+		Result += FrameBoneBounds[FirstFrame + AnimData.NextFrame];
+	}
+	return Result;
+}
+
+uint32 FSIAnimationData::GetNumMatrices() const
+{
+	uint32 Result = 0;
+	for (const FPaletteTier& Tier : PaletteTiers)
+		Result += Tier.NumMatrices;
+	return Result;
+}
+
+SIZE_T FSIAnimationData::GetResourceSize() const
+{
+	SIZE_T Size = sizeof(*this);
+	Size += PaletteTiers.GetAllocatedSize();
+	Size += FrameBoneBounds.GetAllocatedSize();
+	for (const FPaletteTier& Tier : PaletteTiers)
 	{
-		SequenceOffset[SequenceIndex] = Offset;
-		Offset += SequenceLength[SequenceIndex] * NumBones;
+		Size += Tier.SequenceOffset.GetAllocatedSize() + Tier.SequenceLength.GetAllocatedSize();
 	}
+	return Size;
+}
+
+SIZE_T FSIAnimationData::GetPaletteTierMemorySize(int32 Tier) const
+{
+	if (!PaletteTiers.IsValidIndex(Tier))
+		return 0;
+	return PaletteTiers[Tier].NumMatrices * 3 * sizeof(FVector4);
 }
 
 void FSIAnimationData::Update(TArray<FMatrix>* ReferenceToLocalMatrices)
@@ -63,19 +244,19 @@ void FSIAnimationData::UpdateData_RenderThread(TArray<FMatrix>* InReferenceToLoc
 	if (!InReferenceToLocalMatrices)
 		return;
 
-	TArray<FMatrix>& ReferenceToLocalMatrices = *InReferenceToLocalMatrices;
+	SCOPE_CYCLE_COUNTER(STAT_SIUploadBonePalette);
 
-	if (VertexBufferRHI)
-		VertexBufferRHI.SafeRelease();
+	TArray<FMatrix>& ReferenceToLocalMatrices = *InReferenceToLocalMatrices;
 
-	if (VertexBufferSRV)
-		VertexBufferSRV.SafeRelease();
+	ReleaseData_RenderThread();
 
 	uint32 BufferSize = ReferenceToLocalMatrices.Num() * 3 * sizeof(FVector4);
 
 	FRHIResourceCreateInfo CreateInfo;
 	VertexBufferRHI = RHICreateVertexBuffer(BufferSize, (BUF_Dynamic | BUF_ShaderResource), CreateInfo);
 	VertexBufferSRV = RHICreateShaderResourceView(VertexBufferRHI, sizeof(FVector4), PF_A32B32G32R32F);
+	BufferBytes = BufferSize;
+	INC_MEMORY_STAT_BY(STAT_SIBonePaletteMemory, BufferBytes);
 
 	if (ReferenceToLocalMatrices.Num() > 0)
 	{
@@ -0,0 +1,39 @@
+#include "SIAnimationPlayer.h"
+
+FTransform FSIRootMotionTrack::Evaluate(float Time) const
+{
+	if (!HasMotion())
+		return FTransform::Identity;
+
+	const int32 LastFrame = Translations.Num() - 1;
+	const float FrameTime = FMath::Clamp(Time / Interval, 0.0f, (float)LastFrame);
+	const int32 PrevFrame = FMath::Min((int32)FrameTime, LastFrame);
+	const int32 NextFrame = FMath::Min(PrevFrame + 1, LastFrame);
+	const float Lerp = FrameTime - PrevFrame;
+
+	return FTransform(FQuat::Slerp(Rotations[PrevFrame], Rotations[NextFrame], Lerp),
+		FMath::Lerp(Translations[PrevFrame], Translations[NextFrame], Lerp));
+}
+
+FTransform FSIRootMotionTrack::Extract(float EndTime, float PlayedTime, bool bLoop) const
+{
+	FTransform Result = FTransform::Identity;
+	if (!HasMotion())
+		return Result;
+
+	float End = FMath::Clamp(EndTime, 0.0f, Length);
+	float Remaining = PlayedTime;
+	while (Remaining > KINDA_SMALL_NUMBER)
+	{
+		// walks back from EndTime, so every segment happened before the motion gathered so far
+		const float Start = FMath::Max(End - Remaining, 0.0f);
+		Result = Result * Evaluate(End).GetRelativeTransform(Evaluate(Start));
+		Remaining -= End - Start;
+
+		if (!bLoop || Length <= 0)
+			break;
+		End = Length;
+	}
+
+	return Result;
+}
@@ -0,0 +1,775 @@
+#include "SIBenchmarkCommandlet.h"
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "GameFramework/Actor.h"
+#include "Animation/AnimSequence.h"
+#include "Rendering/SkeletalMeshRenderData.h"
+#include "HAL/PlatformTime.h"
+#include "HAL/IConsoleManager.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "Math/RandomStream.h"
+#include "Misc/EngineVersion.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeExit.h"
+#include "SIMeshComponent.h"
+#include "SIAnimationComponent.h"
+#include "SIUnitComponent.h"
+#include "SIAnimationData.h"
+#include "SIInstancePacking.h"
+#include "SkinnedInstancing.h"
+
+namespace
+{
+	enum EBenchmarkPhase
+	{
+		Phase_TickInstances,
+		Phase_UpdateDynamicData,
+		Phase_CalcBounds,
+		Phase_LODBinning,
+		Phase_InstancePacking,
+		Phase_Num
+	};
+
+	const TCHAR* GBenchmarkPhaseNames[Phase_Num] =
+	{
+		TEXT("TickInstances"),
+		TEXT("UpdateDynamicData"),
+		TEXT("CalcBounds"),
+		TEXT("LODBinning"),
+		TEXT("InstancePacking"),
+	};
+
+	/** Forwards to the real allocator and counts the allocations made and the bytes freed while the benchmark runs. */
+	class FCountingMalloc final : public FMalloc
+	{
+	public:
+		explicit FCountingMalloc(FMalloc* InInner) : Inner(InInner) {}
+
+		virtual void* Malloc(SIZE_T Count, uint32 Alignment) override
+		{
+			NumAllocations.Increment();
+			NumBytes.Add(Count);
+			return Inner->Malloc(Count, Alignment);
+		}
+
+		virtual void* Realloc(void* Original, SIZE_T Count, uint32 Alignment) override
+		{
+			CountFree(Original);
+			if (Count > 0)
+			{
+				NumAllocations.Increment();
+				NumBytes.Add(Count);
+			}
+			return Inner->Realloc(Original, Count, Alignment);
+		}
+
+		virtual void Free(void* Original) override
+		{
+			CountFree(Original);
+			Inner->Free(Original);
+		}
+
+		virtual bool GetAllocationSize(void* Original, SIZE_T& SizeOut) override { return Inner->GetAllocationSize(Original, SizeOut); }
+		virtual SIZE_T QuantizeSize(SIZE_T Count, uint32 Alignment) override { return Inner->QuantizeSize(Count, Alignment); }
+		virtual void Trim() override { Inner->Trim(); }
+		virtual bool IsInternallyThreadSafe() const override { return Inner->IsInternallyThreadSafe(); }
+		virtual const TCHAR* GetDescriptiveName() override { return TEXT("SIBenchmarkCountingMalloc"); }
+
+		FMalloc* GetInner() const { return Inner; }
+
+	private:
+		/** Allocators that cannot size a block count nothing, their retained bytes read as allocated bytes. */
+		void CountFree(void* Original)
+		{
+			SIZE_T Size = 0;
+			if (Original && Inner->GetAllocationSize(Original, Size))
+				NumFreedBytes.Add(Size);
+		}
+
+	public:
+		FThreadSafeCounter NumAllocations;
+		FThreadSafeCounter64 NumBytes;
+		FThreadSafeCounter64 NumFreedBytes;
+
+	private:
+		FMalloc* Inner;
+	};
+
+	FCountingMalloc* GetCountingMalloc()
+	{
+		static FCountingMalloc* CountingMalloc = nullptr;
+		if (!CountingMalloc)
+			CountingMalloc = new FCountingMalloc(GMalloc);
+		return CountingMalloc;
+	}
+
+	/** Time and heap bytes of one measured block, GMalloc is swapped for the counting allocator meanwhile. */
+	struct FCostSample
+	{
+		double Ms = 0;
+		int64 NumBytes = 0;
+		/** Bytes still allocated after the block, UObjects included. */
+		int64 NumRetainedBytes = 0;
+		int32 NumAllocations = 0;
+	};
+
+	template <typename FunctionType>
+	FCostSample MeasureCost(FunctionType&& Function)
+	{
+		FCountingMalloc* CountingMalloc = GetCountingMalloc();
+		FMalloc* SavedMalloc = GMalloc;
+		GMalloc = CountingMalloc;
+
+		const int32 StartAllocations = CountingMalloc->NumAllocations.GetValue();
+		const int64 StartBytes = CountingMalloc->NumBytes.GetValue();
+		const int64 StartFreedBytes = CountingMalloc->NumFreedBytes.GetValue();
+		const double StartTime = FPlatformTime::Seconds();
+
+		Function();
+
+		FCostSample Result;
+		Result.Ms = (FPlatformTime::Seconds() - StartTime) * 1000.0;
+		Result.NumBytes = CountingMalloc->NumBytes.GetValue() - StartBytes;
+		Result.NumRetainedBytes = Result.NumBytes - (CountingMalloc->NumFreedBytes.GetValue() - StartFreedBytes);
+		Result.NumAllocations = CountingMalloc->NumAllocations.GetValue() - StartAllocations;
+
+		GMalloc = SavedMalloc;
+		return Result;
+	}
+
+	struct FBenchmarkFrame
+	{
+		double PhaseMs[Phase_Num] = {};
+		int32 NumAllocations = 0;
+		int64 NumAllocatedBytes = 0;
+		int32 NumDrawCalls = 0;
+	};
+
+	class FPhaseTimer
+	{
+	public:
+		FPhaseTimer(FBenchmarkFrame& InFrame, EBenchmarkPhase InPhase)
+			: Frame(InFrame), Phase(InPhase), StartTime(FPlatformTime::Seconds())
+		{
+		}
+
+		~FPhaseTimer()
+		{
+			Frame.PhaseMs[Phase] += (FPlatformTime::Seconds() - StartTime) * 1000.0;
+		}
+
+	private:
+		FBenchmarkFrame& Frame;
+		EBenchmarkPhase Phase;
+		double StartTime;
+	};
+
+	void WriteResults(const FString& BaseName, const FString& Config, const TArray<FBenchmarkFrame>& Frames)
+	{
+		const FString OutputDir = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Profiling"), TEXT("SkinnedInstancing"));
+
+		// per frame rows, easy to diff and plot
+		FString Csv = TEXT("Frame");
+		for (int32 Phase = 0; Phase < Phase_Num; Phase++)
+			Csv += FString::Printf(TEXT(",%sMs"), GBenchmarkPhaseNames[Phase]);
+		Csv += TEXT(",TotalMs,Allocations,AllocatedBytes,DrawCalls\n");
+
+		double SumMs[Phase_Num] = {};
+		double MinMs[Phase_Num];
+		double MaxMs[Phase_Num] = {};
+		for (int32 Phase = 0; Phase < Phase_Num; Phase++)
+			MinMs[Phase] = MAX_dbl;
+
+		double SumAllocations = 0;
+		double SumAllocatedBytes = 0;
+		double SumDrawCalls = 0;
+
+		for (int32 FrameIndex = 0; FrameIndex < Frames.Num(); FrameIndex++)
+		{
+			const FBenchmarkFrame& Frame = Frames[FrameIndex];
+			double TotalMs = 0;
+
+			Csv += FString::Printf(TEXT("%d"), FrameIndex);
+			for (int32 Phase = 0; Phase < Phase_Num; Phase++)
+			{
+				Csv += FString::Printf(TEXT(",%.4f"), Frame.PhaseMs[Phase]);
+				TotalMs += Frame.PhaseMs[Phase];
+				SumMs[Phase] += Frame.PhaseMs[Phase];
+				MinMs[Phase] = FMath::Min(MinMs[Phase], Frame.PhaseMs[Phase]);
+				MaxMs[Phase] = FMath::Max(MaxMs[Phase], Frame.PhaseMs[Phase]);
+			}
+			Csv += FString::Printf(TEXT(",%.4f,%d,%lld,%d\n"), TotalMs, Frame.NumAllocations, Frame.NumAllocatedBytes, Frame.NumDrawCalls);
+
+			SumAllocations += Frame.NumAllocations;
+			SumAllocatedBytes += Frame.NumAllocatedBytes;
+			SumDrawCalls += Frame.NumDrawCalls;
+		}
+
+		const double NumFrames = FMath::Max(Frames.Num(), 1);
+
+		FString Json = TEXT("{\n");
+		Json += Config;
+		Json += TEXT("\t\"phases\": {\n");
+		for (int32 Phase = 0; Phase < Phase_Num; Phase++)
+		{
+			Json += FString::Printf(TEXT("\t\t\"%s\": { \"avg_ms\": %.4f, \"min_ms\": %.4f, \"max_ms\": %.4f }%s\n"),
+				GBenchmarkPhaseNames[Phase], SumMs[Phase] / NumFrames, Frames.Num() > 0 ? MinMs[Phase] : 0.0, MaxMs[Phase],
+				Phase + 1 < Phase_Num ? TEXT(",") : TEXT(""));
+		}
+		Json += TEXT("\t},\n");
+		Json += FString::Printf(TEXT("\t\"allocations_per_frame\": %.2f,\n"), SumAllocations / NumFrames);
+		Json += FString::Printf(TEXT("\t\"allocated_bytes_per_frame\": %.0f,\n"), SumAllocatedBytes / NumFrames);
+		Json += FString::Printf(TEXT("\t\"draw_calls_per_frame\": %.2f\n"), SumDrawCalls / NumFrames);
+		Json += TEXT("}\n");
+
+		const FString CsvPath = FPaths::Combine(OutputDir, BaseName + TEXT(".csv"));
+		const FString JsonPath = FPaths::Combine(OutputDir, BaseName + TEXT(".json"));
+		FFileHelper::SaveStringToFile(Csv, *CsvPath);
+		FFileHelper::SaveStringToFile(Json, *JsonPath);
+
+		UE_LOG(LogSkinnedInstancing, Display, TEXT("Benchmark results written to %s and %s"), *CsvPath, *JsonPath);
+		for (int32 Phase = 0; Phase < Phase_Num; Phase++)
+		{
+			UE_LOG(LogSkinnedInstancing, Display, TEXT("  %-20s avg %.3f ms, max %.3f ms"), GBenchmarkPhaseNames[Phase], SumMs[Phase] / NumFrames, MaxMs[Phase]);
+		}
+		UE_LOG(LogSkinnedInstancing, Display, TEXT("  %.1f allocations per frame, %.1f draw calls per frame"), SumAllocations / NumFrames, SumDrawCalls / NumFrames);
+	}
+}
+
+void USIBenchmarkCommandlet::CompareAgents(AActor* Actor, USIMeshComponent* MeshComponent, int32 NumUnits, const FString& BaseName)
+{
+	const int32 GridSize = FMath::CeilToInt(FMath::Sqrt((float)FMath::Max(NumUnits, 1)));
+	TArray<FTransform> Transforms;
+	Transforms.Reserve(NumUnits);
+	for (int32 i = 0; i < NumUnits; i++)
+		Transforms.Add(FTransform(FVector((i % GridSize) * 200.0f, (i / GridSize) * 200.0f, 0)));
+
+	const SIZE_T BaseStoreSize = MeshComponent->Instances.GetAllocatedSize();
+
+	// units, one scene component each
+	TArray<USIUnitComponent*> Units;
+	Units.Reserve(NumUnits);
+	FCostSample UnitSpawn = MeasureCost([&]()
+	{
+		for (const FTransform& Transform : Transforms)
+		{
+			USIUnitComponent* Unit = NewObject<USIUnitComponent>(Actor);
+			Unit->SetRelativeTransform(Transform);
+			Unit->MeshComponent = MeshComponent;
+			Unit->RegisterComponent();
+			Units.Add(Unit);
+		}
+	});
+	FCostSample UnitUpdate = MeasureCost([&]()
+	{
+		for (USIUnitComponent* Unit : Units)
+			Unit->TickComponent(1.0f / 30.0f, LEVELTICK_All, nullptr);
+	});
+	const SIZE_T UnitStoreSize = MeshComponent->Instances.GetAllocatedSize() - BaseStoreSize;
+	FCostSample UnitDespawn = MeasureCost([&]()
+	{
+		for (USIUnitComponent* Unit : Units)
+			Unit->DestroyComponent();
+		Units.Reset();
+	});
+
+	// agents, a handle into the mesh component's instance arrays
+	TArray<int32> Agents;
+	FCostSample AgentSpawn = MeasureCost([&]()
+	{
+		Agents = MeshComponent->AddInstances(Transforms);
+	});
+	FCostSample AgentUpdate = MeasureCost([&]()
+	{
+		MeshComponent->UpdateInstanceTransforms(Agents, Transforms);
+	});
+	const SIZE_T AgentStoreSize = MeshComponent->Instances.GetAllocatedSize() - BaseStoreSize;
+	FCostSample AgentDespawn = MeasureCost([&]()
+	{
+		MeshComponent->RemoveInstances(Agents);
+	});
+
+	// what spawning left allocated, the unit objects come from the heap like the store growth so each is counted once.
+	// The list of ids the agents return is the caller's, like the reserved unit list
+	const double Num = FMath::Max(NumUnits, 1);
+	const double UnitBytesPerUnit = UnitSpawn.NumRetainedBytes / Num;
+	const double AgentBytesPerUnit = (AgentSpawn.NumRetainedBytes - (int64)Agents.GetAllocatedSize()) / Num;
+
+	FString Json = TEXT("{\n");
+	Json += FString::Printf(TEXT("\t\"units\": %d,\n"), NumUnits);
+	Json += FString::Printf(TEXT("\t\"unit_component\": { \"spawn_ms\": %.3f, \"update_ms\": %.3f, \"despawn_ms\": %.3f, \"spawn_allocations\": %d, \"bytes_per_unit\": %.1f, \"instance_store_bytes_per_unit\": %.1f },\n"),
+		UnitSpawn.Ms, UnitUpdate.Ms, UnitDespawn.Ms, UnitSpawn.NumAllocations, UnitBytesPerUnit, UnitStoreSize / Num);
+	Json += FString::Printf(TEXT("\t\"agent\": { \"spawn_ms\": %.3f, \"update_ms\": %.3f, \"despawn_ms\": %.3f, \"spawn_allocations\": %d, \"bytes_per_unit\": %.1f, \"instance_store_bytes_per_unit\": %.1f }\n"),
+		AgentSpawn.Ms, AgentUpdate.Ms, AgentDespawn.Ms, AgentSpawn.NumAllocations, AgentBytesPerUnit, AgentStoreSize / Num);
+	Json += TEXT("}\n");
+
+	const FString JsonPath = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Profiling"), TEXT("SkinnedInstancing"), BaseName + TEXT("-Agents.json"));
+	FFileHelper::SaveStringToFile(Json, *JsonPath);
+
+	UE_LOG(LogSkinnedInstancing, Display, TEXT("Agent comparison written to %s"), *JsonPath);
+	UE_LOG(LogSkinnedInstancing, Display, TEXT("  USIUnitComponent spawn %.3f ms, update %.3f ms, %.1f bytes per unit"), UnitSpawn.Ms, UnitUpdate.Ms, UnitBytesPerUnit);
+	UE_LOG(LogSkinnedInstancing, Display, TEXT("  Agent            spawn %.3f ms, update %.3f ms, %.1f bytes per unit"), AgentSpawn.Ms, AgentUpdate.Ms, AgentBytesPerUnit);
+}
+
+bool USIBenchmarkCommandlet::StressConcurrentWrites(AActor* Actor, USIAnimationComponent* AnimationComponent, USkeletalMesh* SkeletalMesh,
+	int32 NumInstances, int32 NumWriters, int32 NumRounds, int32 Seed)
+{
+	const int32 NumSequences = FMath::Max(AnimationComponent->AnimSequences.Num(), 1);
+
+	// the update budget is measured in wall clock time, it would hold back other instances in the two runs and they
+	// could never end the same
+	IConsoleVariable* UpdateBudgetMs = IConsoleManager::Get().FindConsoleVariable(TEXT("r.SkinnedInstancing.UpdateBudgetMs"));
+	const float SavedUpdateBudgetMs = UpdateBudgetMs->GetFloat();
+	UpdateBudgetMs->Set(0.0f, ECVF_SetByCode);
+	ON_SCOPE_EXIT
+	{
+		UpdateBudgetMs->Set(SavedUpdateBudgetMs, ECVF_SetByCode);
+	};
+
+	const int32 CommandsPerWriter = FMath::Max(NumInstances / NumWriters, 1);
+
+	TArray<FTransform> Transforms;
+	Transforms.Reserve(NumInstances);
+	for (int32 i = 0; i < NumInstances; i++)
+		Transforms.Add(FTransform(FVector(i * 100.0f, 0, 0)));
+
+	auto Run = [&](bool bSingleThreaded)
+	{
+		USIMeshComponent* MeshComponent = NewObject<USIMeshComponent>(Actor);
+		MeshComponent->SkeletalMesh = SkeletalMesh;
+		MeshComponent->bEnableUpdateRateOptimizations = false;
+		MeshComponent->SetAnimationComponent(AnimationComponent);
+		MeshComponent->SetupAttachment(AnimationComponent);
+		MeshComponent->RegisterComponent();
+		MeshComponent->AddInstances(Transforms);
+
+		double RecordMs = 0;
+		double FlushMs = 0;
+		for (int32 Round = 0; Round < NumRounds; Round++)
+		{
+			MeshComponent->BeginConcurrentWrites(NumWriters);
+
+			// nothing changes the store while the writers run, they can all read the handles
+			const TArray<int32>& Handles = MeshComponent->Instances.Handles;
+
+			auto RecordWrites = [&](int32 Writer)
+			{
+				FRandomStream Random(Seed + Round * NumWriters + Writer);
+				FSIInstanceCommandBuffer& Buffer = MeshComponent->GetCommandBuffer(Writer);
+				for (int32 i = 0; i < CommandsPerWriter; i++)
+				{
+					const int32 Id = Handles.Num() > 0 ? Handles[Random.RandHelper(Handles.Num())] : INDEX_NONE;
+					const float Roll = Random.FRand();
+					if (Roll < 0.6f)
+						Buffer.SetTransform(Id, FTransform(FRotator(0, Random.FRandRange(0, 360), 0), Random.VRand() * 1000.0f));
+					else if (Roll < 0.9f)
+						Buffer.CrossFade(Id, Random.RandHelper(NumSequences), 0.2f, Random.FRand() < 0.5f);
+					else if (Roll < 0.95f)
+						Buffer.Remove(Id);
+					else
+						Buffer.Add(FTransform(Random.VRand() * 1000.0f));
+				}
+			};
+
+			double StartTime = FPlatformTime::Seconds();
+
+			// a dynamic data task reads the store meanwhile, as the one of the last frame can while gameplay starts recording
+			if (MeshComponent->CanBuildDynamicDataAsync() && !MeshComponent->DynamicDataTask.IsValid())
+				MeshComponent->BeginDynamicDataTask();
+
+			FGraphEventArray WriterTasks;
+			for (int32 Writer = 0; Writer < NumWriters; Writer++)
+			{
+				if (bSingleThreaded)
+					RecordWrites(Writer);
+				else
+					WriterTasks.Add(FFunctionGraphTask::CreateAndDispatchWhenReady([&RecordWrites, Writer]() { RecordWrites(Writer); }, TStatId(), nullptr, ENamedThreads::AnyThread));
+			}
+
+			// meanwhile the game thread reads instances and prepares its own write, which waits for the task, all of it
+			// legal next to the writers and checked under SI_CHECK_CONCURRENT_WRITES
+			if (Handles.Num() > 0)
+			{
+				FRandomStream ReadRandom(Seed - Round - 1);
+				FTransform Transform;
+				for (int32 i = 0; i < CommandsPerWriter; i++)
+				{
+					const int32 Id = Handles[ReadRandom.RandHelper(Handles.Num())];
+					MeshComponent->GetInstanceTransform(Id, Transform);
+					MeshComponent->GetInstanceSequence(Id);
+				}
+			}
+			MeshComponent->PrepareInstanceWrite();
+
+			FTaskGraphInterface::Get().WaitUntilTasksComplete(WriterTasks, ENamedThreads::GameThread);
+			RecordMs += (FPlatformTime::Seconds() - StartTime) * 1000.0;
+
+			StartTime = FPlatformTime::Seconds();
+			MeshComponent->FlushInstanceCommands();
+			FlushMs += (FPlatformTime::Seconds() - StartTime) * 1000.0;
+
+			// players advance between rounds, so cross fades recorded later start from other times
+			MeshComponent->TickInstances(1.0f / 30.0f);
+		}
+
+		UE_LOG(LogSkinnedInstancing, Display, TEXT("  %s: %d instances left, record %.3f ms, flush %.3f ms per round"),
+			bSingleThreaded ? TEXT("single threaded") : TEXT("parallel"), MeshComponent->GetNumInstances(),
+			RecordMs / FMath::Max(NumRounds, 1), FlushMs / FMath::Max(NumRounds, 1));
+
+		return MeshComponent;
+	};
+
+	UE_LOG(LogSkinnedInstancing, Display, TEXT("Concurrent write stress: %d writers, %d commands each, %d rounds"), NumWriters, CommandsPerWriter, NumRounds);
+
+	USIMeshComponent* Parallel = Run(false);
+	USIMeshComponent* Serial = Run(true);
+	const FSIInstanceStore& A = Parallel->Instances;
+	const FSIInstanceStore& B = Serial->Instances;
+
+	// field by field, struct padding is not part of the state
+	bool bSame = A.Num() == B.Num() && A.Handles == B.Handles && A.AnimStates == B.AnimStates;
+	for (int32 Index = 0; Index < A.Num() && bSame; Index++)
+	{
+		const FSIMeshInstanceData& DataA = A.InstanceDatas[Index];
+		const FSIMeshInstanceData& DataB = B.InstanceDatas[Index];
+		bSame = DataA.Transform.Equals(DataB.Transform, 0.0f) && DataA.MeshIndex == DataB.MeshIndex
+			&& FMemory::Memcmp(DataA.AnimDatas, DataB.AnimDatas, sizeof(DataA.AnimDatas)) == 0;
+	}
+
+	Parallel->DestroyComponent();
+	Serial->DestroyComponent();
+
+	if (!bSame)
+	{
+		UE_LOG(LogSkinnedInstancing, Error, TEXT("  parallel writers ended in other instances than the same writers on one thread"));
+		return false;
+	}
+
+	UE_LOG(LogSkinnedInstancing, Display, TEXT("  parallel and single threaded writes ended in the same instances"));
+	return true;
+}
+
+USIBenchmarkCommandlet::USIBenchmarkCommandlet(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+	IsClient = false;
+	IsEditor = false;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 USIBenchmarkCommandlet::Main(const FString& Params)
+{
+	FString MeshPath;
+	FString AnimsParam;
+	FString OutputName = FString::Printf(TEXT("SIBenchmark-%s"), *FDateTime::Now().ToString());
+	int32 NumInstances = 10000;
+	int32 NumComponents = 1;
+	int32 NumFrames = 300;
+	int32 Seed = 1;
+	int32 NumStressWriters = 0;
+	float CrossFadeRate = 0.02f;
+	float DeltaTime = 1.0f / 30.0f;
+
+	FParse::Value(*Params, TEXT("Mesh="), MeshPath);
+	FParse::Value(*Params, TEXT("Anims="), AnimsParam);
+	FParse::Value(*Params, TEXT("Output="), OutputName);
+	FParse::Value(*Params, TEXT("Instances="), NumInstances);
+	FParse::Value(*Params, TEXT("Components="), NumComponents);
+	FParse::Value(*Params, TEXT("Frames="), NumFrames);
+	FParse::Value(*Params, TEXT("Seed="), Seed);
+	FParse::Value(*Params, TEXT("StressWriters="), NumStressWriters);
+	FParse::Value(*Params, TEXT("CrossFadeRate="), CrossFadeRate);
+	FParse::Value(*Params, TEXT("DeltaTime="), DeltaTime);
+	const bool bNoUpdateRateOptimizations = FParse::Param(*Params, TEXT("NoURO"));
+	const bool bCompareAgents = FParse::Param(*Params, TEXT("CompareAgents"));
+	const bool bBatch = FParse::Param(*Params, TEXT("Batch"));
+
+	NumComponents = FMath::Max(NumComponents, 1);
+
+	// commandlets cannot render, without the override batching and update rates would be off and -Batch or -NoURO
+	// would measure nothing
+	SISetClientModeOverride(true);
+	ON_SCOPE_EXIT
+	{
+		SISetClientModeOverride(false);
+	};
+
+	if (SIIsServerMode())
+	{
+		UE_LOG(LogSkinnedInstancing, Error, TEXT("Benchmark cannot run in server mode, unset r.SkinnedInstancing.ServerMode"));
+		return 1;
+	}
+
+	USkeletalMesh* SkeletalMesh = LoadObject<USkeletalMesh>(nullptr, *MeshPath);
+	if (!SkeletalMesh || !SkeletalMesh->Skeleton)
+	{
+		UE_LOG(LogSkinnedInstancing, Error, TEXT("Benchmark needs -Mesh=<skeletal mesh with a skeleton>, got '%s'"), *MeshPath);
+		return 1;
+	}
+
+	TArray<FString> AnimPaths;
+	AnimsParam.ParseIntoArray(AnimPaths, TEXT("+"));
+
+	TArray<UAnimSequence*> AnimSequences;
+	for (const FString& AnimPath : AnimPaths)
+	{
+		if (UAnimSequence* AnimSequence = LoadObject<UAnimSequence>(nullptr, *AnimPath))
+			AnimSequences.Add(AnimSequence);
+	}
+
+	if (AnimSequences.Num() == 0)
+	{
+		UE_LOG(LogSkinnedInstancing, Error, TEXT("Benchmark needs -Anims=<sequence>+<sequence>..."));
+		return 1;
+	}
+
+	UWorld* World = UWorld::CreateWorld(EWorldType::Game, false, TEXT("SIBenchmark"));
+	FWorldContext& WorldContext = GEngine->CreateNewWorldContext(EWorldType::Game);
+	WorldContext.SetCurrentWorld(World);
+
+	AActor* Actor = World->SpawnActor<AActor>();
+
+	USIAnimationComponent* AnimationComponent = NewObject<USIAnimationComponent>(Actor);
+	AnimationComponent->Skeleton = SkeletalMesh->Skeleton;
+	AnimationComponent->AnimSequences = AnimSequences;
+	Actor->SetRootComponent(AnimationComponent);
+	AnimationComponent->RegisterComponent();
+
+	// packing only reads the palette layout, which does not need a GPU
+	TArray<int> SequenceLengths;
+	for (UAnimSequence* AnimSequence : AnimSequences)
+		SequenceLengths.Add(AnimSequence->GetNumberOfFrames());
+
+	FSIAnimationData PaletteLayout;
+	PaletteLayout.Init(SkeletalMesh->Skeleton->GetReferenceSkeleton().GetRawBoneNum(), SequenceLengths, AnimationComponent->PaletteTiers);
+
+	FRandomStream Random(Seed);
+
+	TArray<USIMeshComponent*> MeshComponents;
+	const int32 GridSize = FMath::CeilToInt(FMath::Sqrt((float)NumInstances));
+	const float Spacing = 200.0f;
+
+	for (int32 ComponentIndex = 0; ComponentIndex < NumComponents; ComponentIndex++)
+	{
+		USIMeshComponent* MeshComponent = NewObject<USIMeshComponent>(Actor);
+		MeshComponent->SkeletalMesh = SkeletalMesh;
+		MeshComponent->bEnableUpdateRateOptimizations = !bNoUpdateRateOptimizations;
+		MeshComponent->bBatchWithOtherComponents = bBatch;
+		MeshComponent->SetAnimationComponent(AnimationComponent);
+		MeshComponent->SetupAttachment(AnimationComponent);
+		MeshComponent->RegisterComponent();
+		MeshComponents.Add(MeshComponent);
+	}
+
+	if (bCompareAgents)
+	{
+		CompareAgents(Actor, MeshComponents[0], NumInstances, OutputName);
+	}
+
+	if (NumStressWriters > 0 && !StressConcurrentWrites(Actor, AnimationComponent, SkeletalMesh, NumInstances, NumStressWriters, NumFrames, Seed))
+	{
+		World->DestroyWorld(false);
+		GEngine->DestroyWorldContext(World);
+		return 1;
+	}
+
+	for (int32 InstanceIndex = 0; InstanceIndex < NumInstances; InstanceIndex++)
+	{
+		USIMeshComponent* MeshComponent = MeshComponents[InstanceIndex % NumComponents];
+		FVector Location((InstanceIndex % GridSize) * Spacing, (InstanceIndex / GridSize) * Spacing, 0);
+		int32 Id = MeshComponent->AddInstance(FTransform(FRotator(0, Random.FRandRange(0, 360), 0), Location));
+		MeshComponent->CrossFadeInstance(Id, Random.RandHelper(AnimSequences.Num()), 0, true);
+	}
+
+	// a camera above one corner of the grid, looking across it
+	FSIInstanceBinner::FView View;
+	View.Origin = FVector(-1000, -1000, 800);
+	View.ProjectionMatrix = FReversedZPerspectiveMatrix(PI / 4, 1920, 1080, GNearClippingPlane);
+	View.bUseLODs = true;
+
+	// baked bone bounds when the animation component has render state, mesh bounds otherwise
+	FSIInstanceBounds InstanceBounds;
+	InstanceBounds.Init(MakeArrayView(&SkeletalMesh, 1), AnimationComponent->GetAnimationData());
+	View.InstanceBounds = &InstanceBounds;
+
+	World->ViewLocationsRenderedLastFrame.Reset();
+	World->ViewLocationsRenderedLastFrame.Add(View.Origin);
+
+	FSIInstanceBinner Binner;
+	TArray<FSIMeshInstanceData> InstanceDatas;
+	TArray<uint32> ResolvedAnimations;
+	TArray<FMatrix> PackedTransforms;
+	TArray<uint32> PackedAnimations;
+	const int32 AnimationWords = SIInstancePacking::AnimationStride / sizeof(uint32);
+	const FSkeletalMeshRenderData* RenderData = SkeletalMesh->GetResourceForRendering();
+
+	TArray<FBenchmarkFrame> Frames;
+	Frames.AddDefaulted(NumFrames);
+
+	FCountingMalloc* CountingMalloc = GetCountingMalloc();
+	FMalloc* SavedMalloc = GMalloc;
+
+	// the dynamic data phase publishes into the mesh object, which only exists with a scene
+	if (!MeshComponents[0]->MeshObject)
+	{
+		UE_LOG(LogSkinnedInstancing, Error, TEXT("Benchmark components have no render state, the world has no scene"));
+		World->DestroyWorld(false);
+		GEngine->DestroyWorldContext(World);
+		return 1;
+	}
+
+	for (int32 FrameIndex = 0; FrameIndex < NumFrames; FrameIndex++)
+	{
+		FBenchmarkFrame& Frame = Frames[FrameIndex];
+
+		// as the engine loop does, the update budget and the dynamic data tasks are per frame
+		GFrameCounter++;
+
+		for (USIMeshComponent* MeshComponent : MeshComponents)
+		{
+			const TArray<int32>& Handles = MeshComponent->Instances.Handles;
+			const int32 NumCrossFades = FMath::RoundToInt(Handles.Num() * CrossFadeRate);
+			for (int32 i = 0; i < NumCrossFades && Handles.Num() > 0; i++)
+			{
+				MeshComponent->CrossFadeInstance(Handles[Random.RandHelper(Handles.Num())], Random.RandHelper(AnimSequences.Num()), 0.2f, true);
+			}
+			MeshComponent->LastRenderTime = World->GetTimeSeconds();
+		}
+
+		GMalloc = CountingMalloc;
+		const int32 StartAllocations = CountingMalloc->NumAllocations.GetValue();
+		const int64 StartBytes = CountingMalloc->NumBytes.GetValue();
+
+		for (USIMeshComponent* MeshComponent : MeshComponents)
+		{
+			{
+				FPhaseTimer Timer(Frame, Phase_TickInstances);
+				MeshComponent->TickInstances(DeltaTime);
+			}
+
+			// followers are gathered, bound and drawn by their batch leader
+			if (MeshComponent->IsBatchFollower())
+				continue;
+
+			{
+				// the late tick starts the dynamic data task, the end of frame send publishes its result
+				FPhaseTimer Timer(Frame, Phase_UpdateDynamicData);
+				MeshComponent->TickDynamicData();
+				MeshComponent->DoDeferredRenderUpdates_Concurrent();
+			}
+
+			{
+				// the render thread phases below need the packed instances, which stay inside the mesh object, so they are
+				// rebuilt here off the clock and off the allocation count
+				GMalloc = SavedMalloc;
+				InstanceDatas.Reset();
+				MeshComponent->GatherInstanceDatas(InstanceDatas);
+
+				ResolvedAnimations.SetNumUninitialized(PaletteLayout.GetNumPaletteTiers() * InstanceDatas.Num() * AnimationWords, false);
+				for (int32 Tier = 0; Tier < PaletteLayout.GetNumPaletteTiers(); Tier++)
+				{
+					SIInstancePacking::ResolveAnimations(PaletteLayout, Tier, InstanceDatas, ResolvedAnimations.GetData() + Tier * InstanceDatas.Num() * AnimationWords);
+				}
+				GMalloc = CountingMalloc;
+			}
+
+			{
+				FPhaseTimer Timer(Frame, Phase_CalcBounds);
+				MeshComponent->CalcBounds(MeshComponent->GetComponentTransform());
+			}
+
+			{
+				FPhaseTimer Timer(Frame, Phase_LODBinning);
+				Binner.Bin(SkeletalMesh, View, InstanceDatas, 0, 0);
+			}
+
+			{
+				// what is left on the render thread: copying the resolved rows of the drawn instances
+				FPhaseTimer Timer(Frame, Phase_InstancePacking);
+				const int32 NumBinned = Binner.BinnedInstanceDatas.Num();
+				PackedTransforms.SetNumUninitialized(NumBinned, false);
+				PackedAnimations.SetNumUninitialized(NumBinned * AnimationWords, false);
+				SIInstancePacking::PackTransforms(Binner.BinnedInstanceDatas, PackedTransforms.GetData());
+
+				for (const FSIInstanceBinner::FBin& Bin : Binner.Bins)
+				{
+					const uint32* TierAnimations = ResolvedAnimations.GetData() + PaletteLayout.GetPaletteTierForLOD(Bin.LODIndex) * InstanceDatas.Num() * AnimationWords;
+					uint32* BinAnimations = PackedAnimations.GetData() + Bin.FirstInstance * AnimationWords;
+					SIInstancePacking::GatherAnimations(TierAnimations, Binner.GetBinInstanceIndices(Bin), Binner.GetBinInstanceFades(Bin), BinAnimations);
+
+					Frame.NumDrawCalls += RenderData->LODRenderData[Bin.LODIndex].RenderSections.Num();
+				}
+			}
+		}
+
+		Frame.NumAllocations = CountingMalloc->NumAllocations.GetValue() - StartAllocations;
+		Frame.NumAllocatedBytes = CountingMalloc->NumBytes.GetValue() - StartBytes;
+		GMalloc = SavedMalloc;
+	}
+
+	// draw calls of the final frame with every component drawn on its own and with batching
+	auto CountDrawCalls = [&](const TArray<FSIMeshInstanceData>& Datas)
+	{
+		int32 NumDrawCalls = 0;
+		Binner.Bin(SkeletalMesh, View, Datas, 0, 0);
+		for (const FSIInstanceBinner::FBin& Bin : Binner.Bins)
+		{
+			NumDrawCalls += RenderData->LODRenderData[Bin.LODIndex].RenderSections.Num();
+		}
+		return NumDrawCalls;
+	};
+
+	int32 NumDrawCallsUnbatched = 0;
+	int32 NumDrawCallsBatched = 0;
+	for (USIMeshComponent* MeshComponent : MeshComponents)
+	{
+		NumDrawCallsUnbatched += CountDrawCalls(MeshComponent->Instances.InstanceDatas);
+
+		if (!MeshComponent->IsBatchFollower())
+		{
+			InstanceDatas.Reset();
+			MeshComponent->GatherInstanceDatas(InstanceDatas);
+			NumDrawCallsBatched += CountDrawCalls(InstanceDatas);
+		}
+	}
+
+	UE_LOG(LogSkinnedInstancing, Display, TEXT("  %d draw calls unbatched, %d with %s"), NumDrawCallsUnbatched, NumDrawCallsBatched,
+		bBatch ? TEXT("batching") : TEXT("batching disabled (-Batch)"));
+
+	// bulk snapshot round trip of the first component, as level streaming and save games would do it
+	TArray<uint8> Snapshot;
+	double SnapshotStart = FPlatformTime::Seconds();
+	MeshComponents[0]->SaveInstances(Snapshot);
+	const double SaveSeconds = FPlatformTime::Seconds() - SnapshotStart;
+
+	SnapshotStart = FPlatformTime::Seconds();
+	const bool bRestored = MeshComponents[0]->RestoreInstances(Snapshot);
+	const double RestoreSeconds = FPlatformTime::Seconds() - SnapshotStart;
+
+	UE_LOG(LogSkinnedInstancing, Display, TEXT("  snapshot of %d instances: %d bytes, save %.3f ms, restore %.3f ms%s"),
+		MeshComponents[0]->Instances.Num(), Snapshot.Num(), SaveSeconds * 1000.0, RestoreSeconds * 1000.0, bRestored ? TEXT("") : TEXT(" (failed)"));
+
+	FString Config;
+	Config += FString::Printf(TEXT("\t\"mesh\": \"%s\",\n"), *SkeletalMesh->GetPathName());
+	Config += FString::Printf(TEXT("\t\"instances\": %d,\n"), NumInstances);
+	Config += FString::Printf(TEXT("\t\"components\": %d,\n"), NumComponents);
+	Config += FString::Printf(TEXT("\t\"frames\": %d,\n"), NumFrames);
+	Config += FString::Printf(TEXT("\t\"crossfade_rate\": %.4f,\n"), CrossFadeRate);
+	Config += FString::Printf(TEXT("\t\"update_rate_optimizations\": %s,\n"), bNoUpdateRateOptimizations ? TEXT("false") : TEXT("true"));
+	Config += FString::Printf(TEXT("\t\"batching\": %s,\n"), bBatch ? TEXT("true") : TEXT("false"));
+	Config += FString::Printf(TEXT("\t\"draw_calls_unbatched\": %d,\n"), NumDrawCallsUnbatched);
+	Config += FString::Printf(TEXT("\t\"draw_calls_batched\": %d,\n"), NumDrawCallsBatched);
+	Config += FString::Printf(TEXT("\t\"snapshot_bytes\": %d,\n"), Snapshot.Num());
+	Config += FString::Printf(TEXT("\t\"snapshot_save_ms\": %.3f,\n"), SaveSeconds * 1000.0);
+	Config += FString::Printf(TEXT("\t\"snapshot_restore_ms\": %.3f,\n"), RestoreSeconds * 1000.0);
+	Config += FString::Printf(TEXT("\t\"engine_version\": \"%s\",\n"), *FEngineVersion::Current().ToString());
+
+	WriteResults(OutputName, Config, Frames);
+
+	World->DestroyWorld(false);
+	GEngine->DestroyWorldContext(World);
+
+	return 0;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "SIBenchmarkCommandlet.generated.h"
+
+class USIMeshComponent;
+class USIAnimationComponent;
+class USkeletalMesh;
+
+/**
+ * Headless benchmark of the instancing pipeline, writes per frame timings as CSV and a JSON summary.
+ * UE4Editor-Cmd <Project> -run=SIBenchmark -nullrhi -Mesh=/Game/Soldier -Anims=/Game/Idle+/Game/Run -Instances=10000 -Frames=300
+ * -Batch merges the components into one draw, the summary reports draw calls with and without batching.
+ * -CompareAgents also measures spawning the instances as USIUnitComponents against component-less agents.
+ * -StressWriters=N records random instance writes from N parallel writers for -Frames rounds and fails unless the
+ * result matches the same writes made on one thread.
+ */
+UCLASS()
+class USIBenchmarkCommandlet : public UCommandlet
+{
+	GENERATED_UCLASS_BODY()
+
+	//~ Begin UCommandlet Interface
+	virtual int32 Main(const FString& Params) override;
+	//~ End UCommandlet Interface
+
+private:
+	/**
+	 * Spawns the same number of units once as USIUnitComponents and once as component-less agents,
+	 * reports spawn, update and despawn cost plus retained memory per unit.
+	 */
+	static void CompareAgents(AActor* Actor, USIMeshComponent* MeshComponent, int32 NumUnits, const FString& BaseName);
+
+	/**
+	 * Records random instance writes from NumWriters parallel writers for NumRounds rounds, once spread over the worker
+	 * threads and once on this thread. The writers pick from the same instances so their commands collide, the merge
+	 * must still end in the same instances.
+	 */
+	static bool StressConcurrentWrites(AActor* Actor, USIAnimationComponent* AnimationComponent, USkeletalMesh* SkeletalMesh,
+		int32 NumInstances, int32 NumWriters, int32 NumRounds, int32 Seed);
+};
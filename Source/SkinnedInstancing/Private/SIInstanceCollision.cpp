@@ -0,0 +1,361 @@
+#include "SIInstanceCollision.h"
+#include "SIAnimationData.h"
+#include "PhysicsEngine/PhysicsAsset.h"
+#include "PhysicsEngine/BodySetup.h"
+
+namespace
+{
+	/** Entry distance of a ray into a sphere, 0 when it starts inside. */
+	bool RaySphere(const FVector& Start, const FVector& Dir, const FVector& Center, float Radius, float& OutT)
+	{
+		const FVector Offset = Start - Center;
+		const float B = FVector::DotProduct(Offset, Dir);
+		const float C = Offset.SizeSquared() - Radius * Radius;
+		if (C <= 0)
+		{
+			OutT = 0;
+			return true;
+		}
+
+		const float H = B * B - C;
+		if (B > 0 || H < 0)
+			return false;
+
+		OutT = -B - FMath::Sqrt(H);
+		return true;
+	}
+
+	/** Entry distance of a ray into a capsule around segment AB, the end spheres are tested separately. */
+	bool RayCapsule(const FVector& Start, const FVector& Dir, const FVector& A, const FVector& B, float Radius, float& OutT)
+	{
+		const FVector BA = B - A;
+		const FVector OA = Start - A;
+		const float BABA = FVector::DotProduct(BA, BA);
+		const float BARD = FVector::DotProduct(BA, Dir);
+		const float BAOA = FVector::DotProduct(BA, OA);
+
+		bool bHit = false;
+		float BestT = MAX_flt;
+
+		// the cylinder, skipped when the ray runs along the axis
+		const float QA = BABA - BARD * BARD;
+		if (QA > KINDA_SMALL_NUMBER)
+		{
+			const float QB = BABA * FVector::DotProduct(OA, Dir) - BAOA * BARD;
+			const float QC = BABA * OA.SizeSquared() - BAOA * BAOA - Radius * Radius * BABA;
+			const float H = QB * QB - QA * QC;
+			// a start outside the cylinder heading away misses it, like RaySphere
+			if (H >= 0 && !(QC > 0 && QB > 0))
+			{
+				// only a start inside the cylinder enters at 0
+				const float T = QC > 0 ? (-QB - FMath::Sqrt(H)) / QA : 0.0f;
+				const float Y = BAOA + T * BARD;
+				if (Y > 0 && Y < BABA)
+				{
+					bHit = true;
+					BestT = T;
+				}
+			}
+		}
+
+		float SphereT;
+		if (RaySphere(Start, Dir, A, Radius, SphereT) && SphereT < BestT)
+		{
+			bHit = true;
+			BestT = SphereT;
+		}
+		if (BABA > 0 && RaySphere(Start, Dir, B, Radius, SphereT) && SphereT < BestT)
+		{
+			bHit = true;
+			BestT = SphereT;
+		}
+
+		OutT = BestT;
+		return bHit;
+	}
+}
+
+void FSIInstanceHitShapes::Init(const UPhysicsAsset* PhysicsAsset, const FReferenceSkeleton& RefSkeleton)
+{
+	Shapes.Reset();
+	MaxShapeReach = 0;
+
+	if (!PhysicsAsset)
+		return;
+
+	for (const UBodySetup* BodySetup : PhysicsAsset->SkeletalBodySetups)
+	{
+		if (!BodySetup)
+			continue;
+
+		const int32 BoneIndex = RefSkeleton.FindBoneIndex(BodySetup->BoneName);
+		if (BoneIndex == INDEX_NONE)
+			continue;
+
+		for (const FKSphylElem& Sphyl : BodySetup->AggGeom.SphylElems)
+		{
+			// capsules run along their local Z
+			FShape& Shape = Shapes.AddDefaulted_GetRef();
+			Shape.BoneIndex = BoneIndex;
+			Shape.BoneName = BodySetup->BoneName;
+			Shape.Center = Sphyl.Center;
+			Shape.HalfSegment = Sphyl.Rotation.RotateVector(FVector(0, 0, Sphyl.Length * 0.5f));
+			Shape.Radius = Sphyl.Radius;
+		}
+
+		for (const FKSphereElem& Sphere : BodySetup->AggGeom.SphereElems)
+		{
+			FShape& Shape = Shapes.AddDefaulted_GetRef();
+			Shape.BoneIndex = BoneIndex;
+			Shape.BoneName = BodySetup->BoneName;
+			Shape.Center = Sphere.Center;
+			Shape.HalfSegment = FVector::ZeroVector;
+			Shape.Radius = Sphere.Radius;
+		}
+	}
+
+	for (const FShape& Shape : Shapes)
+	{
+		MaxShapeReach = FMath::Max(MaxShapeReach, Shape.Center.Size() + Shape.HalfSegment.Size() + Shape.Radius);
+	}
+}
+
+float FSIInstanceHitShapes::GetBoundsRadius(const FSIBonePalette& Palette) const
+{
+	return Palette.MaxBoneDistance + MaxShapeReach;
+}
+
+void FSIInstanceHitShapes::PoseShape(const FSIBonePalette& Palette, const FSIMeshInstanceData& Instance, const FPoseOptions& Options,
+	const FShape& Shape, FVector& OutA, FVector& OutB, float& OutRadius) const
+{
+	const FMatrix BoneToWorld = Palette.Sample(Instance.AnimDatas, Shape.BoneIndex, Options.bAnimationBlend, Options.bFrameLerp)
+		* Instance.Transform * Options.InstanceToWorld;
+
+	OutA = BoneToWorld.TransformPosition(Shape.Center - Shape.HalfSegment);
+	OutB = BoneToWorld.TransformPosition(Shape.Center + Shape.HalfSegment);
+	OutRadius = Shape.Radius * BoneToWorld.GetMaximumAxisScale();
+}
+
+bool FSIInstanceHitShapes::RayCast(const FSIBonePalette& Palette, const FSIMeshInstanceData& Instance, const FPoseOptions& Options,
+	const FVector& Start, const FVector& Dir, float MaxDistance, float& OutDistance, int32& OutShapeIndex, FVector& OutNormal) const
+{
+	bool bHit = false;
+	float BestDistance = MaxDistance;
+	FVector BestA, BestB;
+
+	for (int32 ShapeIndex = 0; ShapeIndex < Shapes.Num(); ShapeIndex++)
+	{
+		const FShape& Shape = Shapes[ShapeIndex];
+		if (Shape.BoneIndex >= Palette.NumBones)
+			continue;
+
+		FVector A, B;
+		float Radius;
+		PoseShape(Palette, Instance, Options, Shape, A, B, Radius);
+
+		float T;
+		if (RayCapsule(Start, Dir, A, B, Radius, T) && T <= BestDistance)
+		{
+			bHit = true;
+			BestDistance = T;
+			BestA = A;
+			BestB = B;
+			OutShapeIndex = ShapeIndex;
+		}
+	}
+
+	if (bHit)
+	{
+		const FVector Location = Start + Dir * BestDistance;
+		OutNormal = (Location - FMath::ClosestPointOnSegment(Location, BestA, BestB)).GetSafeNormal();
+		if (OutNormal.IsZero())
+			OutNormal = -Dir;
+		OutDistance = BestDistance;
+	}
+
+	return bHit;
+}
+
+bool FSIInstanceHitShapes::Overlap(const FSIBonePalette& Palette, const FSIMeshInstanceData& Instance, const FPoseOptions& Options,
+	const FVector& Center, float Radius) const
+{
+	for (const FShape& Shape : Shapes)
+	{
+		if (Shape.BoneIndex >= Palette.NumBones)
+			continue;
+
+		FVector A, B;
+		float ShapeRadius;
+		PoseShape(Palette, Instance, Options, Shape, A, B, ShapeRadius);
+
+		if (FMath::PointDistToSegmentSquared(Center, A, B) <= FMath::Square(Radius + ShapeRadius))
+			return true;
+	}
+
+	return false;
+}
+
+void FSIInstanceGrid::Build(const FSIInstanceStore& Instances, const FMatrix& InInstanceToWorld, float InBoundsRadius)
+{
+	Revision = Instances.GetRevision();
+	InstanceToWorld = InInstanceToWorld;
+	BoundsRadius = InBoundsRadius;
+
+	const int32 NumInstances = Instances.Num();
+	const float WorldScale = InstanceToWorld.GetMaximumAxisScale();
+	Origins.SetNumUninitialized(NumInstances);
+	Radii.SetNumUninitialized(NumInstances);
+
+	float MaxRadius = 0;
+	for (int32 Index = 0; Index < NumInstances; Index++)
+	{
+		const FTransform& Transform = Instances.InstanceDatas[Index].Transform;
+		Origins[Index] = InstanceToWorld.TransformPosition(Transform.GetOrigin());
+		Radii[Index] = BoundsRadius * Transform.GetMaximumAxisScale() * WorldScale;
+		MaxRadius = FMath::Max(MaxRadius, Radii[Index]);
+	}
+
+	// twice the largest sphere, so no sphere touches more than eight cells
+	CellSize = FMath::Max(2.0f * MaxRadius, 1.0f);
+	InvCellSize = 1.0f / CellSize;
+
+	// counted first, so the instances of a cell end up next to each other
+	Cells.Reset();
+	for (int32 Index = 0; Index < NumInstances; Index++)
+	{
+		const FIntVector Min = GetCell(Origins[Index] - FVector(Radii[Index]));
+		const FIntVector Max = GetCell(Origins[Index] + FVector(Radii[Index]));
+		for (int32 X = Min.X; X <= Max.X; X++)
+			for (int32 Y = Min.Y; Y <= Max.Y; Y++)
+				for (int32 Z = Min.Z; Z <= Max.Z; Z++)
+					Cells.FindOrAdd(FIntVector(X, Y, Z)).Num++;
+	}
+
+	int32 NumListed = 0;
+	for (TPair<FIntVector, FCellRange>& Pair : Cells)
+	{
+		Pair.Value.First = NumListed;
+		NumListed += Pair.Value.Num;
+		Pair.Value.Num = 0;
+	}
+
+	CellInstances.SetNumUninitialized(NumListed);
+	for (int32 Index = 0; Index < NumInstances; Index++)
+	{
+		const FIntVector Min = GetCell(Origins[Index] - FVector(Radii[Index]));
+		const FIntVector Max = GetCell(Origins[Index] + FVector(Radii[Index]));
+		for (int32 X = Min.X; X <= Max.X; X++)
+			for (int32 Y = Min.Y; Y <= Max.Y; Y++)
+				for (int32 Z = Min.Z; Z <= Max.Z; Z++)
+				{
+					FCellRange& Range = Cells.FindChecked(FIntVector(X, Y, Z));
+					CellInstances[Range.First + Range.Num++] = Index;
+				}
+	}
+}
+
+bool FSIInstanceGrid::IsBuiltFor(const FSIInstanceStore& Instances, const FMatrix& InInstanceToWorld, float InBoundsRadius) const
+{
+	return Revision == Instances.GetRevision() && Origins.Num() == Instances.Num() && BoundsRadius == InBoundsRadius
+		&& InstanceToWorld.Equals(InInstanceToWorld, 0.0f);
+}
+
+void FSIInstanceGrid::VisitCell(const FIntVector& Cell, TBitArray<>& Visited, TFunctionRef<void(int32)> Visit) const
+{
+	const FCellRange* Range = Cells.Find(Cell);
+	if (!Range)
+		return;
+
+	for (int32 i = Range->First; i < Range->First + Range->Num; i++)
+	{
+		const int32 Index = CellInstances[i];
+		if (!Visited[Index])
+		{
+			Visited[Index] = true;
+			Visit(Index);
+		}
+	}
+}
+
+void FSIInstanceGrid::VisitAllCells(TBitArray<>& Visited, TFunctionRef<void(int32)> Visit) const
+{
+	for (const TPair<FIntVector, FCellRange>& Pair : Cells)
+	{
+		VisitCell(Pair.Key, Visited, Visit);
+	}
+}
+
+void FSIInstanceGrid::ForEachAlongSegment(const FVector& Start, const FVector& Dir, const float& MaxDistance, TFunctionRef<void(int32)> Visit) const
+{
+	TBitArray<> Visited(false, Origins.Num());
+
+	// a segment crossing more cells than are occupied is cheaper to test against all of them
+	if (MaxDistance * InvCellSize * 3.0f > Cells.Num())
+	{
+		VisitAllCells(Visited, Visit);
+		return;
+	}
+
+	// walks the cells the segment passes, in order
+	const FIntVector StartCell = GetCell(Start);
+	int32 Cell[3] = { StartCell.X, StartCell.Y, StartCell.Z };
+	int32 Step[3];
+	float NextT[3];
+	float DeltaT[3];
+	for (int32 Axis = 0; Axis < 3; Axis++)
+	{
+		if (Dir[Axis] > SMALL_NUMBER)
+		{
+			Step[Axis] = 1;
+			NextT[Axis] = ((Cell[Axis] + 1) * CellSize - Start[Axis]) / Dir[Axis];
+			DeltaT[Axis] = CellSize / Dir[Axis];
+		}
+		else if (Dir[Axis] < -SMALL_NUMBER)
+		{
+			Step[Axis] = -1;
+			NextT[Axis] = (Cell[Axis] * CellSize - Start[Axis]) / Dir[Axis];
+			DeltaT[Axis] = -CellSize / Dir[Axis];
+		}
+		else
+		{
+			Step[Axis] = 0;
+			NextT[Axis] = MAX_flt;
+			DeltaT[Axis] = MAX_flt;
+		}
+	}
+
+	float EntryT = 0;
+	while (EntryT <= MaxDistance)
+	{
+		VisitCell(FIntVector(Cell[0], Cell[1], Cell[2]), Visited, Visit);
+
+		const int32 Axis = NextT[0] < NextT[1] ? (NextT[0] < NextT[2] ? 0 : 2) : (NextT[1] < NextT[2] ? 1 : 2);
+		if (NextT[Axis] == MAX_flt)
+			break;
+
+		EntryT = NextT[Axis];
+		Cell[Axis] += Step[Axis];
+		NextT[Axis] += DeltaT[Axis];
+	}
+}
+
+void FSIInstanceGrid::ForEachInSphere(const FVector& Center, float Radius, TFunctionRef<void(int32)> Visit) const
+{
+	TBitArray<> Visited(false, Origins.Num());
+
+	const FIntVector Min = GetCell(Center - FVector(Radius));
+	const FIntVector Max = GetCell(Center + FVector(Radius));
+	const int64 NumCells = (int64)(Max.X - Min.X + 1) * (Max.Y - Min.Y + 1) * (Max.Z - Min.Z + 1);
+
+	// a sphere covering more cells than are occupied is cheaper to test against all of them
+	if (NumCells > Cells.Num())
+	{
+		VisitAllCells(Visited, Visit);
+		return;
+	}
+
+	for (int32 X = Min.X; X <= Max.X; X++)
+		for (int32 Y = Min.Y; Y <= Max.Y; Y++)
+			for (int32 Z = Min.Z; Z <= Max.Z; Z++)
+				VisitCell(FIntVector(X, Y, Z), Visited, Visit);
+}
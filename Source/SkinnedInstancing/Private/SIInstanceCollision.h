@@ -0,0 +1,116 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "SIInstanceStore.h"
+#include "Templates/Function.h"
+
+class UPhysicsAsset;
+struct FReferenceSkeleton;
+struct FSIBonePalette;
+
+/**
+ * Capsules and spheres of a physics asset, attached to skeleton bones, posed from the CPU bone palette to hit test
+ * instances without physics bodies. Read only once built, so queries can run on any thread.
+ */
+class FSIInstanceHitShapes
+{
+public:
+	struct FShape
+	{
+		int32 BoneIndex;
+		FName BoneName;
+		/** Capsule center and half segment in bone space, spheres have a zero half segment. */
+		FVector Center;
+		FVector HalfSegment;
+		float Radius;
+	};
+
+	struct FPoseOptions
+	{
+		bool bAnimationBlend;
+		bool bFrameLerp;
+		FMatrix InstanceToWorld;
+	};
+
+	/** Boxes and convex elements are skipped, bones missing from the skeleton too. */
+	void Init(const UPhysicsAsset* PhysicsAsset, const FReferenceSkeleton& RefSkeleton);
+
+	bool IsValid() const { return Shapes.Num() > 0; }
+
+	const FShape& GetShape(int32 ShapeIndex) const { return Shapes[ShapeIndex]; }
+
+	/** Sphere around the instance origin in instance space, before instance scale, that holds every shape in every baked frame. */
+	float GetBoundsRadius(const FSIBonePalette& Palette) const;
+
+	/** Closest shape of an instance hit by the segment Start + Dir * [0, MaxDistance], Dir normalized. */
+	bool RayCast(const FSIBonePalette& Palette, const FSIMeshInstanceData& Instance, const FPoseOptions& Options,
+		const FVector& Start, const FVector& Dir, float MaxDistance, float& OutDistance, int32& OutShapeIndex, FVector& OutNormal) const;
+
+	/** Whether any shape of an instance touches the sphere. */
+	bool Overlap(const FSIBonePalette& Palette, const FSIMeshInstanceData& Instance, const FPoseOptions& Options,
+		const FVector& Center, float Radius) const;
+
+private:
+	/** World space capsule segment and radius of a shape on a posed instance. */
+	void PoseShape(const FSIBonePalette& Palette, const FSIMeshInstanceData& Instance, const FPoseOptions& Options,
+		const FShape& Shape, FVector& OutA, FVector& OutB, float& OutRadius) const;
+
+	TArray<FShape> Shapes;
+	/** Furthest any shape reaches from its bone origin. */
+	float MaxShapeReach = 0;
+};
+
+/**
+ * Uniform grid over the world space bounding spheres of a component's instances, every instance is listed in each cell
+ * its sphere touches. Built for one instance revision, instance to world transform and bounds radius, read only after.
+ */
+class FSIInstanceGrid
+{
+public:
+	/** BoundsRadius is FSIInstanceHitShapes::GetBoundsRadius, before instance and world scale. */
+	void Build(const FSIInstanceStore& Instances, const FMatrix& InInstanceToWorld, float InBoundsRadius);
+
+	bool IsBuiltFor(const FSIInstanceStore& Instances, const FMatrix& InInstanceToWorld, float InBoundsRadius) const;
+
+	/** World space bounding sphere of the instance at a store index. */
+	const FVector& GetOrigin(int32 Index) const { return Origins[Index]; }
+	float GetRadius(int32 Index) const { return Radii[Index]; }
+
+	/**
+	 * Visits the store index of every instance listed in a cell the segment Start + Dir * [0, MaxDistance] passes, once
+	 * each, cell by cell from Start. MaxDistance is read again after every cell, so the visitor can shorten the walk.
+	 */
+	void ForEachAlongSegment(const FVector& Start, const FVector& Dir, const float& MaxDistance, TFunctionRef<void(int32)> Visit) const;
+
+	/** Visits the store index of every instance listed in a cell the sphere touches, once each. */
+	void ForEachInSphere(const FVector& Center, float Radius, TFunctionRef<void(int32)> Visit) const;
+
+private:
+	struct FCellRange
+	{
+		int32 First = 0;
+		int32 Num = 0;
+	};
+
+	FIntVector GetCell(const FVector& Location) const
+	{
+		return FIntVector(FMath::FloorToInt(Location.X * InvCellSize), FMath::FloorToInt(Location.Y * InvCellSize), FMath::FloorToInt(Location.Z * InvCellSize));
+	}
+
+	void VisitCell(const FIntVector& Cell, TBitArray<>& Visited, TFunctionRef<void(int32)> Visit) const;
+	void VisitAllCells(TBitArray<>& Visited, TFunctionRef<void(int32)> Visit) const;
+
+	uint32 Revision = 0;
+	FMatrix InstanceToWorld = FMatrix::Identity;
+	float BoundsRadius = 0;
+
+	float CellSize = 1;
+	float InvCellSize = 1;
+	/** Ranges of CellInstances, only for cells some instance touches. */
+	TMap<FIntVector, FCellRange> Cells;
+	TArray<int32> CellInstances;
+
+	/** Per store index */
+	TArray<FVector> Origins;
+	TArray<float> Radii;
+};
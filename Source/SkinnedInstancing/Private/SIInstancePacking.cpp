@@ -0,0 +1,296 @@
+#include "SIInstancePacking.h"
+#include "Engine/SkeletalMesh.h"
+#include "Rendering/SkeletalMeshRenderData.h"
+#include "SceneManagement.h"
+#include "SIAnimationData.h"
+#include "ConvexVolume.h"
+#include <algorithm>
+
+namespace
+{
+	float ComputeInstanceScreenRadiusSquared(const FSIInstanceBinner::FView& View, const FVector4& Origin, const float SphereRadius)
+	{
+		static const auto* SkeletalMeshLODRadiusScale = IConsoleManager::Get().FindTConsoleVariableDataFloat(TEXT("r.SkeletalMeshLODRadiusScale"));
+		float LODScale = FMath::Clamp(SkeletalMeshLODRadiusScale->GetValueOnAnyThread(), 0.25f, 1.0f);
+
+		return ComputeBoundsScreenRadiusSquared(Origin, SphereRadius, View.Origin, View.ProjectionMatrix) * LODScale * LODScale;
+	}
+
+	const uint32 AnimationWords = SIInstancePacking::AnimationStride / sizeof(uint32);
+
+	/** The blend weight word of the first layer also carries the draw budget fade in bits 16..23. */
+	const int32 FadeWord = 3;
+	const uint32 FadeMask = 0xFF0000;
+
+	void PackAnimation(const FSIAnimationData::FPaletteTier& Tier, uint32 NumBones, const FSIMeshInstanceData& Instance, uint8 InstanceFade, uint32* OutAnimation)
+	{
+		const TArray<uint32>& SequenceLength = Tier.SequenceLength;
+		const TArray<uint32>& SequenceOffset = Tier.SequenceOffset;
+
+		uint32 Offset = 0;
+		for (uint32 j = 0; j < 2; j++)
+		{
+			const auto& AnimData = Instance.AnimDatas[j];
+			check(AnimData.Sequence >= 0 && AnimData.Sequence < SequenceLength.Num());
+			const uint32 BufferOffest = SequenceOffset[AnimData.Sequence];
+
+			if (Tier.RateDivisor > 1)
+			{
+				// coarse tiers snap to the nearest kept frame, a zero lerp skips the second fetch in the shader
+				float FullRateFrame = AnimData.PrevFrame + AnimData.FrameLerp;
+				int Frame = FMath::Clamp(FMath::RoundToInt(FullRateFrame / Tier.RateDivisor), 0, (int)SequenceLength[AnimData.Sequence] - 1);
+				OutAnimation[Offset++] = BufferOffest + Frame * NumBones;
+				OutAnimation[Offset++] = BufferOffest + Frame * NumBones;
+				OutAnimation[Offset++] = 0;
+			}
+			else
+			{
+				OutAnimation[Offset++] = BufferOffest + AnimData.PrevFrame * NumBones;
+				OutAnimation[Offset++] = BufferOffest + AnimData.NextFrame * NumBones;
+				OutAnimation[Offset++] = (uint32)(AnimData.FrameLerp * 1000);
+			}
+			const uint32 Fade = (j == 0) ? ((uint32)InstanceFade << 16) : 0;
+			OutAnimation[Offset++] = (uint32)(AnimData.BlendWeight * 1000) | Fade;
+		}
+	}
+
+	int32 GetMinDesiredLODLevel(USkeletalMesh* SkeletalMesh, const FSIInstanceBinner::FView& View, int32 LODNum, const float ScreenRadiusSquared)
+	{
+		// Need the current LOD
+		const int32 CurrentLODLevel = 0;
+		int32 NewLODLevel = 0;
+
+		// Look for a lower LOD if the EngineShowFlags is enabled - Thumbnail rendering disables LODs
+		if (View.bUseLODs)
+		{
+			// Iterate from worst to best LOD
+			for (int32 LODLevel = LODNum - 1; LODLevel > 0; LODLevel--)
+			{
+				FSkeletalMeshLODInfo* LODInfo = SkeletalMesh->GetLODInfo(LODLevel);
+
+				// Get ScreenSize for this LOD
+				float ScreenSize = LODInfo->ScreenSize.Default;
+
+				// If we are considering shifting to a better (lower) LOD, bias with hysteresis.
+				if (LODLevel <= CurrentLODLevel)
+				{
+					ScreenSize += LODInfo->LODHysteresis;
+				}
+
+				// If have passed this boundary, use this LOD
+				if (FMath::Square(ScreenSize * 0.5f) > ScreenRadiusSquared)
+				{
+					NewLODLevel = LODLevel;
+					break;
+				}
+			}
+		}
+
+		return NewLODLevel;
+	}
+}
+
+void FSIInstanceBounds::Init(TArrayView<USkeletalMesh* const> Meshes, const FSIAnimationData* InAnimationData)
+{
+	AnimationData = (InAnimationData && InAnimationData->HasBoneBounds()) ? InAnimationData : nullptr;
+	MeshBounds.Reset();
+	BonePadding.Reset();
+
+	for (USkeletalMesh* Mesh : Meshes)
+	{
+		const FBox Bounds = Mesh->GetBounds().GetBox();
+		MeshBounds.Add(Bounds);
+
+		// how far the surface reaches past the bones, on each side
+		FBox Padding(FVector::ZeroVector, FVector::ZeroVector);
+		if (AnimationData)
+		{
+			const FBox& RefBones = AnimationData->GetRefPoseBoneBounds();
+			Padding.Min = (RefBones.Min - Bounds.Min).ComponentMax(FVector::ZeroVector);
+			Padding.Max = (Bounds.Max - RefBones.Max).ComponentMax(FVector::ZeroVector);
+		}
+		BonePadding.Add(Padding);
+	}
+}
+
+FBox FSIInstanceBounds::GetLocalBounds(const FSIMeshInstanceData& Instance) const
+{
+	const int32 MeshIndex = MeshBounds.IsValidIndex(Instance.MeshIndex) ? Instance.MeshIndex : 0;
+	if (!AnimationData)
+		return MeshBounds[MeshIndex];
+
+	const FBox Bones = AnimationData->GetPlayedBoneBounds(Instance.AnimDatas);
+	if (!Bones.IsValid)
+		return MeshBounds[MeshIndex];
+
+	const FBox& Padding = BonePadding[MeshIndex];
+	return FBox(Bones.Min - Padding.Min, Bones.Max + Padding.Max);
+}
+
+void FSIInstanceBinner::Bin(TArrayView<USkeletalMesh* const> Meshes, const FView& View, const TArray<FSIMeshInstanceData>& InstanceDatas, int32 MaxDrawn, int32 MaxFading)
+{
+	check(Meshes.Num() > 0);
+
+	int32 MaxLODNum = 0;
+	for (USkeletalMesh* Mesh : Meshes)
+	{
+		MaxLODNum = FMath::Max(MaxLODNum, Mesh->GetResourceForRendering()->LODRenderData.Num());
+	}
+
+	ScreenSizes.SetNumUninitialized(InstanceDatas.Num(), false);
+	VisibleInstances.Reset();
+
+	for (int32 i = 0; i < InstanceDatas.Num(); i++)
+	{
+		const FSIMeshInstanceData& Instance = InstanceDatas[i];
+
+		if (!View.InstanceBounds)
+		{
+			ScreenSizes[i] = ComputeInstanceScreenRadiusSquared(View, View.InstanceToWorld.TransformPosition(Instance.Transform.GetOrigin()), 100);
+			VisibleInstances.Add(i);
+			continue;
+		}
+
+		FVector Center, Extent;
+		View.InstanceBounds->GetLocalBounds(Instance).TransformBy(Instance.Transform * View.InstanceToWorld).GetCenterAndExtents(Center, Extent);
+
+		if (View.ViewFrustum && !View.ViewFrustum->IntersectBox(Center, Extent))
+			continue;
+
+		ScreenSizes[i] = ComputeInstanceScreenRadiusSquared(View, Center, Extent.Size());
+		VisibleInstances.Add(i);
+	}
+
+	NumCulled = InstanceDatas.Num() - VisibleInstances.Num();
+
+	// Over budget, keep the largest instances on screen, ties broken by index so the choice is stable
+	int32 NumDrawn = VisibleInstances.Num();
+	int32 NumFading = 0;
+	DrawOrder.Reset();
+
+	if (MaxDrawn > 0 && VisibleInstances.Num() > MaxDrawn)
+	{
+		for (int32 i : VisibleInstances)
+		{
+			uint32 SizeBits;
+			FMemory::Memcpy(&SizeBits, &ScreenSizes[i], sizeof(uint32));
+			DrawOrder.Add(((uint64)(MAX_uint32 - SizeBits) << 32) | (uint32)i);
+		}
+
+		NumDrawn = MaxDrawn;
+		NumFading = FMath::Clamp(MaxFading, 0, MaxDrawn);
+
+		// only the cut needs an order: select the drawn keys, then the fading tail among them, and rank just the tail
+		uint64* Keys = DrawOrder.GetData();
+		const int32 FirstFading = NumDrawn - NumFading;
+		std::nth_element(Keys, Keys + NumDrawn, Keys + DrawOrder.Num());
+		if (NumFading > 0)
+		{
+			std::nth_element(Keys, Keys + FirstFading, Keys + NumDrawn);
+			Sort(Keys + FirstFading, NumFading);
+		}
+	}
+
+	NumDropped = VisibleInstances.Num() - NumDrawn;
+
+	// classify every drawn instance and count the bins, bin index is MeshIndex * MaxLODNum + LODIndex
+	const int32 NumBins = Meshes.Num() * MaxLODNum;
+	BinCursors.Reset();
+	BinCursors.AddZeroed(NumBins);
+	InstanceBins.SetNumUninitialized(NumDrawn, false);
+
+	for (int32 Rank = 0; Rank < NumDrawn; Rank++)
+	{
+		const int32 Index = DrawOrder.Num() > 0 ? (int32)(DrawOrder[Rank] & MAX_uint32) : VisibleInstances[Rank];
+
+		int32 MeshIndex = InstanceDatas[Index].MeshIndex;
+		if (!Meshes.IsValidIndex(MeshIndex))
+			MeshIndex = 0;
+
+		USkeletalMesh* Mesh = Meshes[MeshIndex];
+		int32 LODNum = Mesh->GetResourceForRendering()->LODRenderData.Num();
+		int LODLevel = GetMinDesiredLODLevel(Mesh, View, LODNum, ScreenSizes[Index]);
+		check(LODLevel < LODNum);
+
+		const int32 BinIndex = MeshIndex * MaxLODNum + LODLevel;
+		InstanceBins[Rank] = BinIndex;
+		BinCursors[BinIndex]++;
+	}
+
+	// lay the bins out back to back, the counts become write cursors
+	Bins.Reset();
+	int32 FirstInstance = 0;
+	for (int32 BinIndex = 0; BinIndex < NumBins; BinIndex++)
+	{
+		const int32 NumInstances = BinCursors[BinIndex];
+		BinCursors[BinIndex] = FirstInstance;
+
+		if (NumInstances > 0)
+		{
+			Bins.Add({ BinIndex / MaxLODNum, BinIndex % MaxLODNum, FirstInstance, NumInstances });
+			FirstInstance += NumInstances;
+		}
+	}
+
+	BinnedInstanceDatas.SetNumUninitialized(NumDrawn, false);
+	BinnedInstanceFades.SetNumUninitialized(NumDrawn, false);
+	BinnedInstanceIndices.SetNumUninitialized(NumDrawn, false);
+
+	for (int32 Rank = 0; Rank < NumDrawn; Rank++)
+	{
+		const int32 Index = DrawOrder.Num() > 0 ? (int32)(DrawOrder[Rank] & MAX_uint32) : VisibleInstances[Rank];
+
+		// the last drawn instances fade by rank, so instances near the cut off do not pop
+		uint8 Fade = 255;
+		if (Rank >= NumDrawn - NumFading)
+			Fade = (uint8)(255 * (NumDrawn - Rank) / (NumFading + 1));
+
+		const int32 Slot = BinCursors[InstanceBins[Rank]]++;
+		BinnedInstanceDatas[Slot] = InstanceDatas[Index];
+		BinnedInstanceFades[Slot] = Fade;
+		BinnedInstanceIndices[Slot] = Index;
+	}
+}
+
+void SIInstancePacking::PackTransforms(TArrayView<const FSIMeshInstanceData> InstanceDatas, FMatrix* OutTransforms)
+{
+	for (int32 i = 0; i < InstanceDatas.Num(); i++)
+	{
+		OutTransforms[i] = InstanceDatas[i].Transform;
+	}
+}
+
+void SIInstancePacking::PackAnimations(const FSIAnimationData& AnimationData, int32 LODIndex, TArrayView<const FSIMeshInstanceData> InstanceDatas,
+	TArrayView<const uint8> InstanceFades, uint32* OutAnimations)
+{
+	const FSIAnimationData::FPaletteTier& Tier = AnimationData.GetPaletteTier(AnimationData.GetPaletteTierForLOD(LODIndex));
+	const uint32 NumBones = AnimationData.GetNumBones();
+
+	for (int32 i = 0; i < InstanceDatas.Num(); i++)
+	{
+		PackAnimation(Tier, NumBones, InstanceDatas[i], InstanceFades[i], OutAnimations + i * AnimationWords);
+	}
+}
+
+void SIInstancePacking::ResolveAnimations(const FSIAnimationData& AnimationData, int32 Tier, TArrayView<const FSIMeshInstanceData> InstanceDatas,
+	uint32* OutAnimations)
+{
+	const FSIAnimationData::FPaletteTier& PaletteTier = AnimationData.GetPaletteTier(Tier);
+	const uint32 NumBones = AnimationData.GetNumBones();
+
+	for (int32 i = 0; i < InstanceDatas.Num(); i++)
+	{
+		PackAnimation(PaletteTier, NumBones, InstanceDatas[i], 255, OutAnimations + i * AnimationWords);
+	}
+}
+
+void SIInstancePacking::GatherAnimations(const uint32* ResolvedAnimations, TArrayView<const int32> SourceIndices, TArrayView<const uint8> InstanceFades,
+	uint32* OutAnimations)
+{
+	for (int32 i = 0; i < SourceIndices.Num(); i++)
+	{
+		uint32* Out = OutAnimations + i * AnimationWords;
+		FMemory::Memcpy(Out, ResolvedAnimations + SourceIndices[i] * AnimationWords, AnimationStride);
+		Out[FadeWord] = (Out[FadeWord] & ~FadeMask) | ((uint32)InstanceFades[i] << 16);
+	}
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "SIInstanceStore.h"
+
+class FSIAnimationData;
+class USkeletalMesh;
+class FConvexVolume;
+
+/**
+ * Local bounds of instances from the baked bone boxes of the frames they play, grown by how far each mesh extends
+ * beyond its bones in the reference pose. Falls back to the static mesh bounds without baked bone boxes.
+ */
+class FSIInstanceBounds
+{
+public:
+	void Init(TArrayView<USkeletalMesh* const> Meshes, const FSIAnimationData* InAnimationData);
+
+	bool IsValid() const { return MeshBounds.Num() > 0; }
+
+	FBox GetLocalBounds(const FSIMeshInstanceData& Instance) const;
+
+private:
+	const FSIAnimationData* AnimationData = nullptr;
+	/** Per mesh index */
+	TArray<FBox, TInlineAllocator<4>> MeshBounds;
+	TArray<FBox, TInlineAllocator<4>> BonePadding;
+};
+
+/**
+ * Splits the instances of a component into (mesh, LOD) bins for one view, applying the draw budget. The drawn
+ * instances of all bins are stored back to back so they can be uploaded at once.
+ */
+class FSIInstanceBinner
+{
+public:
+	struct FView
+	{
+		FVector4 Origin;
+		FMatrix ProjectionMatrix;
+		bool bUseLODs;
+
+		/** Brings instance transforms to world space, identity unless instances are component relative. */
+		FMatrix InstanceToWorld = FMatrix::Identity;
+
+		/** Per instance bounds for LOD selection and culling, a fixed radius of 100 is used without them. */
+		const FSIInstanceBounds* InstanceBounds = nullptr;
+
+		/** Instances outside are not drawn, needs InstanceBounds. */
+		const FConvexVolume* ViewFrustum = nullptr;
+	};
+
+	/** A contiguous range of BinnedInstanceDatas drawn with one mesh LOD. */
+	struct FBin
+	{
+		int32 MeshIndex;
+		int32 LODIndex;
+		int32 FirstInstance;
+		int32 NumInstances;
+	};
+
+	/** Meshes are indexed by FSIMeshInstanceData::MeshIndex, out of range indices use the first mesh. */
+	void Bin(TArrayView<USkeletalMesh* const> Meshes, const FView& View, const TArray<FSIMeshInstanceData>& InstanceDatas, int32 MaxDrawn, int32 MaxFading);
+
+	void Bin(USkeletalMesh* SkeletalMesh, const FView& View, const TArray<FSIMeshInstanceData>& InstanceDatas, int32 MaxDrawn, int32 MaxFading)
+	{
+		Bin(MakeArrayView(&SkeletalMesh, 1), View, InstanceDatas, MaxDrawn, MaxFading);
+	}
+
+	int32 GetNumDropped() const { return NumDropped; }
+
+	int32 GetNumCulled() const { return NumCulled; }
+
+	/** Every instance is drawn, in one bin and in its original order, so the bin is the instance array itself. */
+	bool IsIdentity() const { return Bins.Num() == 1 && NumCulled == 0 && NumDropped == 0; }
+
+	TArrayView<const FSIMeshInstanceData> GetBinInstanceDatas(const FBin& InBin) const
+	{
+		return TArrayView<const FSIMeshInstanceData>(BinnedInstanceDatas.GetData() + InBin.FirstInstance, InBin.NumInstances);
+	}
+
+	TArrayView<const uint8> GetBinInstanceFades(const FBin& InBin) const
+	{
+		return TArrayView<const uint8>(BinnedInstanceFades.GetData() + InBin.FirstInstance, InBin.NumInstances);
+	}
+
+	/** Index into the instance array given to Bin of every drawn instance of a bin. */
+	TArrayView<const int32> GetBinInstanceIndices(const FBin& InBin) const
+	{
+		return TArrayView<const int32>(BinnedInstanceIndices.GetData() + InBin.FirstInstance, InBin.NumInstances);
+	}
+
+public:
+	/** Non empty bins ordered by mesh, then LOD. */
+	TArray<FBin> Bins;
+	TArray<FSIMeshInstanceData> BinnedInstanceDatas;
+	TArray<uint8> BinnedInstanceFades;
+	TArray<int32> BinnedInstanceIndices;
+
+private:
+	TArray<float> ScreenSizes;
+	TArray<int32> VisibleInstances;
+	TArray<uint64> DrawOrder;
+	TArray<int32> InstanceBins;
+	TArray<int32> BinCursors;
+	int32 NumDropped = 0;
+	int32 NumCulled = 0;
+};
+
+/** Writes instances in the layout read by the vertex factory. */
+namespace SIInstancePacking
+{
+	/** Per instance: a 4x4 transform and 8 uint animation words. */
+	const uint32 TransformStride = 4 * sizeof(FVector4);
+	const uint32 AnimationStride = 8 * sizeof(uint32);
+
+	void PackTransforms(TArrayView<const FSIMeshInstanceData> InstanceDatas, FMatrix* OutTransforms);
+
+	void PackAnimations(const FSIAnimationData& AnimationData, int32 LODIndex, TArrayView<const FSIMeshInstanceData> InstanceDatas,
+		TArrayView<const uint8> InstanceFades, uint32* OutAnimations);
+
+	/**
+	 * Animation words of every instance against one palette tier, drawn without draw budget fade. Depends on neither
+	 * view nor LOD, so it can run as soon as the players advanced.
+	 */
+	void ResolveAnimations(const FSIAnimationData& AnimationData, int32 Tier, TArrayView<const FSIMeshInstanceData> InstanceDatas,
+		uint32* OutAnimations);
+
+	/** Copies the resolved words of the instances at SourceIndices and applies their draw budget fade. */
+	void GatherAnimations(const uint32* ResolvedAnimations, TArrayView<const int32> SourceIndices, TArrayView<const uint8> InstanceFades,
+		uint32* OutAnimations);
+}
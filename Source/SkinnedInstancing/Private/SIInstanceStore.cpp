@@ -0,0 +1,505 @@
+#include "SIInstanceStore.h"
+#include "Async/ParallelFor.h"
+#include <type_traits>
+
+namespace
+{
+	void GetInstanceDataFromPlayer(FSIMeshInstanceData::FAnimData& Data,
+		const FAnimtionPlayer::Sequence& Seq)
+	{
+		int NumFrames = Seq.NumFrames;
+		float SequenceLength = Seq.Length;
+		float Interval = (NumFrames > 1) ? (SequenceLength / (NumFrames - 1)) : MINIMUM_ANIMATION_LENGTH;
+
+		float Time = Seq.Time;
+		int Frame = Time / Interval;
+		float Lerp = (Time - Frame * Interval) / Interval;
+
+		Data.Sequence = FMath::Max(Seq.Id, 0);
+		Data.PrevFrame = FMath::Clamp(Frame, 0, FMath::Max(NumFrames - 1, 0));
+		Data.NextFrame = FMath::Clamp(Frame + 1, 0, FMath::Max(NumFrames - 1, 0));
+		Data.FrameLerp = FMath::Clamp(Lerp, 0.0f, 1.0f);
+	}
+
+	/** Same result as FTransform(Rotation, Translation, Scale).ToMatrixWithScale(), without building the FTransform. */
+	FORCEINLINE void ComposeMatrix(const FVector& Translation, const FQuat& Rotation, const FVector& Scale, FMatrix& OutMatrix)
+	{
+		const VectorRegister Q = VectorLoad(&Rotation);
+		const VectorRegister Q2 = VectorAdd(Q, Q);
+
+		// (xx2, yy2, zz2), (xy2, yz2, zx2) and (wx2, wy2, wz2)
+		const VectorRegister Squares = VectorMultiply(Q, Q2);
+		const VectorRegister Cross = VectorMultiply(Q, VectorSwizzle(Q2, 1, 2, 0, 3));
+		const VectorRegister W = VectorMultiply(VectorReplicate(Q, 3), Q2);
+
+		// 1 - (yy2 + zz2), 1 - (xx2 + zz2), 1 - (xx2 + yy2)
+		const VectorRegister Diagonal = VectorSubtract(GlobalVectorConstants::FloatOne,
+			VectorAdd(VectorSwizzle(Squares, 1, 0, 0, 3), VectorSwizzle(Squares, 2, 2, 1, 3)));
+
+		// (xy2 + wz2, yz2 + wx2, zx2 + wy2) and (xy2 - wz2, yz2 - wx2, zx2 - wy2)
+		const VectorRegister WShifted = VectorSwizzle(W, 2, 0, 1, 3);
+		const VectorRegister Sum = VectorAdd(Cross, WShifted);
+		const VectorRegister Difference = VectorSubtract(Cross, WShifted);
+
+		MS_ALIGN(16) float D[4] GCC_ALIGN(16);
+		MS_ALIGN(16) float S[4] GCC_ALIGN(16);
+		MS_ALIGN(16) float M[4] GCC_ALIGN(16);
+		VectorStoreAligned(Diagonal, D);
+		VectorStoreAligned(Sum, S);
+		VectorStoreAligned(Difference, M);
+
+		VectorStoreAligned(VectorMultiply(MakeVectorRegister(D[0], S[0], M[2], 0.0f), VectorSetFloat1(Scale.X)), &OutMatrix.M[0][0]);
+		VectorStoreAligned(VectorMultiply(MakeVectorRegister(M[0], D[1], S[1], 0.0f), VectorSetFloat1(Scale.Y)), &OutMatrix.M[1][0]);
+		VectorStoreAligned(VectorMultiply(MakeVectorRegister(S[2], M[1], D[2], 0.0f), VectorSetFloat1(Scale.Z)), &OutMatrix.M[2][0]);
+		VectorStoreAligned(VectorLoadFloat3_W1(&Translation), &OutMatrix.M[3][0]);
+	}
+
+	const int32 GTransformChunkSize = 1024;
+
+	const uint32 GSnapshotMagic = 0x53495353; // 'SISS'
+	const uint32 GSnapshotVersion = 2;
+	const int32 GSnapshotAlignment = 16;
+
+	/** Record sizes catch layout changes that were not followed by a version bump. */
+	struct FSnapshotHeader
+	{
+		uint32 Magic;
+		uint32 Version;
+		uint32 NumInstances;
+		int32 NextHandle;
+		uint32 NumStateParameters;
+		uint16 InstanceDataSize;
+		uint16 PlayerSize;
+		uint32 Reserved[2];
+	};
+
+	static_assert(std::is_trivially_copyable<FSIMeshInstanceData>::value, "Instance data is copied in bulk by snapshots");
+	static_assert(std::is_trivially_copyable<FAnimtionPlayer>::value, "Players are copied in bulk by snapshots");
+
+	void WriteBlock(TArray<uint8>& Out, const void* Data, SIZE_T Size)
+	{
+		Out.AddZeroed(Align(Out.Num(), GSnapshotAlignment) - Out.Num());
+		const int32 Offset = Out.AddUninitialized(Size);
+		if (Size > 0)
+			FMemory::Memcpy(Out.GetData() + Offset, Data, Size);
+	}
+
+	/** Frames a snapshot was taken with, re-imported shorter sequences would be sampled past their end. */
+	bool IsValidAnimData(const FSIMeshInstanceData::FAnimData& AnimData, const FSIInstanceStore::FSnapshotLimits& Limits)
+	{
+		if (!Limits.bCheckSequences)
+			return true;
+		if (!Limits.SequenceNumFrames.IsValidIndex(AnimData.Sequence))
+			return false;
+
+		const int32 NumFrames = Limits.SequenceNumFrames[AnimData.Sequence];
+		return AnimData.PrevFrame >= 0 && AnimData.PrevFrame < NumFrames && AnimData.NextFrame >= 0 && AnimData.NextFrame < NumFrames;
+	}
+
+	/** Players keep producing frames from their own frame count, it must still be the sequence's. */
+	bool IsValidPlayerSequence(const FAnimtionPlayer::Sequence& Seq, const FSIInstanceStore::FSnapshotLimits& Limits)
+	{
+		if (!Limits.bCheckSequences || Seq.Id < 0)
+			return true;
+		return Limits.SequenceNumFrames.IsValidIndex(Seq.Id) && Limits.SequenceNumFrames[Seq.Id] == Seq.NumFrames;
+	}
+
+	/** Offset of the next block after Offset, INDEX_NONE when it does not fit into Data. */
+	int64 NextBlock(TArrayView<const uint8> Data, int64 Offset, SIZE_T Size)
+	{
+		const int64 Start = Align(Offset, GSnapshotAlignment);
+		return Start + (int64)Size <= Data.Num() ? Start : INDEX_NONE;
+	}
+}
+
+FSIInstanceStore::FSIInstanceStore()
+	: NextHandle(0)
+	, Revision(0)
+{
+}
+
+void FSIInstanceStore::Reserve(int32 NumInstances)
+{
+	const int32 NewNum = Handles.Num() + NumInstances;
+	Handles.Reserve(NewNum);
+	InstanceDatas.Reserve(NewNum);
+	Players.Reserve(NewNum);
+	UpdateStates.Reserve(NewNum);
+	AnimStates.Reserve(NewNum);
+	for (TArray<float>& Column : StateParameters)
+	{
+		Column.Reserve(NewNum);
+	}
+	HandleToIndex.Reserve(NewNum);
+}
+
+int32 FSIInstanceStore::Add(const FMatrix& Transform)
+{
+	int32 Handle = ++NextHandle;
+	int32 Index = Handles.Add(Handle);
+
+	FSIMeshInstanceData& NewInstanceData = InstanceDatas.AddDefaulted_GetRef();
+	NewInstanceData.Transform = Transform;
+	NewInstanceData.AnimDatas[0] = { 0, 0, 0, 0, 1 };
+	NewInstanceData.AnimDatas[1] = { 0, 0, 0, 0, 0 };
+	NewInstanceData.MeshIndex = 0;
+
+	Players.AddDefaulted();
+	UpdateStates.AddDefaulted();
+	AnimStates.Add(INDEX_NONE);
+	for (TArray<float>& Column : StateParameters)
+	{
+		Column.Add(0.0f);
+	}
+
+	HandleToIndex.Add(Handle, Index);
+	MarkChanged();
+
+	return Handle;
+}
+
+bool FSIInstanceStore::Remove(int32 Handle)
+{
+	int32 Index = FindIndex(Handle);
+	if (Index == INDEX_NONE)
+		return false;
+
+	HandleToIndex.Remove(Handle);
+
+	Handles.RemoveAtSwap(Index, 1, false);
+	InstanceDatas.RemoveAtSwap(Index, 1, false);
+	Players.RemoveAtSwap(Index, 1, false);
+	UpdateStates.RemoveAtSwap(Index, 1, false);
+	AnimStates.RemoveAtSwap(Index, 1, false);
+	for (TArray<float>& Column : StateParameters)
+	{
+		Column.RemoveAtSwap(Index, 1, false);
+	}
+
+	// the last instance was moved into the hole
+	if (Index < Handles.Num())
+		HandleToIndex.Add(Handles[Index], Index);
+
+	MarkChanged();
+	return true;
+}
+
+void FSIInstanceStore::Empty()
+{
+	Handles.Reset();
+	InstanceDatas.Reset();
+	Players.Reset();
+	UpdateStates.Reset();
+	AnimStates.Reset();
+	for (TArray<float>& Column : StateParameters)
+	{
+		Column.Reset();
+	}
+	HandleToIndex.Reset();
+	MarkChanged();
+}
+
+SIZE_T FSIInstanceStore::GetAllocatedSize() const
+{
+	SIZE_T Size = Handles.GetAllocatedSize() + InstanceDatas.GetAllocatedSize() + Players.GetAllocatedSize()
+		+ UpdateStates.GetAllocatedSize() + AnimStates.GetAllocatedSize() + HandleToIndex.GetAllocatedSize();
+
+	Size += StateParameters.GetAllocatedSize();
+	for (const TArray<float>& Column : StateParameters)
+	{
+		Size += Column.GetAllocatedSize();
+	}
+	return Size;
+}
+
+void FSIInstanceStore::SaveSnapshot(TArray<uint8>& Out) const
+{
+	const int32 NumInstances = Num();
+
+	FSnapshotHeader Header;
+	FMemory::Memzero(Header);
+	Header.Magic = GSnapshotMagic;
+	Header.Version = GSnapshotVersion;
+	Header.NumInstances = NumInstances;
+	Header.NextHandle = NextHandle;
+	Header.NumStateParameters = StateParameters.Num();
+	Header.InstanceDataSize = sizeof(FSIMeshInstanceData);
+	Header.PlayerSize = sizeof(FAnimtionPlayer);
+
+	SIZE_T Size = Align(sizeof(Header), GSnapshotAlignment) + (SIZE_T)NumInstances * (sizeof(int32) * 2 + sizeof(float) + sizeof(FSIMeshInstanceData) + sizeof(FAnimtionPlayer));
+	Size += (SIZE_T)StateParameters.Num() * (Align(NumInstances * sizeof(float), GSnapshotAlignment));
+	Out.Reserve(Align(Out.Num(), GSnapshotAlignment) + Size + 4 * GSnapshotAlignment);
+
+	WriteBlock(Out, &Header, sizeof(Header));
+	WriteBlock(Out, Handles.GetData(), NumInstances * sizeof(int32));
+	WriteBlock(Out, InstanceDatas.GetData(), NumInstances * sizeof(FSIMeshInstanceData));
+	WriteBlock(Out, Players.GetData(), NumInstances * sizeof(FAnimtionPlayer));
+	WriteBlock(Out, AnimStates.GetData(), NumInstances * sizeof(int32));
+
+	// time slow update bands have not played yet belongs to the clocks, the empty write only aligns the block
+	WriteBlock(Out, nullptr, 0);
+	float* PendingDeltaTimes = (float*)(Out.GetData() + Out.AddUninitialized(NumInstances * sizeof(float)));
+	for (int32 Index = 0; Index < NumInstances; Index++)
+	{
+		PendingDeltaTimes[Index] = UpdateStates[Index].PendingDeltaTime;
+	}
+
+	for (const TArray<float>& Column : StateParameters)
+	{
+		WriteBlock(Out, Column.GetData(), NumInstances * sizeof(float));
+	}
+}
+
+bool FSIInstanceStore::LoadSnapshot(TArrayView<const uint8> Data, const FSnapshotLimits& Limits)
+{
+	if (Data.Num() < (int32)sizeof(FSnapshotHeader))
+		return false;
+
+	FSnapshotHeader Header;
+	FMemory::Memcpy(&Header, Data.GetData(), sizeof(Header));
+	if (Header.Magic != GSnapshotMagic || Header.Version != GSnapshotVersion
+		|| Header.InstanceDataSize != sizeof(FSIMeshInstanceData) || Header.PlayerSize != sizeof(FAnimtionPlayer))
+	{
+		return false;
+	}
+
+	const int32 NumInstances = Header.NumInstances;
+	const int32 NumParameters = Header.NumStateParameters;
+	if (NumInstances < 0 || NumParameters < 0 || NumParameters > Limits.NumStateParameters || NumParameters > Data.Num())
+		return false;
+
+	// find every block before touching anything
+	const int64 HandlesOffset = NextBlock(Data, sizeof(Header), NumInstances * sizeof(int32));
+	const int64 InstanceDatasOffset = HandlesOffset != INDEX_NONE ? NextBlock(Data, HandlesOffset + NumInstances * sizeof(int32), NumInstances * sizeof(FSIMeshInstanceData)) : INDEX_NONE;
+	const int64 PlayersOffset = InstanceDatasOffset != INDEX_NONE ? NextBlock(Data, InstanceDatasOffset + NumInstances * sizeof(FSIMeshInstanceData), NumInstances * sizeof(FAnimtionPlayer)) : INDEX_NONE;
+	const int64 AnimStatesOffset = PlayersOffset != INDEX_NONE ? NextBlock(Data, PlayersOffset + NumInstances * sizeof(FAnimtionPlayer), NumInstances * sizeof(int32)) : INDEX_NONE;
+	const int64 PendingOffset = AnimStatesOffset != INDEX_NONE ? NextBlock(Data, AnimStatesOffset + NumInstances * sizeof(int32), NumInstances * sizeof(float)) : INDEX_NONE;
+	if (PendingOffset == INDEX_NONE)
+		return false;
+
+	TArray<int64, TInlineAllocator<8>> ParameterOffsets;
+	int64 Offset = PendingOffset + NumInstances * sizeof(float);
+	for (int32 Parameter = 0; Parameter < NumParameters; Parameter++)
+	{
+		Offset = NextBlock(Data, Offset, NumInstances * sizeof(float));
+		if (Offset == INDEX_NONE)
+			return false;
+
+		ParameterOffsets.Add(Offset);
+		Offset += NumInstances * sizeof(float);
+	}
+
+	const uint8* Bytes = Data.GetData();
+
+	// a snapshot of another setup or of since re-imported sequences would index past the palette, meshes or state
+	// machine, blocks may be unaligned
+	for (int32 Index = 0; Index < NumInstances; Index++)
+	{
+		FSIMeshInstanceData::FAnimData AnimDatas[2];
+		int32 MeshIndex;
+		const uint8* Instance = Bytes + InstanceDatasOffset + (SIZE_T)Index * sizeof(FSIMeshInstanceData);
+		FMemory::Memcpy(AnimDatas, Instance + STRUCT_OFFSET(FSIMeshInstanceData, AnimDatas), sizeof(AnimDatas));
+		FMemory::Memcpy(&MeshIndex, Instance + STRUCT_OFFSET(FSIMeshInstanceData, MeshIndex), sizeof(MeshIndex));
+
+		FAnimtionPlayer Player;
+		FMemory::Memcpy(&Player, Bytes + PlayersOffset + (SIZE_T)Index * sizeof(FAnimtionPlayer), sizeof(Player));
+
+		int32 AnimState;
+		FMemory::Memcpy(&AnimState, Bytes + AnimStatesOffset + (SIZE_T)Index * sizeof(int32), sizeof(AnimState));
+
+		// animation data is only written from players that play something
+		const bool bPlaying = Player.GetCurrentSeq().Id >= 0;
+		if ((bPlaying && (!IsValidAnimData(AnimDatas[0], Limits) || !IsValidAnimData(AnimDatas[1], Limits)))
+			|| !IsValidPlayerSequence(Player.GetCurrentSeq(), Limits) || !IsValidPlayerSequence(Player.GetNextSeq(), Limits)
+			|| MeshIndex < 0 || MeshIndex >= Limits.NumMeshes
+			|| AnimState < INDEX_NONE || AnimState >= Limits.NumStates)
+		{
+			return false;
+		}
+	}
+
+	Handles.SetNumUninitialized(NumInstances);
+	InstanceDatas.SetNumUninitialized(NumInstances);
+	Players.SetNumUninitialized(NumInstances);
+	AnimStates.SetNumUninitialized(NumInstances);
+	FMemory::Memcpy(Handles.GetData(), Bytes + HandlesOffset, NumInstances * sizeof(int32));
+	FMemory::Memcpy(InstanceDatas.GetData(), Bytes + InstanceDatasOffset, NumInstances * sizeof(FSIMeshInstanceData));
+	FMemory::Memcpy(Players.GetData(), Bytes + PlayersOffset, NumInstances * sizeof(FAnimtionPlayer));
+	FMemory::Memcpy(AnimStates.GetData(), Bytes + AnimStatesOffset, NumInstances * sizeof(int32));
+
+	StateParameters.SetNum(NumParameters);
+	for (int32 Parameter = 0; Parameter < NumParameters; Parameter++)
+	{
+		StateParameters[Parameter].SetNumUninitialized(NumInstances);
+		FMemory::Memcpy(StateParameters[Parameter].GetData(), Bytes + ParameterOffsets[Parameter], NumInstances * sizeof(float));
+	}
+
+	// the rest of the update rate bookkeeping is transient, restored instances update on their next tick
+	UpdateStates.Reset();
+	UpdateStates.AddDefaulted(NumInstances);
+	for (int32 Index = 0; Index < NumInstances; Index++)
+	{
+		FMemory::Memcpy(&UpdateStates[Index].PendingDeltaTime, Bytes + PendingOffset + (SIZE_T)Index * sizeof(float), sizeof(float));
+	}
+
+	HandleToIndex.Reset();
+	HandleToIndex.Reserve(NumInstances);
+	for (int32 Index = 0; Index < NumInstances; Index++)
+	{
+		HandleToIndex.Add(Handles[Index], Index);
+	}
+
+	NextHandle = Header.NextHandle;
+	MarkChanged();
+	return true;
+}
+
+void FSIInstanceStore::SetNumStateParameters(int32 NumParameters)
+{
+	const int32 OldNumParameters = StateParameters.Num();
+	StateParameters.SetNum(NumParameters);
+
+	for (int32 Parameter = OldNumParameters; Parameter < NumParameters; Parameter++)
+	{
+		StateParameters[Parameter].AddZeroed(Handles.Num());
+	}
+}
+
+bool FSIInstanceStore::SetTransforms(TArrayView<const int32> InHandles, const TSIStridedView<FVector>& Positions,
+	const TSIStridedView<FQuat>& Rotations, const TSIStridedView<FVector>& Scales)
+{
+	const int32 NumTransforms = InHandles.Num();
+	if (Positions.Num != NumTransforms || Rotations.Num != NumTransforms || (Scales.Num != 0 && Scales.Num != NumTransforms))
+		return false;
+
+	if (NumTransforms == 0)
+		return true;
+
+	const bool bHasScales = Scales.Num > 0;
+	const int32 NumChunks = FMath::DivideAndRoundUp(NumTransforms, GTransformChunkSize);
+
+	// chunks write disjoint instances, the handle map is only read
+	ParallelFor(NumChunks, [&](int32 ChunkIndex)
+	{
+		const int32 Start = ChunkIndex * GTransformChunkSize;
+		const int32 End = FMath::Min(Start + GTransformChunkSize, NumTransforms);
+
+		for (int32 i = Start; i < End; i++)
+		{
+			const int32 Index = FindIndex(InHandles[i]);
+			if (Index == INDEX_NONE)
+				continue;
+
+			ComposeMatrix(Positions[i], Rotations[i], bHasScales ? Scales[i] : FVector::OneVector, InstanceDatas[Index].Transform);
+		}
+	}, NumChunks == 1);
+
+	MarkChanged();
+	return true;
+}
+
+void FSIInstanceStore::ConsumeRootMotion(TArrayView<const int32> InHandles, TArrayView<const FSIRootMotionTrack> Tracks, TArrayView<FTransform> OutDeltas)
+{
+	check(InHandles.Num() == OutDeltas.Num());
+
+	const int32 NumChunks = FMath::DivideAndRoundUp(InHandles.Num(), GTransformChunkSize);
+
+	// chunks touch disjoint players, the handle map is only read
+	ParallelFor(NumChunks, [&](int32 ChunkIndex)
+	{
+		const int32 Start = ChunkIndex * GTransformChunkSize;
+		const int32 End = FMath::Min(Start + GTransformChunkSize, InHandles.Num());
+
+		for (int32 i = Start; i < End; i++)
+		{
+			const int32 Index = FindIndex(InHandles[i]);
+			if (Index == INDEX_NONE)
+			{
+				OutDeltas[i] = FTransform::Identity;
+				continue;
+			}
+
+			FAnimtionPlayer& Player = Players[Index];
+			const FAnimtionPlayer::Sequence& CurrentSeq = Player.GetCurrentSeq();
+			const FAnimtionPlayer::Sequence& NextSeq = Player.GetNextSeq();
+
+			FTransform Delta = Tracks.IsValidIndex(CurrentSeq.Id)
+				? Tracks[CurrentSeq.Id].Extract(CurrentSeq.Time, CurrentSeq.PlayedTime, Player.IsLooping()) : FTransform::Identity;
+
+			// same weight as UpdateAnimData gives the layers
+			if (CurrentSeq.Id != NextSeq.Id)
+			{
+				const FTransform NextDelta = Tracks.IsValidIndex(NextSeq.Id)
+					? Tracks[NextSeq.Id].Extract(NextSeq.Time, NextSeq.PlayedTime, Player.IsNextLooping()) : FTransform::Identity;
+				const float BlendWeight = Player.GetFadeTime() / FMath::Max(Player.GetFadeLength(), 0.001f);
+				Delta.Blend(NextDelta, FTransform(Delta), BlendWeight);
+			}
+
+			OutDeltas[i] = Delta;
+			Player.ResetPlayedTime();
+		}
+	}, NumChunks <= 1);
+}
+
+void FSIInstanceStore::TickPlayer(int32 Index, float DeltaTime, TArrayView<const FSINotifyTrack> NotifyTracks, TArray<FSIInstanceNotify>& OutNotifies)
+{
+	FAnimtionPlayer& Player = Players[Index];
+
+	if (NotifyTracks.Num() > 0)
+	{
+		// one layer fires, so footsteps do not double up during a cross fade
+		const bool bFading = Player.GetCurrentSeq().Id != Player.GetNextSeq().Id && Player.GetFadeTime() > 0 && Player.GetFadeLength() > 0;
+		const bool bFromNext = bFading && Player.GetFadeTime() < Player.GetFadeLength() * 0.5f;
+		const FAnimtionPlayer::Sequence& Seq = bFromNext ? Player.GetNextSeq() : Player.GetCurrentSeq();
+
+		if (NotifyTracks.IsValidIndex(Seq.Id))
+		{
+			const FSINotifyTrack& Track = NotifyTracks[Seq.Id];
+			Track.ForEachCrossed(Seq.Time, DeltaTime, bFromNext ? Player.IsNextLooping() : Player.IsLooping(), [&](int32 NotifyIndex)
+			{
+				OutNotifies.Add(FSIInstanceNotify{ Handles[Index], Seq.Id, Track.Names[NotifyIndex] });
+			});
+		}
+	}
+
+	Player.Tick(DeltaTime);
+}
+
+void FSIInstanceStore::FlushPendingTime(int32 Index, TArrayView<const FSINotifyTrack> NotifyTracks, TArray<FSIInstanceNotify>& OutNotifies)
+{
+	FSIInstanceUpdateState& State = UpdateStates[Index];
+	if (State.PendingDeltaTime > 0)
+	{
+		TickPlayer(Index, State.PendingDeltaTime, NotifyTracks, OutNotifies);
+		State.PendingDeltaTime = 0;
+	}
+}
+
+void FSIInstanceStore::UpdateAnimData(int32 Index)
+{
+	const FAnimtionPlayer& Player = Players[Index];
+	if (Player.GetCurrentSeq().Id < 0)
+		return;
+
+	FSIMeshInstanceData& Instance = InstanceDatas[Index];
+	FSIMeshInstanceData::FAnimData OldAnimDatas[2] = { Instance.AnimDatas[0], Instance.AnimDatas[1] };
+
+	GetInstanceDataFromPlayer(Instance.AnimDatas[0], Player.GetCurrentSeq());
+	GetInstanceDataFromPlayer(Instance.AnimDatas[1], Player.GetNextSeq());
+
+	float BlendWeight = 1;
+
+	if (Player.GetCurrentSeq().Id != Player.GetNextSeq().Id)
+	{
+		float FadeTime = Player.GetFadeTime();
+		float FadeLength = FMath::Max(Player.GetFadeLength(), 0.001f);
+		BlendWeight = FadeTime / FadeLength;
+	}
+
+	Instance.AnimDatas[0].BlendWeight = BlendWeight;
+	Instance.AnimDatas[1].BlendWeight = 1 - BlendWeight;
+
+	// a finished non looping clip or a paused player produces the same frame again
+	if (FMemory::Memcmp(OldAnimDatas, Instance.AnimDatas, sizeof(OldAnimDatas)) != 0)
+		MarkChanged();
+}
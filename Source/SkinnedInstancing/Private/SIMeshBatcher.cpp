@@ -0,0 +1,100 @@
+#include "SIMeshBatcher.h"
+#include "Engine/World.h"
+#include "Materials/MaterialInterface.h"
+#include "SIMeshComponent.h"
+
+namespace
+{
+	struct FSIMeshBatchKey
+	{
+		UWorld* World = nullptr;
+		USkeletalMesh* SkeletalMesh = nullptr;
+		USIAnimationComponent* AnimationComponent = nullptr;
+		TArray<USkeletalMesh*> VariantMeshes;
+		TArray<UMaterialInterface*> Materials;
+
+		explicit FSIMeshBatchKey(const USIMeshComponent* Component)
+			: World(Component->GetWorld())
+			, SkeletalMesh(Component->SkeletalMesh)
+			, AnimationComponent(Component->AnimationComponent.Get())
+			, VariantMeshes(Component->VariantMeshes)
+		{
+			const UPrimitiveComponent* Primitive = Component;
+			for (int32 MaterialIndex = 0; MaterialIndex < Primitive->GetNumMaterials(); MaterialIndex++)
+				Materials.Add(Primitive->GetMaterial(MaterialIndex));
+		}
+
+		bool operator==(const FSIMeshBatchKey& Other) const
+		{
+			return World == Other.World && SkeletalMesh == Other.SkeletalMesh
+				&& AnimationComponent == Other.AnimationComponent && VariantMeshes == Other.VariantMeshes && Materials == Other.Materials;
+		}
+
+		friend uint32 GetTypeHash(const FSIMeshBatchKey& Key)
+		{
+			uint32 Hash = HashCombine(PointerHash(Key.World), PointerHash(Key.SkeletalMesh));
+			Hash = HashCombine(Hash, PointerHash(Key.AnimationComponent));
+			for (USkeletalMesh* Variant : Key.VariantMeshes)
+				Hash = HashCombine(Hash, PointerHash(Variant));
+			for (UMaterialInterface* Material : Key.Materials)
+				Hash = HashCombine(Hash, PointerHash(Material));
+			return Hash;
+		}
+	};
+
+	TMap<FSIMeshBatchKey, TWeakPtr<FSIMeshBatch>> GBatches;
+}
+
+TSharedPtr<FSIMeshBatch> FSIMeshBatcher::Join(USIMeshComponent* Component)
+{
+	check(IsInGameThread());
+
+	if (!Component->SkeletalMesh || !Component->AnimationComponent.IsValid())
+		return nullptr;
+
+	FSIMeshBatchKey Key(Component);
+	TSharedPtr<FSIMeshBatch> Batch = GBatches.FindRef(Key).Pin();
+	if (!Batch.IsValid())
+	{
+		Batch = MakeShared<FSIMeshBatch>();
+		GBatches.Add(Key, Batch);
+	}
+
+	Batch->Members.AddUnique(Component);
+
+	// the leader draws the new member from now on
+	USIMeshComponent* Leader = Batch->GetLeader();
+	if (Leader != Component)
+		Leader->OnBatchMembersChanged();
+
+	return Batch;
+}
+
+void FSIMeshBatcher::Leave(USIMeshComponent* Component, TSharedPtr<FSIMeshBatch>& Batch)
+{
+	check(IsInGameThread());
+
+	if (!Batch.IsValid())
+		return;
+
+	const bool bWasLeader = Batch->GetLeader() == Component;
+	Batch->Members.Remove(Component);
+
+	if (USIMeshComponent* Leader = Batch->GetLeader())
+	{
+		// a new leader needs its own proxy and mesh object
+		if (bWasLeader)
+			Leader->MarkRenderStateDirty();
+		Leader->OnBatchMembersChanged();
+	}
+	else
+	{
+		for (auto It = GBatches.CreateIterator(); It; ++It)
+		{
+			if (!It.Value().IsValid() || It.Value().Pin() == Batch)
+				It.RemoveCurrent();
+		}
+	}
+
+	Batch.Reset();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+class USIMeshComponent;
+
+/**
+ * Components that share a skeletal mesh, animation component and materials in one world.
+ * The first member leads: it owns the scene proxy and draws the instances of every member.
+ */
+class FSIMeshBatch
+{
+public:
+	USIMeshComponent* GetLeader() const { return Members.Num() > 0 ? Members[0] : nullptr; }
+
+	const TArray<USIMeshComponent*>& GetMembers() const { return Members; }
+
+private:
+	TArray<USIMeshComponent*> Members;
+
+	friend class FSIMeshBatcher;
+};
+
+/** Game thread registry of the batches, components join on register when they opt in. */
+class FSIMeshBatcher
+{
+public:
+	static TSharedPtr<FSIMeshBatch> Join(USIMeshComponent* Component);
+
+	static void Leave(USIMeshComponent* Component, TSharedPtr<FSIMeshBatch>& Batch);
+};
@@ -7,6 +7,55 @@
 #include "BonePose.h"
 #include "SIAnimationData.h"
 #include "MeshDrawShaderBindings.h"
+#include "SIStats.h"
+#include "SIInstancePacking.h"
+#include "SkinnedInstancing.h"
+#include "SIMeshBatcher.h"
+#include "Misc/ScopeLock.h"
+#include "Misc/App.h"
+#include "Engine/SkeletalMeshSocket.h"
+#include "SIInstanceCollision.h"
+
+DECLARE_CYCLE_STAT(TEXT("Tick Instances"), STAT_SITickInstances, STATGROUP_SkinnedInstancing);
+DECLARE_CYCLE_STAT(TEXT("Update Dynamic Data"), STAT_SIUpdateDynamicData, STATGROUP_SkinnedInstancing);
+DECLARE_CYCLE_STAT(TEXT("Build Dynamic Data Task"), STAT_SIBuildDynamicDataTask, STATGROUP_SkinnedInstancing);
+DECLARE_CYCLE_STAT(TEXT("Wait For Dynamic Data Task"), STAT_SIWaitForDynamicDataTask, STATGROUP_SkinnedInstancing);
+DECLARE_CYCLE_STAT(TEXT("Set Instance Transforms"), STAT_SISetInstanceTransforms, STATGROUP_SkinnedInstancing);
+DECLARE_CYCLE_STAT(TEXT("Bone Transform Queries"), STAT_SIBoneTransformQueries, STATGROUP_SkinnedInstancing);
+DECLARE_CYCLE_STAT(TEXT("Root Motion"), STAT_SIRootMotion, STATGROUP_SkinnedInstancing);
+DECLARE_CYCLE_STAT(TEXT("Instance Hit Tests"), STAT_SIInstanceHitTests, STATGROUP_SkinnedInstancing);
+DECLARE_CYCLE_STAT(TEXT("Instance Snapshots"), STAT_SIInstanceSnapshots, STATGROUP_SkinnedInstancing);
+DECLARE_CYCLE_STAT(TEXT("Flush Instance Commands"), STAT_SIFlushInstanceCommands, STATGROUP_SkinnedInstancing);
+DECLARE_CYCLE_STAT(TEXT("Evaluate State Machine"), STAT_SIEvaluateStateMachine, STATGROUP_SkinnedInstancing);
+DECLARE_CYCLE_STAT(TEXT("Calc Bounds"), STAT_SICalcBounds, STATGROUP_SkinnedInstancing);
+DECLARE_CYCLE_STAT(TEXT("Get Dynamic Mesh Elements"), STAT_SIGetDynamicMeshElements, STATGROUP_SkinnedInstancing);
+DECLARE_CYCLE_STAT(TEXT("LOD Binning"), STAT_SILODBinning, STATGROUP_SkinnedInstancing);
+DECLARE_CYCLE_STAT(TEXT("Upload Instances"), STAT_SIUploadInstances, STATGROUP_SkinnedInstancing);
+DECLARE_CYCLE_STAT(TEXT("Upload Bone Maps"), STAT_SIUploadBoneMaps, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Instances LOD 0"), STAT_SIInstancesLOD0, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Instances LOD 1"), STAT_SIInstancesLOD1, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Instances LOD 2"), STAT_SIInstancesLOD2, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Instances LOD 3+"), STAT_SIInstancesLOD3, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Bytes Uploaded"), STAT_SIBytesUploaded, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Render State Recreates"), STAT_SIRenderStateRecreates, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Skipped Dynamic Data Sends"), STAT_SISkippedDynamicDataSends, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Discarded Dynamic Data Tasks"), STAT_SIDiscardedDynamicDataTasks, STATGROUP_SkinnedInstancing);
+DECLARE_MEMORY_STAT(TEXT("Mesh Object GPU Memory"), STAT_SIMeshObjectGPUMemory, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Shared Mesh Resources"), STAT_SISharedMeshResources, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Instances Updated Every Frame"), STAT_SIUpdateRateBand0, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Instances Updated Every 2nd Frame"), STAT_SIUpdateRateBand1, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Instances Updated Every 4th Frame"), STAT_SIUpdateRateBand2, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Instances Updated Every 8th Frame"), STAT_SIUpdateRateBand3, STATGROUP_SkinnedInstancing);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Update Rate Time Saved (ms)"), STAT_SIUpdateRateTimeSaved, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Update Budget Overruns"), STAT_SIUpdateBudgetOverruns, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Deferred Instance Updates"), STAT_SIDeferredUpdates, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Instance Notifies"), STAT_SIInstanceNotifies, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Instance Commands"), STAT_SIInstanceCommands, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("State Transitions"), STAT_SIStateTransitions, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Max Update Latency (frames)"), STAT_SIMaxUpdateLatency, STATGROUP_SkinnedInstancing);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Avg Update Latency (frames)"), STAT_SIAvgUpdateLatency, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Instances Dropped By Draw Budget"), STAT_SIDroppedInstances, STATGROUP_SkinnedInstancing);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Instances Frustum Culled"), STAT_SICulledInstances, STATGROUP_SkinnedInstancing);
 
 #pragma optimize( "", off )
 namespace
@@ -29,6 +78,90 @@ namespace
 		TEXT("Whether to use frame lerp. Cannot be changed at runtime."),
 		ECVF_ReadOnly);
 
+	static TAutoConsoleVariable<int32> CVarSkinnedInstancingDrawBudgetFade(
+		TEXT("r.SkinnedInstancing.DrawBudgetFade"),
+		0,
+		TEXT("Whether the least significant drawn instances fade out through vertex color alpha when a draw budget is hit. Cannot be changed at runtime."),
+		ECVF_ReadOnly);
+
+	static TAutoConsoleVariable<int32> CVarSkinnedInstancingMaxDrawnInstances(
+		TEXT("r.SkinnedInstancing.MaxDrawnInstances"),
+		0,
+		TEXT("Maximum instances drawn per component and view, used by components without their own budget. 0 means no limit."),
+		ECVF_RenderThreadSafe);
+
+	static TAutoConsoleVariable<float> CVarSkinnedInstancingUpdateBudgetMs(
+		TEXT("r.SkinnedInstancing.UpdateBudgetMs"),
+		2.0f,
+		TEXT("Game thread time per frame for instance animation updates, shared by all components. Updates over budget are carried over to the next frame. 0 disables the budget."),
+		ECVF_Default);
+
+	static TAutoConsoleVariable<int32> CVarSkinnedInstancingMinUpdatesPerComponent(
+		TEXT("r.SkinnedInstancing.MinUpdatesPerComponent"),
+		64,
+		TEXT("Instance updates every component makes per frame even when components that ticked earlier used up the update budget, so none of them freezes under sustained overload."),
+		ECVF_Default);
+
+	static TAutoConsoleVariable<float> CVarSkinnedInstancingMaxPendingUpdateTime(
+		TEXT("r.SkinnedInstancing.MaxPendingUpdateTime"),
+		0.25f,
+		TEXT("Maximum time in seconds an instance can accumulate while the update budget defers it. 0 disables the clamp."),
+		ECVF_Default);
+
+	static TAutoConsoleVariable<int32> CVarSkinnedInstancingAsyncDynamicData(
+		TEXT("r.SkinnedInstancing.AsyncDynamicData"),
+		1,
+		TEXT("Whether the instance data sent to the renderer is gathered and packed in a task started from a late tick, after gameplay wrote the instances, instead of when it is sent. Batched components always build it when sent."),
+		ECVF_Default);
+
+	/** Instances already in the vertex factory layout, built off the render thread. */
+	struct FPackedInstances
+	{
+		void Reset()
+		{
+			Transforms.Reset();
+			Animations.Reset();
+			PaletteGeneration = 0;
+		}
+
+		/** Resolved animation words of the instances against one palette tier. */
+		const uint32* GetTierAnimations(int32 Tier) const
+		{
+			return Animations.GetData() + (SIZE_T)Tier * Transforms.Num() * (SIInstancePacking::AnimationStride / sizeof(uint32));
+		}
+
+		SIZE_T GetAllocatedSize() const
+		{
+			return Transforms.GetAllocatedSize() + Animations.GetAllocatedSize();
+		}
+
+		TArray<FMatrix> Transforms;
+		/** Every palette tier after the other, at full draw budget fade. */
+		TArray<uint32> Animations;
+		/** FSIAnimationData::GetGeneration of the palette the animations were resolved against, instances are packed on the render thread for any other. */
+		uint32 PaletteGeneration = 0;
+	};
+
+	/** Packs every instance for all palette tiers, see SIInstancePacking::ResolveAnimations. */
+	void PackInstances(const TArray<FSIMeshInstanceData>& InstanceDatas, const FSIAnimationData* AnimationData, FPackedInstances& OutPacked)
+	{
+		const int32 NumInstances = InstanceDatas.Num();
+		OutPacked.Transforms.SetNumUninitialized(NumInstances, false);
+		SIInstancePacking::PackTransforms(InstanceDatas, OutPacked.Transforms.GetData());
+
+		OutPacked.PaletteGeneration = AnimationData ? AnimationData->GetGeneration() : 0;
+		if (!AnimationData)
+			return;
+
+		const int32 NumTiers = AnimationData->GetNumPaletteTiers();
+		const int32 TierWords = NumInstances * (SIInstancePacking::AnimationStride / sizeof(uint32));
+		OutPacked.Animations.SetNumUninitialized(NumTiers * TierWords, false);
+		for (int32 Tier = 0; Tier < NumTiers; Tier++)
+		{
+			SIInstancePacking::ResolveAnimations(*AnimationData, Tier, InstanceDatas, OutPacked.Animations.GetData() + Tier * TierWords);
+		}
+	}
+
 	struct FVertexFactoryBuffers
 	{
 		FStaticMeshVertexBuffers* StaticVertexBuffers = nullptr;
@@ -38,8 +171,19 @@ namespace
 
 	struct FVertexBufferAndSRV
 	{
+		void Create(uint32 Size, uint32 Stride, EPixelFormat Format)
+		{
+			FRHIResourceCreateInfo CreateInfo;
+			VertexBufferRHI = RHICreateVertexBuffer(Size, (BUF_Dynamic | BUF_ShaderResource), CreateInfo);
+			VertexBufferSRV = RHICreateShaderResourceView(VertexBufferRHI, Stride, Format);
+			NumBytes = Size;
+			INC_MEMORY_STAT_BY(STAT_SIMeshObjectGPUMemory, NumBytes);
+		}
+
 		void SafeRelease()
 		{
+			DEC_MEMORY_STAT_BY(STAT_SIMeshObjectGPUMemory, NumBytes);
+			NumBytes = 0;
 			VertexBufferRHI.SafeRelease();
 			VertexBufferSRV.SafeRelease();
 		}
@@ -51,6 +195,176 @@ namespace
 
 		FVertexBufferRHIRef VertexBufferRHI;
 		FShaderResourceViewRHIRef VertexBufferSRV;
+		uint32 NumBytes = 0;
+	};
+
+	struct FInstanceShaderData;
+
+	/**
+	 * Instances uploaded by one gather. Views and shadow passes bin the instances differently and are all drawn after
+	 * the last gather of the frame, so each gather writes its own buffers.
+	 */
+	struct FInstanceBuffers
+	{
+		const FInstanceShaderData* ShaderData = nullptr;
+		FVertexBufferAndSRV InstanceTransformBuffer;
+		FVertexBufferAndSRV InstanceAnimationBuffer;
+	};
+
+	/** Instance buffers of one mesh object, bound through FMeshBatchElement::UserData since the vertex factories are shared. */
+	struct FInstanceShaderData
+	{
+		void Release()
+		{
+			ensure(IsInRenderingThread());
+			for (TUniquePtr<FInstanceBuffers>& Buffers : GatherBuffers)
+			{
+				Buffers->InstanceTransformBuffer.SafeRelease();
+				Buffers->InstanceAnimationBuffer.SafeRelease();
+			}
+			GatherBuffers.Empty();
+			NumGathers = 0;
+			VideoMemoryBytes = 0;
+		}
+
+		/**
+		 * Uploads the drawn instances of every bin at once into buffers of their own for this gather, bins are drawn from
+		 * their FirstInstance offset. Copies rows of the packed instances, or the whole block when the binner drew every
+		 * instance in order.
+		 */
+		const FInstanceBuffers& UpdateInstanceData(const FSIInstanceBinner& Binner, const FPackedInstances& Packed, int MaxNumInstances, uint32 FrameNumber)
+		{
+			SCOPE_CYCLE_COUNTER(STAT_SIUploadInstances);
+			CSV_SCOPED_TIMING_STAT(SkinnedInstancing, UploadInstances);
+
+			FInstanceBuffers& Buffers = BeginGather(FrameNumber);
+			FVertexBufferAndSRV& InstanceTransformBuffer = Buffers.InstanceTransformBuffer;
+			FVertexBufferAndSRV& InstanceAnimationBuffer = Buffers.InstanceAnimationBuffer;
+
+			const uint32 NumInstances = Binner.BinnedInstanceDatas.Num();
+			uint32 BufferSize = NumInstances * SIInstancePacking::TransformStride;
+
+			// the packed animations are only valid for the palette they were resolved against
+			const bool bResolved = Packed.PaletteGeneration == BoneDataGeneration && Packed.Animations.Num() > 0;
+			const bool bIdentity = Binner.IsIdentity() && Packed.Transforms.Num() == NumInstances;
+
+			if (!InstanceTransformBuffer.IsValid() || InstanceTransformBuffer.NumBytes < BufferSize)
+			{
+				InstanceTransformBuffer.SafeRelease();
+				uint32 MaxBufferSize = GetGrownInstanceCount(MaxNumInstances) * SIInstancePacking::TransformStride;
+				InstanceTransformBuffer.Create(MaxBufferSize, sizeof(FVector4), PF_A32B32G32R32F);
+				UpdateVideoMemoryBytes();
+			}
+
+			if (InstanceTransformBuffer.IsValid())
+			{
+				FMatrix* LockedBuffer = (FMatrix*)RHILockVertexBuffer(InstanceTransformBuffer.VertexBufferRHI, 0, BufferSize, RLM_WriteOnly);
+				if (bIdentity)
+					FMemory::Memcpy(LockedBuffer, Packed.Transforms.GetData(), BufferSize);
+				else
+					SIInstancePacking::PackTransforms(Binner.BinnedInstanceDatas, LockedBuffer);
+				RHIUnlockVertexBuffer(InstanceTransformBuffer.VertexBufferRHI);
+				INC_DWORD_STAT_BY(STAT_SIBytesUploaded, BufferSize);
+				CSV_CUSTOM_STAT(SkinnedInstancing, BytesUploaded, (int32)BufferSize, ECsvCustomStatOp::Accumulate);
+			}
+
+			BufferSize = NumInstances * SIInstancePacking::AnimationStride;
+			if (!InstanceAnimationBuffer.IsValid() || InstanceAnimationBuffer.NumBytes < BufferSize)
+			{
+				InstanceAnimationBuffer.SafeRelease();
+				uint32 MaxBufferSize = GetGrownInstanceCount(MaxNumInstances) * SIInstancePacking::AnimationStride;
+				InstanceAnimationBuffer.Create(MaxBufferSize, sizeof(uint32), PF_R32_UINT);
+				UpdateVideoMemoryBytes();
+			}
+
+			if (InstanceAnimationBuffer.IsValid())
+			{
+				uint32* LockedBuffer = (uint32*)RHILockVertexBuffer(InstanceAnimationBuffer.VertexBufferRHI, 0, BufferSize, RLM_WriteOnly);
+				for (const FSIInstanceBinner::FBin& Bin : Binner.Bins)
+				{
+					// the palette tier follows the LOD of the bin
+					uint32* BinBuffer = LockedBuffer + Bin.FirstInstance * (SIInstancePacking::AnimationStride / sizeof(uint32));
+					if (!bResolved)
+					{
+						SIInstancePacking::PackAnimations(*BoneData, Bin.LODIndex, Binner.GetBinInstanceDatas(Bin), Binner.GetBinInstanceFades(Bin), BinBuffer);
+						continue;
+					}
+
+					const uint32* TierAnimations = Packed.GetTierAnimations(BoneData->GetPaletteTierForLOD(Bin.LODIndex));
+					if (bIdentity)
+						FMemory::Memcpy(BinBuffer, TierAnimations, Bin.NumInstances * SIInstancePacking::AnimationStride);
+					else
+						SIInstancePacking::GatherAnimations(TierAnimations, Binner.GetBinInstanceIndices(Bin), Binner.GetBinInstanceFades(Bin), BinBuffer);
+				}
+				RHIUnlockVertexBuffer(InstanceAnimationBuffer.VertexBufferRHI);
+				INC_DWORD_STAT_BY(STAT_SIBytesUploaded, BufferSize);
+				CSV_CUSTOM_STAT(SkinnedInstancing, BytesUploaded, (int32)BufferSize, ECsvCustomStatOp::Accumulate);
+			}
+
+			return Buffers;
+		}
+
+		/** Instance buffers grow with some slack so spawning a few more instances does not recreate them. */
+		static uint32 GetGrownInstanceCount(int32 NumInstances)
+		{
+			return FMath::Max<uint32>(FMath::RoundUpToPowerOfTwo(FMath::Max(NumInstances, 1)), 64);
+		}
+
+		const FSIAnimationData* BoneData = nullptr;
+		/** Generation of BoneData when it was set, a palette allocated at the same address has another one. */
+		uint32 BoneDataGeneration = 0;
+		/** Instance matrices are relative to the primitive and composed with its LocalToWorld in the shader. */
+		bool bInstancesInComponentSpace = false;
+		/** Bytes of all gather buffers, written on the render thread so the game thread can read them. */
+		TAtomic<uint32> VideoMemoryBytes { 0 };
+
+	private:
+		/** Buffers for the next gather of the frame, buffers the previous frame did not need are released. */
+		FInstanceBuffers& BeginGather(uint32 FrameNumber)
+		{
+			if (FrameNumber != GatherFrameNumber)
+			{
+				// the first buffers stay, frames the component is not drawn in do not recreate them
+				const int32 NumKept = FMath::Max(NumGathers, 1);
+				if (GatherBuffers.Num() > NumKept)
+				{
+					for (int32 Index = NumKept; Index < GatherBuffers.Num(); Index++)
+					{
+						GatherBuffers[Index]->InstanceTransformBuffer.SafeRelease();
+						GatherBuffers[Index]->InstanceAnimationBuffer.SafeRelease();
+					}
+					GatherBuffers.SetNum(NumKept);
+					UpdateVideoMemoryBytes();
+				}
+
+				GatherFrameNumber = FrameNumber;
+				NumGathers = 0;
+			}
+
+			if (NumGathers == GatherBuffers.Num())
+			{
+				GatherBuffers.Add(MakeUnique<FInstanceBuffers>());
+			}
+
+			FInstanceBuffers& Buffers = *GatherBuffers[NumGathers++];
+			Buffers.ShaderData = this;
+			return Buffers;
+		}
+
+		void UpdateVideoMemoryBytes()
+		{
+			uint32 Bytes = 0;
+			for (const TUniquePtr<FInstanceBuffers>& Buffers : GatherBuffers)
+			{
+				Bytes += Buffers->InstanceTransformBuffer.NumBytes + Buffers->InstanceAnimationBuffer.NumBytes;
+			}
+			VideoMemoryBytes = Bytes;
+		}
+
+		/** Separate allocations, batches keep pointers to them until the frame was drawn. */
+		TArray<TUniquePtr<FInstanceBuffers>> GatherBuffers;
+		int32 NumGathers = 0;
+		uint32 GatherFrameNumber = 0;
 	};
 
 	class FGPUSkinVertexFactory : public FVertexFactory
@@ -81,6 +395,7 @@ namespace
 			FVertexStreamComponent BoneWeights;
 		};
 
+		/** Bone remap table and reference pose of one section, shared by every mesh object drawing the mesh. */
 		struct FShaderDataType
 		{
 			void Release()
@@ -88,8 +403,6 @@ namespace
 				ensure(IsInRenderingThread());
 				BoneMap.SafeRelease();
 				RefBasesInvMatrix.SafeRelease();
-				InstanceTransformBuffer.SafeRelease();
-				InstanceAnimationBuffer.SafeRelease();
 			}
 
 			const FVertexBufferAndSRV& GetBoneMapForReading() const
@@ -102,30 +415,13 @@ namespace
 				return RefBasesInvMatrix;
 			}
 
-			const FShaderResourceViewRHIRef& GetBoneBufferForReading() const
-			{
-				return BoneData->GetSRVForReading();
-			}
-
-			const FVertexBufferAndSRV& GetInstanceTransformBufferForReading() const
-			{
-				return InstanceTransformBuffer;
-			}
-
-			const FVertexBufferAndSRV& GetInstanceAnimationBufferForReading() const
-			{
-				return InstanceAnimationBuffer;
-			}
-
 			bool UpdateBoneMap(const TArray<FBoneIndexType>& _BoneMap)
 			{
 				uint32 BufferSize = _BoneMap.Num() * sizeof(uint32);
 
 				if (!BoneMap.IsValid())
 				{
-					FRHIResourceCreateInfo CreateInfo;
-					BoneMap.VertexBufferRHI = RHICreateVertexBuffer(BufferSize, (BUF_Dynamic | BUF_ShaderResource), CreateInfo);
-					BoneMap.VertexBufferSRV = RHICreateShaderResourceView(BoneMap.VertexBufferRHI, sizeof(uint32), PF_R32_UINT);
+					BoneMap.Create(BufferSize, sizeof(uint32), PF_R32_UINT);
 				}
 
 				if (BoneMap.IsValid() && _BoneMap.Num() > 0)
@@ -139,6 +435,7 @@ namespace
 					}
 
 					RHIUnlockVertexBuffer(BoneMap.VertexBufferRHI);
+					INC_DWORD_STAT_BY(STAT_SIBytesUploaded, BufferSize);
 				}
 
 				return true;
@@ -150,9 +447,7 @@ namespace
 
 				if (!RefBasesInvMatrix.IsValid())
 				{
-					FRHIResourceCreateInfo CreateInfo;
-					RefBasesInvMatrix.VertexBufferRHI = RHICreateVertexBuffer(BufferSize, (BUF_Dynamic | BUF_ShaderResource), CreateInfo);
-					RefBasesInvMatrix.VertexBufferSRV = RHICreateShaderResourceView(RefBasesInvMatrix.VertexBufferRHI, sizeof(FVector4), PF_A32B32G32R32F);
+					RefBasesInvMatrix.Create(BufferSize, sizeof(FVector4), PF_A32B32G32R32F);
 				}
 
 				if (RefBasesInvMatrix.IsValid() && BoneMatrices.Num() > 0)
@@ -171,90 +466,19 @@ namespace
 					}
 
 					RHIUnlockVertexBuffer(RefBasesInvMatrix.VertexBufferRHI);
+					INC_DWORD_STAT_BY(STAT_SIBytesUploaded, BufferSize);
 				}
 
 				return true;
 			}
 
-			void UpdateBoneData(const FSIAnimationData* BoneData)
-			{
-				this->BoneData = BoneData;
-			}
-
-			bool UpdateInstanceData(const TArray<FSIMeshInstanceData>& InstanceData, int MaxNumInstances)
+			SIZE_T GetResourceSize() const
 			{
-				const uint32 NumInstances = InstanceData.Num();
-				uint32 BufferSize = NumInstances * 4 * sizeof(FVector4);
-
-				if (!InstanceTransformBuffer.IsValid())
-				{
-					uint32 MaxBufferSize = MaxNumInstances * 4 * sizeof(FVector4);
-					FRHIResourceCreateInfo CreateInfo;
-					InstanceTransformBuffer.VertexBufferRHI = RHICreateVertexBuffer(MaxBufferSize, (BUF_Dynamic | BUF_ShaderResource), CreateInfo);
-					InstanceTransformBuffer.VertexBufferSRV = RHICreateShaderResourceView(InstanceTransformBuffer.VertexBufferRHI, sizeof(FVector4), PF_A32B32G32R32F);
-				}
-
-				if (InstanceTransformBuffer.IsValid())
-				{
-					FMatrix* LockedBuffer = (FMatrix*)RHILockVertexBuffer(InstanceTransformBuffer.VertexBufferRHI, 0, BufferSize, RLM_WriteOnly);
-
-					const int32 PreFetchStride = 2; // FPlatformMisc::Prefetch stride
-
-					for (uint32 i = 0; i < NumInstances; i++)
-					{
-						LockedBuffer[i] = InstanceData[i].Transform;
-					}
-
-					RHIUnlockVertexBuffer(InstanceTransformBuffer.VertexBufferRHI);
-				}
-
-				const uint32 InstanceDataStride = 8;
-				BufferSize = NumInstances * sizeof(uint32) * InstanceDataStride;
-				if (!InstanceAnimationBuffer.IsValid())
-				{
-					uint32 MaxBufferSize = MaxNumInstances * sizeof(uint32) * InstanceDataStride;
-					FRHIResourceCreateInfo CreateInfo;
-					InstanceAnimationBuffer.VertexBufferRHI = RHICreateVertexBuffer(MaxBufferSize, (BUF_Dynamic | BUF_ShaderResource), CreateInfo);
-					InstanceAnimationBuffer.VertexBufferSRV = RHICreateShaderResourceView(InstanceAnimationBuffer.VertexBufferRHI, sizeof(uint32), PF_R32_UINT);
-				}
-
-				if (InstanceAnimationBuffer.IsValid())
-				{
-					uint32* LockedBuffer = (uint32*)RHILockVertexBuffer(InstanceAnimationBuffer.VertexBufferRHI, 0, BufferSize, RLM_WriteOnly);
-
-					const int32 PreFetchStride = 2; // FPlatformMisc::Prefetch stride
-
-					uint32 NumBones = BoneData->GetNumBones();
-					const TArray<uint32>& SequenceLength = BoneData->GetSequenceLength();
-					const TArray<uint32>& SequenceOffset = BoneData->GetSequenceOffset();
-
-					for (uint32 i = 0; i < NumInstances; i++)
-					{
-						uint32 Offset = i * InstanceDataStride;
-
-						for (uint32 j = 0; j < 2; j++)
-						{
-							const auto& AnimData = InstanceData[i].AnimDatas[j];
-							check(AnimData.Sequence >= 0 && AnimData.Sequence < SequenceLength.Num());
-							const uint32 BufferOffest = SequenceOffset[AnimData.Sequence];
-							LockedBuffer[Offset++] = BufferOffest + AnimData.PrevFrame * NumBones;
-							LockedBuffer[Offset++] = BufferOffest + AnimData.NextFrame * NumBones;
-							LockedBuffer[Offset++] = (uint32)(AnimData.FrameLerp * 1000);
-							LockedBuffer[Offset++] = (uint32)(AnimData.BlendWeight * 1000);
-						}
-					}
-
-					RHIUnlockVertexBuffer(InstanceAnimationBuffer.VertexBufferRHI);
-				}
-
-				return true;
+				return BoneMap.NumBytes + RefBasesInvMatrix.NumBytes;
 			}
 		private:
-			const FSIAnimationData* BoneData = nullptr;
 			FVertexBufferAndSRV BoneMap;
 			FVertexBufferAndSRV RefBasesInvMatrix;
-			FVertexBufferAndSRV InstanceTransformBuffer;
-			FVertexBufferAndSRV InstanceAnimationBuffer;
 		};
 
 		const FShaderDataType& GetShaderData() const
@@ -381,6 +605,8 @@ namespace
 			BoneMatrices.Bind(ParameterMap, TEXT("BoneMatrices"));
 			InstanceMatrices.Bind(ParameterMap, TEXT("InstanceMatrices"));
 			InstanceAnimations.Bind(ParameterMap, TEXT("InstanceAnimations"));
+			InstancesInComponentSpace.Bind(ParameterMap, TEXT("InstancesInComponentSpace"));
+			InstanceOffset.Bind(ParameterMap, TEXT("InstanceOffset"));
 		}
 
 		virtual void Serialize(FArchive& Ar) override
@@ -390,6 +616,8 @@ namespace
 			Ar << BoneMatrices;
 			Ar << InstanceMatrices;
 			Ar << InstanceAnimations;
+			Ar << InstancesInComponentSpace;
+			Ar << InstanceOffset;
 		}
 
 		virtual void GetElementShaderBindings(
@@ -417,23 +645,39 @@ namespace
 				ShaderBindings.Add(RefBasesInvMatrix, CurrentData);
 			}
 
+			const FInstanceBuffers* InstanceBuffers = (const FInstanceBuffers*)BatchElement.UserData;
+			if (!InstanceBuffers)
+				return;
+
+			const FInstanceShaderData* InstanceShaderData = InstanceBuffers->ShaderData;
+
 			if (BoneMatrices.IsBound())
 			{
-				FShaderResourceViewRHIParamRef CurrentData = ShaderData.GetBoneBufferForReading();
+				FShaderResourceViewRHIParamRef CurrentData = InstanceShaderData->BoneData->GetSRVForReading();
 				ShaderBindings.Add(BoneMatrices, CurrentData);
 			}
 
 			if (InstanceMatrices.IsBound())
 			{
-				FShaderResourceViewRHIParamRef CurrentData = ShaderData.GetInstanceTransformBufferForReading().VertexBufferSRV;
+				FShaderResourceViewRHIParamRef CurrentData = InstanceBuffers->InstanceTransformBuffer.VertexBufferSRV;
 				ShaderBindings.Add(InstanceMatrices, CurrentData);
 			}
 
 			if (InstanceAnimations.IsBound())
 			{
-				FShaderResourceViewRHIParamRef CurrentData = ShaderData.GetInstanceAnimationBufferForReading().VertexBufferSRV;
+				FShaderResourceViewRHIParamRef CurrentData = InstanceBuffers->InstanceAnimationBuffer.VertexBufferSRV;
 				ShaderBindings.Add(InstanceAnimations, CurrentData);
 			}
+
+			if (InstancesInComponentSpace.IsBound())
+			{
+				ShaderBindings.Add(InstancesInComponentSpace, InstanceShaderData->bInstancesInComponentSpace ? 1u : 0u);
+			}
+
+			if (InstanceOffset.IsBound())
+			{
+				ShaderBindings.Add(InstanceOffset, (uint32)BatchElement.UserIndex);
+			}
 		}
 
 		virtual uint32 GetSize() const override { return sizeof(*this); }
@@ -444,6 +688,8 @@ namespace
 		FShaderResourceParameter BoneMatrices;
 		FShaderResourceParameter InstanceMatrices;
 		FShaderResourceParameter InstanceAnimations;
+		FShaderParameter InstancesInComponentSpace;
+		FShaderParameter InstanceOffset;
 	};
 
 	FVertexFactoryShaderParameters* FGPUSkinVertexFactory::ConstructShaderParameters(EShaderFrequency ShaderFrequency)
@@ -468,6 +714,9 @@ namespace
 
 		bool bDisableFrameLerp = (CVarSkinnedInstancingDisableFrameLerp.GetValueOnAnyThread() != 0);
 		OutEnvironment.SetDefine(TEXT("SKINNED_INSTANCING_DISABLE_FRAME_LERP"), (bDisableFrameLerp ? 1 : 0));
+
+		bool bDrawBudgetFade = (CVarSkinnedInstancingDrawBudgetFade.GetValueOnAnyThread() != 0);
+		OutEnvironment.SetDefine(TEXT("SKINNED_INSTANCING_DRAW_BUDGET_FADE"), (bDrawBudgetFade ? 1 : 0));
 	}
 	
 	FVertexFactoryType FGPUSkinVertexFactory::StaticType(
@@ -493,48 +742,59 @@ namespace
 	}
 }
 
-class FSIMeshObject : public FDeferredCleanupInterface
+/**
+ * Vertex factories with the bone remap tables and reference pose buffers of their sections. These only depend on the
+ * skeletal mesh and its skeleton, so every mesh object drawing the same pair shares one refcounted set.
+ */
+class FSISharedMeshResources : public FDeferredCleanupInterface
 {
 public:
-	class FDynamicData
+	/** Returns the resources of the mesh, created on first use. Safe to call from concurrent render state creation. */
+	static FSISharedMeshResources* Acquire(USkeletalMesh* SkeletalMesh, ERHIFeatureLevel::Type FeatureLevel);
+	/** Drops a reference, the last one begins releasing the resources. */
+	void Release();
+	SIZE_T GetResourceSize() const;
+	FGPUSkinVertexFactory* GetSkinVertexFactory(int32 LODIndex, int32 ChunkIdx) const;
+private:
+	FSISharedMeshResources(USkeletalMesh* SkeletalMesh, ERHIFeatureLevel::Type FeatureLevel);
+private:
+	struct FKey
 	{
-	public:
-		static FDynamicData* Alloc();
-		static void Free(FDynamicData* Who);
-		void Clear()
+		USkeletalMesh* SkeletalMesh;
+		USkeleton* Skeleton;
+		FSkeletalMeshRenderData* SkeletalMeshRenderData;
+		ERHIFeatureLevel::Type FeatureLevel;
+
+		bool operator==(const FKey& Other) const
 		{
-			InstanceDatas.Reset();
+			return SkeletalMesh == Other.SkeletalMesh && Skeleton == Other.Skeleton
+				&& SkeletalMeshRenderData == Other.SkeletalMeshRenderData && FeatureLevel == Other.FeatureLevel;
+		}
+
+		friend uint32 GetTypeHash(const FKey& Key)
+		{
+			uint32 Hash = HashCombine(PointerHash(Key.SkeletalMesh), PointerHash(Key.Skeleton));
+			Hash = HashCombine(Hash, PointerHash(Key.SkeletalMeshRenderData));
+			return HashCombine(Hash, ::GetTypeHash((int32)Key.FeatureLevel));
 		}
-	public:
-		TArray<FSIMeshInstanceData> InstanceDatas;
 	};
-public:
-	FSIMeshObject(USkeletalMesh* SkeletalMesh, ERHIFeatureLevel::Type FeatureLevel);
-	virtual ~FSIMeshObject();
-public:
-	virtual void ReleaseResources();
-	FGPUSkinVertexFactory* GetSkinVertexFactory(int32 LODIndex, int32 ChunkIdx) const;
-	void UpdateBoneData(const FSIAnimationData* AnimationData);
-	const FDynamicData* GetDynamicData() const { return DynamicData; }
-	void UpdateDynamicData(FDynamicData* NewDynamicData);
-private:
-	void UpdateDynamicData_RenderThread(FDynamicData* NewDynamicData);
-	void UpdateBoneData_RenderThread(const FSIAnimationData* AnimationData);
-private:
+
 	struct FSkeletalMeshObjectLOD;
 private:
-	ERHIFeatureLevel::Type FeatureLevel;
-	class USkeletalMesh* SkeletalMesh;
-	FSkeletalMeshRenderData* SkeletalMeshRenderData;
+	FKey Key;
+	int32 NumRefs;
 	TArray<FSkeletalMeshObjectLOD> LODs;
-	FDynamicData* DynamicData;
-public:
-	TArray<TArray<FSIMeshInstanceData>> TempLODInstanceDatas;
+
+	static FCriticalSection CacheCritical;
+	static TMap<FKey, FSISharedMeshResources*> Cache;
 };
 
-struct FSIMeshObject::FSkeletalMeshObjectLOD
+FCriticalSection FSISharedMeshResources::CacheCritical;
+TMap<FSISharedMeshResources::FKey, FSISharedMeshResources*> FSISharedMeshResources::Cache;
+
+struct FSISharedMeshResources::FSkeletalMeshObjectLOD
 {
-	void InitResources(FSkeletalMeshLODRenderData& LODData, ERHIFeatureLevel::Type InFeatureLevel)
+	void InitResources(USkeletalMesh* SkeletalMesh, FSkeletalMeshLODRenderData& LODData, ERHIFeatureLevel::Type InFeatureLevel)
 	{
 		// Vertex buffers available for the LOD
 		FVertexFactoryBuffers VertexBuffers;
@@ -550,11 +810,27 @@ struct FSIMeshObject::FSkeletalMeshObjectLOD
 
 		VertexFactories.Empty(LODData.RenderSections.Num());
 
+		const FReferenceSkeleton& SkeletonRefSkeleton = SkeletalMesh->Skeleton->GetReferenceSkeleton();
+
 		for (int32 FactoryIdx = 0; FactoryIdx < LODData.RenderSections.Num(); ++FactoryIdx)
 		{
 			FGPUSkinVertexFactory* VertexFactory = new FGPUSkinVertexFactory(InFeatureLevel, VertexBuffers.NumVertices);
 			VertexFactories.Add(TUniquePtr<FGPUSkinVertexFactory>(VertexFactory));
 
+			// resolve the section bones against the skeleton once for every component drawing the mesh
+			const FSkelMeshRenderSection& Section = LODData.RenderSections[FactoryIdx];
+			TArray<FBoneIndexType> BoneMap;
+			TArray<FMatrix> RefBasesInvMatrix;
+			BoneMap.Reserve(Section.BoneMap.Num());
+			RefBasesInvMatrix.Reserve(Section.BoneMap.Num());
+
+			for (int BoneIndex = 0; BoneIndex < Section.BoneMap.Num(); BoneIndex++)
+			{
+				FName BoneName = SkeletalMesh->RefSkeleton.GetBoneName(Section.BoneMap[BoneIndex]);
+				BoneMap.Add(SkeletonRefSkeleton.FindBoneIndex(BoneName));
+				RefBasesInvMatrix.Add(SkeletalMesh->RefBasesInvMatrix[Section.BoneMap[BoneIndex]]);
+			}
+
 			// update vertex factory components and sync it
 			ENQUEUE_RENDER_COMMAND(InitGPUSkinVertexFactory)(
 				[VertexFactory, VertexBuffers](FRHICommandList& CmdList)
@@ -565,6 +841,15 @@ struct FSIMeshObject::FSkeletalMeshObjectLOD
 
 			// init rendering resource	
 			BeginInitResource(VertexFactory);
+
+			ENQUEUE_RENDER_COMMAND(SIUploadBoneMaps)(
+				[VertexFactory, BoneMap = MoveTemp(BoneMap), RefBasesInvMatrix = MoveTemp(RefBasesInvMatrix)](FRHICommandListImmediate& RHICmdList)
+			{
+				SCOPE_CYCLE_COUNTER(STAT_SIUploadBoneMaps);
+				VertexFactory->GetShaderData().UpdateBoneMap(BoneMap);
+				VertexFactory->GetShaderData().UpdateRefBasesInvMatrix(RefBasesInvMatrix);
+			}
+			);
 		}
 	}
 
@@ -577,10 +862,15 @@ struct FSIMeshObject::FSkeletalMeshObjectLOD
 		}
 	}
 
-	SIZE_T GetResourceSize()
+	SIZE_T GetResourceSize() const
 	{
 		SIZE_T Size = 0;
 		Size += VertexFactories.GetAllocatedSize();
+		for (const TUniquePtr<FGPUSkinVertexFactory>& VertexFactory : VertexFactories)
+		{
+			Size += sizeof(FGPUSkinVertexFactory);
+			Size += VertexFactory->GetShaderData().GetResourceSize();
+		}
 		return Size;
 	}
 
@@ -588,56 +878,12 @@ struct FSIMeshObject::FSkeletalMeshObjectLOD
 	TArray<TUniquePtr<FGPUSkinVertexFactory>> VertexFactories;
 };
 
-namespace
-{
-	TArray<FSIMeshObject::FDynamicData*> FreeDynamicDatas;
-	FCriticalSection FreeDynamicDatasCriticalSection;
-	int32 GMinPoolCount = 0;
-	int32 GAllocationCounter = 0;
-	const int32 GAllocationsBeforeCleanup = 1000; // number of allocations we make before we clean up the pool, this number is increased when we have to allocate not from the pool
-}
-
-FSIMeshObject::FDynamicData * FSIMeshObject::FDynamicData::Alloc()
-{
-	FScopeLock S(&FreeDynamicDatasCriticalSection);
-	++GAllocationCounter;
-	GMinPoolCount = FMath::Min(FreeDynamicDatas.Num(), GMinPoolCount);
-	if (FreeDynamicDatas.Num() > 0)
-	{
-		FDynamicData *Result = FreeDynamicDatas[0];
-		FreeDynamicDatas.RemoveAtSwap(0);
-		return Result;
-	}
-	else
-	{
-		return new FDynamicData;
-	}
-}
-
-void FSIMeshObject::FDynamicData::Free(FDynamicData * Who)
+FSISharedMeshResources::FSISharedMeshResources(USkeletalMesh* SkeletalMesh, ERHIFeatureLevel::Type FeatureLevel)
+	: Key{ SkeletalMesh, SkeletalMesh->Skeleton, SkeletalMesh->GetResourceForRendering(), FeatureLevel }
+	, NumRefs(0)
 {
-	Who->Clear();
-	FScopeLock S(&FreeDynamicDatasCriticalSection);
-	FreeDynamicDatas.Add(Who);
-	if (GAllocationCounter > GAllocationsBeforeCleanup)
-	{
-		GAllocationCounter = 0;
-		for (int32 I = 0; I < GMinPoolCount; ++I)
-		{
-			delete FreeDynamicDatas[0];
-			FreeDynamicDatas.RemoveAtSwap(0);
-		}
-		GMinPoolCount = FreeDynamicDatas.Num();
-	}
-}
+	FSkeletalMeshRenderData* SkeletalMeshRenderData = Key.SkeletalMeshRenderData;
 
-FSIMeshObject::FSIMeshObject(USkeletalMesh* SkeletalMesh,
-	ERHIFeatureLevel::Type FeatureLevel)
-	: FeatureLevel(FeatureLevel)
-	, SkeletalMesh(SkeletalMesh)
-	, SkeletalMeshRenderData(SkeletalMesh->GetResourceForRendering())
-	, DynamicData(nullptr)
-{
 	// create LODs to match the base mesh
 	LODs.Empty(SkeletalMeshRenderData->LODRenderData.Num());
 
@@ -649,104 +895,255 @@ FSIMeshObject::FSIMeshObject(USkeletalMesh* SkeletalMesh,
 		if (SkeletalMeshRenderData->LODRenderData.IsValidIndex(LODIndex)
 			&& SkeletalMeshRenderData->LODRenderData[LODIndex].GetNumVertices() > 0)
 		{
-			LODs[LODIndex].InitResources(SkeletalMeshRenderData->LODRenderData[LODIndex],  FeatureLevel);
+			LODs[LODIndex].InitResources(SkeletalMesh, SkeletalMeshRenderData->LODRenderData[LODIndex], FeatureLevel);
 		}
 	}
-}
-
-FSIMeshObject::~FSIMeshObject()
-{
-}
 
-void FSIMeshObject::ReleaseResources()
-{
-	for (int32 LODIndex = 0; LODIndex < LODs.Num(); LODIndex++)
-	{
-		LODs[LODIndex].ReleaseResources();
-	}
+	INC_DWORD_STAT(STAT_SISharedMeshResources);
 }
 
-FGPUSkinVertexFactory* FSIMeshObject::GetSkinVertexFactory(int32 LODIndex, int32 ChunkIdx) const
+FSISharedMeshResources* FSISharedMeshResources::Acquire(USkeletalMesh* SkeletalMesh, ERHIFeatureLevel::Type FeatureLevel)
 {
-	checkSlow(LODs.IsValidIndex(LODIndex));
-
-	const FSkeletalMeshObjectLOD& LOD = LODs[LODIndex];
-
-	// use the default gpu skin vertex factory
-	return LOD.VertexFactories[ChunkIdx].Get();
-}
+	FScopeLock Lock(&CacheCritical);
 
-void FSIMeshObject::UpdateBoneData(const FSIAnimationData* AnimationData)
-{
-	// queue a call to update this data
-	ENQUEUE_RENDER_COMMAND(SIMeshObjectUpdateDataCommand)(
-		[this, AnimationData](FRHICommandListImmediate& RHICmdList)
+	const FKey Key{ SkeletalMesh, SkeletalMesh->Skeleton, SkeletalMesh->GetResourceForRendering(), FeatureLevel };
+	FSISharedMeshResources*& Resources = Cache.FindOrAdd(Key);
+	if (!Resources)
 	{
-		UpdateBoneData_RenderThread(AnimationData);
+		Resources = new FSISharedMeshResources(SkeletalMesh, FeatureLevel);
 	}
-	);
+
+	Resources->NumRefs++;
+	return Resources;
 }
 
-void FSIMeshObject::UpdateBoneData_RenderThread(const FSIAnimationData* AnimationData)
+void FSISharedMeshResources::Release()
 {
-	for (int32 LODIndex = 0; LODIndex < SkeletalMeshRenderData->LODRenderData.Num(); LODIndex++)
 	{
-		const FSkeletalMeshLODRenderData& LODData = SkeletalMeshRenderData->LODRenderData[LODIndex];
-
-		for (int32 SectionIndex = 0; SectionIndex < LODData.RenderSections.Num(); SectionIndex++)
-		{
-			const FSkelMeshRenderSection& Section = LODData.RenderSections[SectionIndex];
-			FGPUSkinVertexFactory* VertexFactory = GetSkinVertexFactory(LODIndex, SectionIndex);
+		FScopeLock Lock(&CacheCritical);
 
-			VertexFactory->GetShaderData().UpdateBoneData(AnimationData);
+		check(NumRefs > 0);
+		if (--NumRefs > 0)
+			return;
 
-			TArray<FBoneIndexType> BoneMap;
-
-			for (int BoneIndex = 0; BoneIndex < Section.BoneMap.Num(); BoneIndex++)
-			{
-				FName BoneName = SkeletalMesh->RefSkeleton.GetBoneName(Section.BoneMap[BoneIndex]);
-				int NewBoneIndex = SkeletalMesh->Skeleton->GetReferenceSkeleton().FindBoneIndex(BoneName);
-				BoneMap.Add(NewBoneIndex);
-			}
-
-			VertexFactory->GetShaderData().UpdateBoneMap(BoneMap);
+		Cache.Remove(Key);
+	}
 
-			TArray<FMatrix> RefBasesInvMatrix;
-			for (int BoneIndex = 0; BoneIndex < Section.BoneMap.Num(); BoneIndex++)
-				RefBasesInvMatrix.Add(SkeletalMesh->RefBasesInvMatrix[Section.BoneMap[BoneIndex]]);
+	DEC_DWORD_STAT(STAT_SISharedMeshResources);
 
-			VertexFactory->GetShaderData().UpdateRefBasesInvMatrix(RefBasesInvMatrix);
-		}
+	for (int32 LODIndex = 0; LODIndex < LODs.Num(); LODIndex++)
+	{
+		LODs[LODIndex].ReleaseResources();
 	}
+
+	// deleted once the release commands above have executed on the rendering thread
+	BeginCleanup(this);
 }
 
-void FSIMeshObject::UpdateDynamicData(FDynamicData * NewDynamicData)
+SIZE_T FSISharedMeshResources::GetResourceSize() const
 {
-	// queue a call to update this data
-	ENQUEUE_RENDER_COMMAND(SIMeshObjectUpdateDataCommand)(
-		[this, NewDynamicData](FRHICommandListImmediate& RHICmdList)
+	SIZE_T Size = sizeof(*this);
+	for (int32 LODIndex = 0; LODIndex < LODs.Num(); LODIndex++)
 	{
-		UpdateDynamicData_RenderThread(NewDynamicData);
+		Size += LODs[LODIndex].GetResourceSize();
 	}
-	);
+	return Size;
 }
 
-void FSIMeshObject::UpdateDynamicData_RenderThread(FDynamicData * NewDynamicData)
+FGPUSkinVertexFactory* FSISharedMeshResources::GetSkinVertexFactory(int32 LODIndex, int32 ChunkIdx) const
 {
-	if (DynamicData)
-		FDynamicData::Free(DynamicData);
-	DynamicData = NewDynamicData;
+	checkSlow(LODs.IsValidIndex(LODIndex));
+
+	const FSkeletalMeshObjectLOD& LOD = LODs[LODIndex];
+
+	// stripped LODs have no factories
+	return LOD.VertexFactories.IsValidIndex(ChunkIdx) ? LOD.VertexFactories[ChunkIdx].Get() : nullptr;
 }
 
-class FSIMeshSceneProxy final : public FPrimitiveSceneProxy
+class FSIMeshObject : public FDeferredCleanupInterface
 {
 public:
-	FSIMeshSceneProxy(USIMeshComponent* Component, 
-		USkeletalMesh* SkeletalMesh, FSIMeshObject* MeshObject);
-	virtual ~FSIMeshSceneProxy();
-
-	
-public: // override
+	class FDynamicData
+	{
+	public:
+		void Clear()
+		{
+			InstanceDatas.Reset();
+			Packed.Reset();
+		}
+	public:
+		TArray<FSIMeshInstanceData> InstanceDatas;
+		FPackedInstances Packed;
+	};
+public:
+	FSIMeshObject(const TArray<USkeletalMesh*>& Meshes, ERHIFeatureLevel::Type FeatureLevel, bool bInstancesInComponentSpace);
+	virtual ~FSIMeshObject();
+public:
+	virtual void ReleaseResources();
+	/** RHI buffer bytes owned by this mesh object, the shared vertex factories and bone maps are not included. Any thread. */
+	uint32 GetVideoMemorySize() const { return InstanceShaderData.VideoMemoryBytes; }
+	/** CPU bytes of the dynamic data slots as of their last publish. Any thread. */
+	SIZE_T GetSystemMemorySize() const;
+	FGPUSkinVertexFactory* GetSkinVertexFactory(int32 MeshIndex, int32 LODIndex, int32 ChunkIdx) const;
+	FInstanceShaderData& GetInstanceShaderData() { return InstanceShaderData; }
+	void UpdateBoneData(const FSIAnimationData* AnimationData, const TArray<USkeletalMesh*>& Meshes);
+	const FDynamicData* GetDynamicData() const { return &DynamicDatas[ReadIndex]; }
+	/** Producer side (game thread or a concurrent send), returns the cleared back buffer. Capacity is kept from the last time the slot was used. */
+	FDynamicData& BeginUpdateDynamicData();
+	/** Producer side, publishes the back buffer filled since BeginUpdateDynamicData. */
+	void EndUpdateDynamicData();
+private:
+	void ConsumeDynamicData_RenderThread();
+private:
+	// Per mesh index, only the instance buffers are owned by the mesh object
+	TArray<FSISharedMeshResources*> SharedResources;
+	FInstanceShaderData InstanceShaderData;
+
+	// Triple buffer, the producer owns WriteIndex, the render thread owns ReadIndex and
+	// PendingIndex is swapped between them. The dirty flag marks a published, unread slot.
+	enum { DynamicDataIndexMask = 0x3, DynamicDataDirtyFlag = 0x4 };
+	FDynamicData DynamicDatas[3];
+	/** Allocated size of each slot, set by the producer when it publishes the slot. */
+	TAtomic<uint64> DynamicDataBytes[3];
+	int32 WriteIndex;
+	int32 ReadIndex;
+	volatile int32 PendingIndex;
+public:
+	FSIInstanceBinner Binner;
+	/** Render thread copy, follows the animation data the instances are drawn with. */
+	FSIInstanceBounds InstanceBounds;
+};
+
+namespace
+{
+	const int32 GNumUpdateRateBands = 4;
+
+	struct FInstanceUpdateBudget
+	{
+		uint64 FrameNumber = 0;
+		double UsedSeconds = 0;
+		uint32 MaxLatency = 0;
+		uint32 LatencySum = 0;
+		uint32 NumUpdated = 0;
+	};
+	FInstanceUpdateBudget GInstanceUpdateBudget;
+}
+
+FSIMeshObject::FSIMeshObject(const TArray<USkeletalMesh*>& Meshes,
+	ERHIFeatureLevel::Type FeatureLevel, bool bInstancesInComponentSpace)
+	: WriteIndex(0)
+	, ReadIndex(1)
+	, PendingIndex(2)
+{
+	// variants repeating a mesh share its resources through the cache
+	for (USkeletalMesh* Mesh : Meshes)
+	{
+		SharedResources.Add(FSISharedMeshResources::Acquire(Mesh, FeatureLevel));
+	}
+
+	InstanceShaderData.bInstancesInComponentSpace = bInstancesInComponentSpace;
+
+	for (TAtomic<uint64>& Bytes : DynamicDataBytes)
+	{
+		Bytes = 0;
+	}
+}
+
+FSIMeshObject::~FSIMeshObject()
+{
+}
+
+void FSIMeshObject::ReleaseResources()
+{
+	ENQUEUE_RENDER_COMMAND(SIMeshObjectReleaseCommand)(
+		[this](FRHICommandListImmediate& RHICmdList)
+	{
+		InstanceShaderData.Release();
+	}
+	);
+
+	for (FSISharedMeshResources* Resources : SharedResources)
+	{
+		Resources->Release();
+	}
+	SharedResources.Empty();
+}
+
+SIZE_T FSIMeshObject::GetSystemMemorySize() const
+{
+	SIZE_T Size = sizeof(*this);
+	for (const TAtomic<uint64>& Bytes : DynamicDataBytes)
+	{
+		Size += Bytes;
+	}
+	return Size;
+}
+
+FGPUSkinVertexFactory* FSIMeshObject::GetSkinVertexFactory(int32 MeshIndex, int32 LODIndex, int32 ChunkIdx) const
+{
+	return SharedResources[MeshIndex]->GetSkinVertexFactory(LODIndex, ChunkIdx);
+}
+
+void FSIMeshObject::UpdateBoneData(const FSIAnimationData* AnimationData, const TArray<USkeletalMesh*>& Meshes)
+{
+	FSIInstanceBounds NewInstanceBounds;
+	NewInstanceBounds.Init(Meshes, AnimationData);
+
+	// queue a call to update this data
+	const uint32 Generation = AnimationData ? AnimationData->GetGeneration() : 0;
+	ENQUEUE_RENDER_COMMAND(SIMeshObjectUpdateDataCommand)(
+		[this, AnimationData, Generation, NewInstanceBounds](FRHICommandListImmediate& RHICmdList)
+	{
+		InstanceShaderData.BoneData = AnimationData;
+		InstanceShaderData.BoneDataGeneration = Generation;
+		InstanceBounds = NewInstanceBounds;
+	}
+	);
+}
+
+FSIMeshObject::FDynamicData& FSIMeshObject::BeginUpdateDynamicData()
+{
+	FDynamicData& Result = DynamicDatas[WriteIndex];
+	Result.Clear();
+	return Result;
+}
+
+void FSIMeshObject::EndUpdateDynamicData()
+{
+	const FDynamicData& Written = DynamicDatas[WriteIndex];
+	DynamicDataBytes[WriteIndex] = Written.InstanceDatas.GetAllocatedSize() + Written.Packed.GetAllocatedSize();
+
+	// hand the filled slot over and take back whichever slot was pending, an unread pending slot is simply overwritten
+	const int32 PreviousPending = FPlatformAtomics::InterlockedExchange(&PendingIndex, WriteIndex | DynamicDataDirtyFlag);
+	WriteIndex = PreviousPending & DynamicDataIndexMask;
+
+	// queue a call to pick up the latest data, later calls find nothing new and early out
+	ENQUEUE_RENDER_COMMAND(SIMeshObjectUpdateDataCommand)(
+		[this](FRHICommandListImmediate& RHICmdList)
+	{
+		ConsumeDynamicData_RenderThread();
+	}
+	);
+}
+
+void FSIMeshObject::ConsumeDynamicData_RenderThread()
+{
+	if ((PendingIndex & DynamicDataDirtyFlag) == 0)
+		return;
+
+	const int32 PreviousPending = FPlatformAtomics::InterlockedExchange(&PendingIndex, ReadIndex);
+	ReadIndex = PreviousPending & DynamicDataIndexMask;
+}
+
+class FSIMeshSceneProxy final : public FPrimitiveSceneProxy
+{
+public:
+	FSIMeshSceneProxy(USIMeshComponent* Component, 
+		USkeletalMesh* SkeletalMesh, FSIMeshObject* MeshObject);
+	virtual ~FSIMeshSceneProxy();
+
+	
+public: // override
 
 	SIZE_T GetTypeHash() const override
 	{
@@ -768,12 +1165,14 @@ public: // override
 
 	virtual uint32 GetMemoryFootprint(void) const override
 	{
-		return(sizeof(*this) + FPrimitiveSceneProxy::GetAllocatedSize());
+		return(sizeof(*this) + FPrimitiveSceneProxy::GetAllocatedSize() + (MeshObject ? MeshObject->GetSystemMemorySize() : 0));
 	}
 
 private:
-	void GetDynamicMeshElementsByLOD(FMeshElementCollector & Collector, int32 ViewIndex, const FEngineShowFlags& EngineShowFlags,
-		int LODIndex, const TArray< FSIMeshInstanceData>& InstanceData, int32 MaxNumInstances) const;
+	void GetDynamicMeshElementsByBin(FMeshElementCollector & Collector, int32 ViewIndex, const FEngineShowFlags& EngineShowFlags,
+		const FSIInstanceBinner::FBin& Bin, const FInstanceBuffers& InstanceBuffers) const;
+
+	int32 GetMaxDrawnInstances() const;
 
 private:
 	USIMeshComponent* Component;
@@ -783,6 +1182,11 @@ private:
 	class USkeletalMesh* SkeletalMesh;
 	class FSIMeshObject* MeshObject;
 	FSkeletalMeshRenderData* SkeletalMeshRenderData;
+	/** Indexed by instance mesh index, the first one is SkeletalMesh. */
+	TArray<USkeletalMesh*> Meshes;
+	int32 MaxDrawnInstances;
+	int32 DrawBudgetFadeInstances;
+	bool bInstancesInComponentSpace;
 };
 
 FSIMeshSceneProxy::FSIMeshSceneProxy(USIMeshComponent * Component,
@@ -795,47 +1199,72 @@ FSIMeshSceneProxy::FSIMeshSceneProxy(USIMeshComponent * Component,
 	, SkeletalMesh(SkeletalMesh)
 	, MeshObject(MeshObject)
 	, SkeletalMeshRenderData(SkeletalMesh->GetResourceForRendering())
+	, MaxDrawnInstances(Component->MaxDrawnInstances)
+	, DrawBudgetFadeInstances(Component->DrawBudgetFadeInstances)
+	, bInstancesInComponentSpace(Component->bInstancesInComponentSpace)
 {
+	Component->GetRenderMeshes(Meshes);
+
+	// variants draw with their own materials
+	for (int32 MeshIndex = 1; MeshIndex < Meshes.Num(); MeshIndex++)
+	{
+		for (const FSkeletalMaterial& Material : Meshes[MeshIndex]->Materials)
+		{
+			if (Material.MaterialInterface)
+			{
+				MaterialRelevance |= Material.MaterialInterface->GetRelevance_Concurrent(FeatureLevel);
+			}
+		}
+	}
 }
 
 FSIMeshSceneProxy::~FSIMeshSceneProxy()
 {
 }
 
-void FSIMeshSceneProxy::GetDynamicMeshElementsByLOD(FMeshElementCollector & Collector, int32 ViewIndex, const FEngineShowFlags& EngineShowFlags,
-	int LODIndex, const TArray< FSIMeshInstanceData>& InstanceData, int32 MaxNumInstances) const
+void FSIMeshSceneProxy::GetDynamicMeshElementsByBin(FMeshElementCollector & Collector, int32 ViewIndex, const FEngineShowFlags& EngineShowFlags,
+	const FSIInstanceBinner::FBin& Bin, const FInstanceBuffers& InstanceBuffers) const
 {
-	const FSkeletalMeshLODRenderData& LODData = SkeletalMeshRenderData->LODRenderData[LODIndex];
+	const int32 LODIndex = Bin.LODIndex;
+	USkeletalMesh* Mesh = Meshes[Bin.MeshIndex];
+	const FSkeletalMeshLODRenderData& LODData = Mesh->GetResourceForRendering()->LODRenderData[LODIndex];
 
 	for (int32 SectionIndex = 0; SectionIndex < LODData.RenderSections.Num(); SectionIndex++)
 	{
 		const FSkelMeshRenderSection& Section = LODData.RenderSections[SectionIndex];
-		FGPUSkinVertexFactory* VertexFactory = MeshObject->GetSkinVertexFactory(LODIndex, SectionIndex);
+		FGPUSkinVertexFactory* VertexFactory = MeshObject->GetSkinVertexFactory(Bin.MeshIndex, LODIndex, SectionIndex);
 
 		if (!VertexFactory)
 			continue;
 
-		// UpdateInstanceData
-		VertexFactory->GetShaderData().UpdateInstanceData(InstanceData, MaxNumInstances);
-
 		// Collect MeshBatch
-		FMeshBatch& Mesh = Collector.AllocateMesh();
+		FMeshBatch& MeshBatch = Collector.AllocateMesh();
 
-		Mesh.VertexFactory = MeshObject->GetSkinVertexFactory(LODIndex, SectionIndex);
+		MeshBatch.VertexFactory = VertexFactory;
 
 		// Get material
-		const FSkeletalMeshLODInfo& Info = *(SkeletalMesh->GetLODInfo(LODIndex));
+		const FSkeletalMeshLODInfo& Info = *(Mesh->GetLODInfo(LODIndex));
 		int32 UseMaterialIndex = Section.MaterialIndex;
 		if (LODIndex > 0)
 		{
 			if (Section.MaterialIndex < Info.LODMaterialMap.Num())
 			{
 				UseMaterialIndex = Info.LODMaterialMap[Section.MaterialIndex];
-				UseMaterialIndex = FMath::Clamp(UseMaterialIndex, 0, SkeletalMesh->Materials.Num());
+				UseMaterialIndex = FMath::Clamp(UseMaterialIndex, 0, Mesh->Materials.Num());
 			}
 		}
 
-		UMaterialInterface* Material = Component->GetMaterial(UseMaterialIndex);
+		// component overrides apply to the main mesh, variants use their own materials
+		UMaterialInterface* Material = nullptr;
+		if (Bin.MeshIndex == 0)
+		{
+			Material = Component->GetMaterial(UseMaterialIndex);
+		}
+		else if (Mesh->Materials.IsValidIndex(UseMaterialIndex))
+		{
+			Material = Mesh->Materials[UseMaterialIndex].MaterialInterface;
+		}
+
 		if (!Material)
 		{
 			Material = UMaterial::GetDefaultMaterial(MD_Surface);
@@ -843,30 +1272,32 @@ void FSIMeshSceneProxy::GetDynamicMeshElementsByLOD(FMeshElementCollector & Coll
 
 		if (Material)
 		{
-			Mesh.MaterialRenderProxy = Material->GetRenderProxy();
+			MeshBatch.MaterialRenderProxy = Material->GetRenderProxy();
 		}
 
-		FMeshBatchElement& BatchElement = Mesh.Elements[0];
+		FMeshBatchElement& BatchElement = MeshBatch.Elements[0];
 		BatchElement.FirstIndex = Section.BaseIndex;
 		BatchElement.IndexBuffer = LODData.MultiSizeIndexContainer.GetIndexBuffer();
 		BatchElement.MaxVertexIndex = LODData.GetNumVertices() - 1;
 		BatchElement.PrimitiveUniformBuffer = GetUniformBuffer();
 		BatchElement.NumPrimitives = Section.NumTriangles;
-		BatchElement.NumInstances = InstanceData.Num();
+		BatchElement.NumInstances = Bin.NumInstances;
+		BatchElement.UserData = &InstanceBuffers;
+		BatchElement.UserIndex = Bin.FirstInstance;
 
-		Mesh.bWireframe |= EngineShowFlags.Wireframe;
-		Mesh.Type = PT_TriangleList;
-		Mesh.bSelectable = true;
+		MeshBatch.bWireframe |= EngineShowFlags.Wireframe;
+		MeshBatch.Type = PT_TriangleList;
+		MeshBatch.bSelectable = true;
 
 		BatchElement.MinVertexIndex = Section.BaseVertexIndex;
-		Mesh.ReverseCulling = IsLocalToWorldDeterminantNegative();
-		Mesh.CastShadow = true;
-		Mesh.bCanApplyViewModeOverrides = true;
+		MeshBatch.ReverseCulling = IsLocalToWorldDeterminantNegative();
+		MeshBatch.CastShadow = true;
+		MeshBatch.bCanApplyViewModeOverrides = true;
 
-		if (ensureMsgf(Mesh.MaterialRenderProxy, TEXT("GetDynamicElementsSection with invalid MaterialRenderProxy. Owner:%s LODIndex:%d UseMaterialIndex:%d"), *GetOwnerName().ToString(), LODIndex, UseMaterialIndex) &&
-			ensureMsgf(Mesh.MaterialRenderProxy->GetMaterial(FeatureLevel), TEXT("GetDynamicElementsSection with invalid FMaterial. Owner:%s LODIndex:%d UseMaterialIndex:%d"), *GetOwnerName().ToString(), LODIndex, UseMaterialIndex))
+		if (ensureMsgf(MeshBatch.MaterialRenderProxy, TEXT("GetDynamicElementsSection with invalid MaterialRenderProxy. Owner:%s LODIndex:%d UseMaterialIndex:%d"), *GetOwnerName().ToString(), LODIndex, UseMaterialIndex) &&
+			ensureMsgf(MeshBatch.MaterialRenderProxy->GetMaterial(FeatureLevel), TEXT("GetDynamicElementsSection with invalid FMaterial. Owner:%s LODIndex:%d UseMaterialIndex:%d"), *GetOwnerName().ToString(), LODIndex, UseMaterialIndex))
 		{
-			Collector.AddMesh(ViewIndex, Mesh);
+			Collector.AddMesh(ViewIndex, MeshBatch);
 		}
 
 #if !(UE_BUILD_SHIPPING || UE_BUILD_TEST)
@@ -875,93 +1306,100 @@ void FSIMeshSceneProxy::GetDynamicMeshElementsByLOD(FMeshElementCollector & Coll
 	}
 }
 
-int32 GetMinDesiredLODLevel(USkeletalMesh* SkeletalMesh, const FSceneView* View, const FVector4& Origin, const float SphereRadius)
-{
-	static const auto* SkeletalMeshLODRadiusScale = IConsoleManager::Get().FindTConsoleVariableDataFloat(TEXT("r.SkeletalMeshLODRadiusScale"));
-	float LODScale = FMath::Clamp(SkeletalMeshLODRadiusScale->GetValueOnRenderThread(), 0.25f, 1.0f);
-
-	const float ScreenRadiusSquared = ComputeBoundsScreenRadiusSquared(Origin, SphereRadius, *View) * LODScale * LODScale;
-
-	// Need the current LOD
-	const int32 CurrentLODLevel = 0;
-	int32 NewLODLevel = 0;
-
-	// Look for a lower LOD if the EngineShowFlags is enabled - Thumbnail rendering disables LODs
-	if (View->Family && 1 == View->Family->EngineShowFlags.LOD)
-	{
-		int32 LODNum = SkeletalMesh->GetResourceForRendering()->LODRenderData.Num();
-
-		// Iterate from worst to best LOD
-		for (int32 LODLevel = LODNum - 1; LODLevel > 0; LODLevel--)
-		{
-			FSkeletalMeshLODInfo* LODInfo = SkeletalMesh->GetLODInfo(LODLevel);
-
-			// Get ScreenSize for this LOD
-			float ScreenSize = LODInfo->ScreenSize.Default;
-
-			// If we are considering shifting to a better (lower) LOD, bias with hysteresis.
-			if (LODLevel <= CurrentLODLevel)
-			{
-				ScreenSize += LODInfo->LODHysteresis;
-			}
-
-			// If have passed this boundary, use this LOD
-			if (FMath::Square(ScreenSize * 0.5f) > ScreenRadiusSquared)
-			{
-				NewLODLevel = LODLevel;
-				break;
-			}
-		}
-	}
-
-	return NewLODLevel;
-}
-
 void FSIMeshSceneProxy::GetDynamicMeshElements(const TArray<const FSceneView*>& Views,
 	const FSceneViewFamily & ViewFamily, uint32 VisibilityMap, FMeshElementCollector & Collector) const
 {
+	SCOPE_CYCLE_COUNTER(STAT_SIGetDynamicMeshElements);
+
 	if (!MeshObject)
 		return;
 
 	auto DynamicData = MeshObject->GetDynamicData();
-	if (!DynamicData || DynamicData->InstanceDatas.Num() <= 0)
+	if (DynamicData->InstanceDatas.Num() <= 0)
 		return;
 
-	auto& LODInstanceDatas = MeshObject->TempLODInstanceDatas;
+	FSIInstanceBinner& Binner = MeshObject->Binner;
+
+	const TArray<FSIMeshInstanceData>& InstanceDatas = DynamicData->InstanceDatas;
+	const int32 MaxDrawn = GetMaxDrawnInstances();
+	const bool bDrawBudgetFade = (CVarSkinnedInstancingDrawBudgetFade.GetValueOnRenderThread() != 0);
 
 	for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ViewIndex++)
 	{
 		if (VisibilityMap & (1 << ViewIndex))
 		{
-			int32 MaxNumInstances = DynamicData->InstanceDatas.Num();
-			int32 LODNum = SkeletalMeshRenderData->LODRenderData.Num();
-
-			if (LODInstanceDatas.Num() < LODNum)
-				LODInstanceDatas.AddDefaulted(LODNum - LODInstanceDatas.Num());
+			const FSceneView* View = Views[ViewIndex];
+
+			FSIInstanceBinner::FView BinnerView;
+			BinnerView.Origin = View->ViewMatrices.GetViewOrigin();
+			BinnerView.ProjectionMatrix = View->ViewMatrices.GetProjectionMatrix();
+			BinnerView.bUseLODs = View->Family && 1 == View->Family->EngineShowFlags.LOD;
+			BinnerView.InstanceToWorld = bInstancesInComponentSpace ? GetLocalToWorld() : FMatrix::Identity;
+			BinnerView.InstanceBounds = MeshObject->InstanceBounds.IsValid() ? &MeshObject->InstanceBounds : nullptr;
+
+			// Shadow depth passes gather with the camera view, cull casters against the shadow frustum instead.
+			// Its planes are in shadow translated space, like HISM bring them back to world space.
+			FConvexVolume ShadowCullFrustum;
+			if (const FConvexVolume* ShadowFrustum = View->GetDynamicMeshElementsShadowCullFrustum())
+			{
+				const FVector PreShadowTranslation = View->GetPreShadowTranslation();
+				for (const FPlane& Plane : ShadowFrustum->Planes)
+				{
+					ShadowCullFrustum.Planes.Add(FPlane(FVector(Plane), Plane.W - (FVector(Plane) | PreShadowTranslation)));
+				}
+				ShadowCullFrustum.Init();
+				BinnerView.ViewFrustum = &ShadowCullFrustum;
+			}
+			else if (View->ViewMatrices.GetOverriddenTranslatedViewMatrix() == View->ViewMatrices.GetTranslatedViewMatrix())
+			{
+				// shadow gathers override the view matrix with the light's, those without a caster frustum are not culled
+				BinnerView.ViewFrustum = &View->ViewFrustum;
+			}
 
-			for (int32 i = 0; i < LODNum; i++)
-				LODInstanceDatas[i].Reset();
+			int32 MaxNumInstances = InstanceDatas.Num();
 
-			// Calc LOD Instance
-			for (auto Instance : DynamicData->InstanceDatas)
+			// Calc (mesh, LOD) bins
 			{
-				int LODLevel = GetMinDesiredLODLevel(SkeletalMesh, Views[ViewIndex], Instance.Transform.GetOrigin(), 100);
-				check(LODLevel < LODNum);
-				LODInstanceDatas[LODLevel].Add(Instance);
+				SCOPE_CYCLE_COUNTER(STAT_SILODBinning);
+				CSV_SCOPED_TIMING_STAT(SkinnedInstancing, LODBinning);
+				Binner.Bin(Meshes, BinnerView, InstanceDatas, MaxDrawn, bDrawBudgetFade ? DrawBudgetFadeInstances : 0);
 			}
 
-			// Draw All LOD
-			for (int32 LODIndex = 0; LODIndex < LODNum; LODIndex++)
+			INC_DWORD_STAT_BY(STAT_SIDroppedInstances, Binner.GetNumDropped());
+			INC_DWORD_STAT_BY(STAT_SICulledInstances, Binner.GetNumCulled());
+			for (const FSIInstanceBinner::FBin& Bin : Binner.Bins)
 			{
-				if (LODInstanceDatas[LODIndex].Num() > 0)
+				switch (Bin.LODIndex)
 				{
-					GetDynamicMeshElementsByLOD(Collector, ViewIndex, ViewFamily.EngineShowFlags, LODIndex, LODInstanceDatas[LODIndex], MaxNumInstances);
+				case 0: INC_DWORD_STAT_BY(STAT_SIInstancesLOD0, Bin.NumInstances); break;
+				case 1: INC_DWORD_STAT_BY(STAT_SIInstancesLOD1, Bin.NumInstances); break;
+				case 2: INC_DWORD_STAT_BY(STAT_SIInstancesLOD2, Bin.NumInstances); break;
+				default: INC_DWORD_STAT_BY(STAT_SIInstancesLOD3, Bin.NumInstances); break;
 				}
 			}
+
+			if (Binner.Bins.Num() == 0)
+				continue;
+
+			// UpdateInstanceData, once for every mesh and LOD
+			const FInstanceBuffers& InstanceBuffers = MeshObject->GetInstanceShaderData().UpdateInstanceData(Binner, DynamicData->Packed, MaxNumInstances, ViewFamily.FrameNumber);
+
+			// Draw All Bins
+			for (const FSIInstanceBinner::FBin& Bin : Binner.Bins)
+			{
+				GetDynamicMeshElementsByBin(Collector, ViewIndex, ViewFamily.EngineShowFlags, Bin, InstanceBuffers);
+			}
 		}
 	}
 }
 
+int32 FSIMeshSceneProxy::GetMaxDrawnInstances() const
+{
+	if (MaxDrawnInstances > 0)
+		return MaxDrawnInstances;
+	return FMath::Max(CVarSkinnedInstancingMaxDrawnInstances.GetValueOnRenderThread(), 0);
+}
+
 FPrimitiveViewRelevance FSIMeshSceneProxy::GetViewRelevance(const FSceneView * View) const
 {
 	FPrimitiveViewRelevance Result;
@@ -992,7 +1430,31 @@ USIMeshComponent::USIMeshComponent(const FObjectInitializer& ObjectInitializer)
 	PrimaryComponentTick.bCanEverTick = true;
 	PrimaryComponentTick.TickGroup = TG_PrePhysics;
 
-	InstanceIdIncrease = 0;
+	DynamicDataTickFunction.bCanEverTick = true;
+	DynamicDataTickFunction.bStartWithTickEnabled = true;
+	DynamicDataTickFunction.TickGroup = TG_LastDemotable;
+
+	UpdateRateFrameCounter = 0;
+	SentInstanceRevision = 0;
+	BoundsInstanceRevision = 0;
+	bBatchMembersDirty = false;
+	DynamicDataTaskRevision = 0;
+	InstanceBoundsAnimationData = nullptr;
+	InstanceBoundsGeneration = 0;
+	bInstanceBoundsHaveBones = false;
+
+	bInstancesInComponentSpace = false;
+	bBatchWithOtherComponents = false;
+	bEnableUpdateRateOptimizations = true;
+	UpdateRateBandDistances.Add(3000.0f);
+	UpdateRateBandDistances.Add(6000.0f);
+	UpdateRateBandDistances.Add(12000.0f);
+	OffScreenUpdateRateBand = 3;
+
+	MaxDrawnInstances = 0;
+	DrawBudgetFadeInstances = 256;
+
+	StateMachine = nullptr;
 }
 
 FPrimitiveSceneProxy* USIMeshComponent::CreateSceneProxy()
@@ -1000,8 +1462,8 @@ FPrimitiveSceneProxy* USIMeshComponent::CreateSceneProxy()
 	FSIMeshSceneProxy* Result = nullptr;
 	FSkeletalMeshRenderData* SkelMeshRenderData = SkeletalMesh ? SkeletalMesh->GetResourceForRendering() : nullptr;
 
-	// Only create a scene proxy for rendering if properly initialized
-	if (SkelMeshRenderData)
+	// Only create a scene proxy for rendering if properly initialized, batch followers are drawn by their leader
+	if (SkelMeshRenderData && !IsBatchFollower() && !SIIsServerMode())
 	{
 		Result = ::new FSIMeshSceneProxy(this, SkeletalMesh, MeshObject);
 	}
@@ -1021,45 +1483,126 @@ int32 USIMeshComponent::GetNumMaterials() const
 
 FBoxSphereBounds USIMeshComponent::CalcBounds(const FTransform & BoundTransform) const
 {
-	if (SkeletalMesh && PerInstanceSMData.Num() > 0)
+	SCOPE_CYCLE_COUNTER(STAT_SICalcBounds);
+
+	FBoxSphereBounds NewBounds(BoundTransform.GetLocation(), FVector::ZeroVector, 0.f);
+	bool IsFirst = true;
+
+	if (SkeletalMesh && Instances.Num() > 0)
 	{
-		FBoxSphereBounds RenderBounds = SkeletalMesh->GetBounds();
-		FBoxSphereBounds NewBounds;
+		// tight bounds of the frames each instance plays when the animation is baked
+		const FSIInstanceBounds& LocalBounds = GetInstanceBounds();
 
-		bool IsFirst = true;
-		for (auto& Elem : PerInstanceSMData)
+		FBox NewBox(ForceInit);
+		for (const FSIMeshInstanceData& Instance : Instances.InstanceDatas)
 		{
-			if (IsFirst)
-			{
-				IsFirst = false;
-				NewBounds = RenderBounds.TransformBy(Elem.Value.Transform);
-			}
-			else
-			{
-				NewBounds = NewBounds + RenderBounds.TransformBy(Elem.Value.Transform);
-			}
+			NewBox += LocalBounds.GetLocalBounds(Instance).TransformBy(Instance.Transform);
+		}
+
+		IsFirst = false;
+		NewBounds = FBoxSphereBounds(NewBox);
+
+		// component space instances are gathered locally and moved once
+		if (bInstancesInComponentSpace)
+		{
+			NewBounds = NewBounds.TransformBy(BoundTransform);
 		}
+	}
+
+	// a batch leader draws every member, so its bounds cover theirs
+	if (Batch.IsValid() && Batch->GetLeader() == this)
+	{
+		for (const USIMeshComponent* Member : Batch->GetMembers())
+		{
+			if (Member == this || Member->Instances.Num() == 0)
+				continue;
 
-		return NewBounds;
+			NewBounds = IsFirst ? Member->Bounds : NewBounds + Member->Bounds;
+			IsFirst = false;
+		}
 	}
-	else
+
+	return NewBounds;
+}
+
+void USIMeshComponent::OnUpdateTransform(EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport)
+{
+	Super::OnUpdateTransform(UpdateTransformFlags, Teleport);
+
+	// batched instances are re-expressed relative to the leader, component space ones move with their component
+	if (Batch.IsValid() && Batch->GetMembers().Num() > 1 && bInstancesInComponentSpace)
 	{
-		return FBoxSphereBounds(BoundTransform.GetLocation(), FVector::ZeroVector, 0.f);
+		Batch->GetLeader()->OnBatchMembersChanged();
 	}
 }
 
 void USIMeshComponent::OnRegister()
 {
 	Super::OnRegister();
+
+	// batching only merges draws
+	if (bBatchWithOtherComponents && !SIIsServerMode())
+	{
+		Batch = FSIMeshBatcher::Join(this);
+	}
+
+	BuildHitShapes();
+	InstanceBounds.Reset();
+}
+
+void USIMeshComponent::BuildHitShapes()
+{
+	// shapes index the CPU palette, which follows the animation component's skeleton
+	HitShapes.Reset();
+	const USIAnimationComponent* Animation = AnimationComponent.Get();
+	if (SkeletalMesh && SkeletalMesh->PhysicsAsset && Animation && Animation->Skeleton)
+	{
+		HitShapes = MakeShared<FSIInstanceHitShapes, ESPMode::ThreadSafe>();
+		HitShapes->Init(SkeletalMesh->PhysicsAsset, Animation->Skeleton->GetReferenceSkeleton());
+	}
+}
+
+const FSIInstanceBounds& USIMeshComponent::GetInstanceBounds() const
+{
+	// the bone boxes come with the palette, which is rebuilt on its own and can get them after it was built
+	const FSIAnimationData* AnimationData = AnimationComponent.IsValid() ? AnimationComponent->GetAnimationData() : nullptr;
+	const uint32 Generation = AnimationData ? AnimationData->GetGeneration() : 0;
+	const bool bHasBones = AnimationData && AnimationData->HasBoneBounds();
+
+	if (!InstanceBounds.IsValid() || AnimationData != InstanceBoundsAnimationData || Generation != InstanceBoundsGeneration
+		|| bHasBones != bInstanceBoundsHaveBones)
+	{
+		TArray<USkeletalMesh*> Meshes;
+		GetRenderMeshes(Meshes);
+
+		InstanceBounds = MakeShared<FSIInstanceBounds>();
+		InstanceBounds->Init(Meshes, AnimationData);
+		InstanceBoundsAnimationData = AnimationData;
+		InstanceBoundsGeneration = Generation;
+		bInstanceBoundsHaveBones = bHasBones;
+	}
+
+	return *InstanceBounds;
 }
 
 void USIMeshComponent::OnUnregister()
 {
+	WaitForDynamicDataTask();
+
 	Super::OnUnregister();
+
+	FSIMeshBatcher::Leave(this, Batch);
+}
+
+bool USIMeshComponent::IsBatchFollower() const
+{
+	return Batch.IsValid() && Batch->GetLeader() != this;
 }
 
 void USIMeshComponent::CreateRenderState_Concurrent()
 {
+	INC_DWORD_STAT(STAT_SIRenderStateRecreates);
+
 	if (SkeletalMesh && AnimationComponent.IsValid())
 	{
 		ERHIFeatureLevel::Type SceneFeatureLevel = GetWorld()->FeatureLevel;
@@ -1068,11 +1611,13 @@ void USIMeshComponent::CreateRenderState_Concurrent()
 		checkf(!SkeletalMesh->HasAnyFlags(RF_NeedLoad | RF_NeedPostLoad | RF_NeedPostLoadSubobjects | RF_WillBeLoaded), TEXT("Attempting to create render state for a skeletal mesh that is is not fully loaded. Mesh: %s"), *SkeletalMesh->GetName());
 
 		// No need to create the mesh object if we aren't actually rendering anything (see UPrimitiveComponent::Attach)
-		if (FApp::CanEverRender() && ShouldComponentAddToScene())
+		if (!SIIsServerMode() && ShouldComponentAddToScene() && !IsBatchFollower())
 		{
-			MeshObject = ::new FSIMeshObject(SkeletalMesh, SceneFeatureLevel);
+			TArray<USkeletalMesh*> Meshes;
+			GetRenderMeshes(Meshes);
+			MeshObject = ::new FSIMeshObject(Meshes, SceneFeatureLevel, bInstancesInComponentSpace);
 
-			MeshObject->UpdateBoneData(AnimationComponent->GetAnimationData());
+			MeshObject->UpdateBoneData(AnimationComponent->GetAnimationData(), Meshes);
 		}
 	}
 
@@ -1090,6 +1635,9 @@ void USIMeshComponent::SendRenderDynamicData_Concurrent()
 
 void USIMeshComponent::DestroyRenderState_Concurrent()
 {
+	// the task fills a buffer of the mesh object
+	WaitForDynamicDataTask();
+
 	Super::DestroyRenderState_Concurrent();
 
 	if (MeshObject)
@@ -1110,64 +1658,1115 @@ void USIMeshComponent::SetAnimationComponent(USIAnimationComponent * _AnimationC
 	AnimationComponent.Reset();
 	AnimationComponent = _AnimationComponent;
 	MarkRenderDynamicDataDirty();
+
+	if (IsRegistered())
+	{
+		BuildHitShapes();
+	}
+	InstanceBounds.Reset();
+
+	// the animation component is part of the batch key
+	if (Batch.IsValid())
+	{
+		FSIMeshBatcher::Leave(this, Batch);
+		Batch = FSIMeshBatcher::Join(this);
+		MarkRenderStateDirty();
+	}
 }
 
-void USIMeshComponent::UpdateMeshObejctDynamicData()
+void USIMeshComponent::CrossFadeInstance(int32 Id, int Sequence, float FadeLength, bool Loop)
 {
-	if (MeshObject)
+	PrepareInstanceWrite();
+
+	int32 Index = Instances.FindIndex(Id);
+	if (Index == INDEX_NONE)
+		return;
+
+	UAnimSequence* AnimSequence = GetSequence(Sequence);
+	if (AnimSequence)
 	{
-		auto DynamicData = FSIMeshObject::FDynamicData::Alloc();
-		DynamicData->InstanceDatas.Reserve(PerInstanceSMData.Num());
-		for (auto Pair : PerInstanceSMData)
-			DynamicData->InstanceDatas.Add(Pair.Value);
-		MeshObject->UpdateDynamicData(DynamicData);
+		FAnimtionPlayer::Sequence Seq(Sequence, AnimSequence->SequenceLength, AnimSequence->GetNumberOfFrames());
+		CrossFadeInstanceAtIndex(Index, Seq, FadeLength, Loop);
 	}
 }
 
-int32 USIMeshComponent::AddInstance(const FTransform & Transform)
+void USIMeshComponent::CrossFadeInstanceAtIndex(int32 Index, const FAnimtionPlayer::Sequence& Seq, float FadeLength, bool Loop)
+{
+	// keep the clip timing of instances that skipped updates
+	Instances.FlushPendingTime(Index, GetNotifyTracksToSearch(), PendingNotifies);
+
+	Instances.Players[Index].CrossFade(Seq, Loop, FadeLength);
+	Instances.UpdateAnimData(Index);
+}
+
+FMatrix USIMeshComponent::GetInstanceToWorld() const
+{
+	return bInstancesInComponentSpace ? GetComponentTransform().ToMatrixWithScale() : FMatrix::Identity;
+}
+
+void USIMeshComponent::SetInstancesInComponentSpace(bool bInComponentSpace)
 {
-	int Id = ++InstanceIdIncrease;
-	FSIMeshInstanceData NewInstanceData;
+	if (bInstancesInComponentSpace == bInComponentSpace)
+		return;
 
-	NewInstanceData.Transform = Transform.ToMatrixWithScale();
-	NewInstanceData.AnimDatas[0] = { 0, 0, 0, 0, 1 };
-	NewInstanceData.AnimDatas[1] = { 0, 0, 0, 0, 0 };
+	PrepareInstanceWrite();
 
-	PerInstanceSMData.Add(Id, NewInstanceData);
+	// keep every instance where it is in the world
+	const FMatrix ComponentToWorld = GetComponentTransform().ToMatrixWithScale();
+	const FMatrix Conversion = bInComponentSpace ? ComponentToWorld.Inverse() : ComponentToWorld;
+	for (FSIMeshInstanceData& Instance : Instances.InstanceDatas)
+	{
+		Instance.Transform = Instance.Transform * Conversion;
+	}
 
+	bInstancesInComponentSpace = bInComponentSpace;
+	Instances.MarkChanged();
 	MarkRenderStateDirty();
+}
 
-	return Id;
+bool USIMeshComponent::GetInstanceTransform(int32 Id, FTransform& OutTransform) const
+{
+	int32 Index = Instances.FindIndex(Id);
+	if (Index == INDEX_NONE)
+		return false;
+
+	OutTransform.SetFromMatrix(Instances.InstanceDatas[Index].Transform);
+	return true;
 }
 
-void USIMeshComponent::RemoveInstance(int Id)
+int32 USIMeshComponent::GetInstanceSequence(int32 Id) const
 {
-	PerInstanceSMData.Remove(Id);
-	MarkRenderStateDirty();
+	int32 Index = Instances.FindIndex(Id);
+	if (Index == INDEX_NONE)
+		return -1;
+
+	const FAnimtionPlayer& Player = Instances.Players[Index];
+	return Player.GetNextSeq().Id >= 0 ? Player.GetNextSeq().Id : Player.GetCurrentSeq().Id;
 }
 
-UAnimSequence * USIMeshComponent::GetSequence(int Id)
+TArray<int32> USIMeshComponent::AddInstances(const TArray<FTransform>& Transforms)
 {
-	if (AnimationComponent.IsValid())
+	PrepareInstanceWrite();
+
+	TArray<int32> Ids;
+	Ids.Reserve(Transforms.Num());
+
+	Instances.Reserve(Transforms.Num());
+	for (const FTransform& Transform : Transforms)
 	{
-		return AnimationComponent->GetSequence(Id);
+		Ids.Add(Instances.Add(Transform.ToMatrixWithScale()));
 	}
 
-	return nullptr;
+	if (Transforms.Num() > 0)
+		MarkRenderDynamicDataDirty();
+
+	return Ids;
 }
 
-FSIMeshInstanceData* USIMeshComponent::GetInstanceData(int Id)
+void USIMeshComponent::RemoveInstances(const TArray<int32>& Ids)
 {
-	return PerInstanceSMData.Find(Id);
+	PrepareInstanceWrite();
+
+	int32 NumRemoved = 0;
+	for (int32 Id : Ids)
+	{
+		if (Instances.Remove(Id))
+			NumRemoved++;
+	}
+
+	if (NumRemoved > 0)
+		MarkRenderDynamicDataDirty();
 }
 
-void USIMeshComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction * ThisTickFunction)
+void USIMeshComponent::UpdateInstanceTransforms(const TArray<int32>& Ids, const TArray<FTransform>& Transforms)
 {
-	// Tick ActorComponent first.
-	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
-	UpdateBounds();
-	MarkRenderTransformDirty();
-	MarkRenderDynamicDataDirty();
+	PrepareInstanceWrite();
+
+	if (Ids.Num() != Transforms.Num())
+	{
+		UE_LOG(LogSkinnedInstancing, Warning, TEXT("%s: UpdateInstanceTransforms got %d ids and %d transforms"),
+			*GetPathName(), Ids.Num(), Transforms.Num());
+		return;
+	}
+
+	for (int32 i = 0; i < Ids.Num(); i++)
+	{
+		int32 Index = Instances.FindIndex(Ids[i]);
+		if (Index != INDEX_NONE)
+		{
+			Instances.InstanceDatas[Index].Transform = Transforms[i].ToMatrixWithScale();
+		}
+	}
+
+	if (Ids.Num() > 0)
+	{
+		Instances.MarkChanged();
+		MarkRenderDynamicDataDirty();
+	}
+}
+
+void USIMeshComponent::SetInstanceTransforms(TArrayView<const int32> Ids, TArrayView<const FVector> Positions,
+	TArrayView<const FQuat> Rotations, TArrayView<const FVector> Scales)
+{
+	SetInstanceTransforms(Ids, TSIStridedView<FVector>(Positions), TSIStridedView<FQuat>(Rotations), TSIStridedView<FVector>(Scales));
+}
+
+void USIMeshComponent::SetInstanceTransforms(TArrayView<const int32> Ids, const TSIStridedView<FVector>& Positions,
+	const TSIStridedView<FQuat>& Rotations, const TSIStridedView<FVector>& Scales)
+{
+	PrepareInstanceWrite();
+	SCOPE_CYCLE_COUNTER(STAT_SISetInstanceTransforms);
+
+	if (!Instances.SetTransforms(Ids, Positions, Rotations, Scales))
+	{
+		UE_LOG(LogSkinnedInstancing, Warning, TEXT("%s: SetInstanceTransforms got %d ids, %d positions, %d rotations and %d scales"),
+			*GetPathName(), Ids.Num(), Positions.Num, Rotations.Num, Scales.Num);
+		return;
+	}
+
+	if (Ids.Num() > 0)
+		MarkRenderDynamicDataDirty();
+}
+
+bool USIMeshComponent::GetInstanceBoneTransform(int32 Id, FName BoneOrSocketName, FTransform& OutTransform) const
+{
+	FTransform Result;
+	if (GetInstanceBoneTransforms(MakeArrayView(&Id, 1), BoneOrSocketName, MakeArrayView(&Result, 1)) == 0)
+		return false;
+
+	OutTransform = Result;
+	return true;
+}
+
+int32 USIMeshComponent::GetInstanceBoneTransforms(TArrayView<const int32> Ids, FName BoneOrSocketName, TArrayView<FTransform> OutTransforms) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_SIBoneTransformQueries);
+
+	check(Ids.Num() == OutTransforms.Num());
+
+	const USIAnimationComponent* Animation = AnimationComponent.Get();
+	if (!Animation || !Animation->Skeleton || !SkeletalMesh)
+		return 0;
+
+	// sockets are found on the mesh an instance is drawn with or its skeleton, the palette is indexed by skeleton bone
+	struct FMeshSocket
+	{
+		int32 BoneIndex = INDEX_NONE;
+		FTransform LocalTransform;
+	};
+
+	TArray<USkeletalMesh*> Meshes;
+	GetRenderMeshes(Meshes);
+
+	TArray<FMeshSocket, TInlineAllocator<4>> MeshSockets;
+	bool bAnyFound = false;
+	for (USkeletalMesh* Mesh : Meshes)
+	{
+		FMeshSocket& MeshSocket = MeshSockets.AddDefaulted_GetRef();
+		FName BoneName = BoneOrSocketName;
+		if (const USkeletalMeshSocket* Socket = Mesh->FindSocket(BoneOrSocketName))
+		{
+			BoneName = Socket->BoneName;
+			MeshSocket.LocalTransform = Socket->GetSocketLocalTransform();
+		}
+		MeshSocket.BoneIndex = Animation->Skeleton->GetReferenceSkeleton().FindBoneIndex(BoneName);
+		bAnyFound |= MeshSocket.BoneIndex != INDEX_NONE;
+	}
+
+	if (!bAnyFound)
+		return 0;
+
+	const bool bAnimationBlend = (CVarSkinnedInstancingDisableAnimationBlend.GetValueOnAnyThread() == 0);
+	const bool bFrameLerp = (CVarSkinnedInstancingDisableFrameLerp.GetValueOnAnyThread() == 0);
+	const FMatrix InstanceToWorld = GetInstanceToWorld();
+
+	int32 NumFound = 0;
+	Animation->ReadCPUBonePalette([&](const FSIBonePalette& Palette)
+	{
+		for (int32 i = 0; i < Ids.Num(); i++)
+		{
+			const int32 Index = Instances.FindIndex(Ids[i]);
+			if (Index == INDEX_NONE)
+				continue;
+
+			const FSIMeshInstanceData& Instance = Instances.InstanceDatas[Index];
+			const FMeshSocket& MeshSocket = MeshSockets[MeshSockets.IsValidIndex(Instance.MeshIndex) ? Instance.MeshIndex : 0];
+			if (MeshSocket.BoneIndex == INDEX_NONE || MeshSocket.BoneIndex >= Palette.NumBones)
+				continue;
+
+			const FMatrix BoneToWorld = Palette.Sample(Instance.AnimDatas, MeshSocket.BoneIndex, bAnimationBlend, bFrameLerp) * Instance.Transform * InstanceToWorld;
+			OutTransforms[i] = MeshSocket.LocalTransform * FTransform(BoneToWorld);
+			NumFound++;
+		}
+	});
+
+	return NumFound;
+}
+
+void USIMeshComponent::ConsumeRootMotion(TArrayView<const int32> Ids, TArrayView<FTransform> OutDeltas)
+{
+	SCOPE_CYCLE_COUNTER(STAT_SIRootMotion);
+
+	check(Ids.Num() == OutDeltas.Num());
+
+	const USIAnimationComponent* Animation = AnimationComponent.Get();
+	Instances.ConsumeRootMotion(Ids, Animation ? Animation->GetRootMotionTracks() : TArrayView<const FSIRootMotionTrack>(), OutDeltas);
+}
+
+void USIMeshComponent::ApplyRootMotion(const TArray<int32>& Ids)
+{
+	PrepareInstanceWrite();
+
+	TArray<FTransform> Deltas;
+	Deltas.AddUninitialized(Ids.Num());
+	ConsumeRootMotion(Ids, Deltas);
+
+	bool bMoved = false;
+	for (int32 i = 0; i < Ids.Num(); i++)
+	{
+		int32 Index = Instances.FindIndex(Ids[i]);
+		if (Index == INDEX_NONE || Deltas[i].Equals(FTransform::Identity, 0.0f))
+			continue;
+
+		FMatrix& Transform = Instances.InstanceDatas[Index].Transform;
+		Transform = Deltas[i].ToMatrixWithScale() * Transform;
+		bMoved = true;
+	}
+
+	if (bMoved)
+	{
+		Instances.MarkChanged();
+		MarkRenderDynamicDataDirty();
+	}
+}
+
+bool USIMeshComponent::LineTraceInstances(const FVector& Start, const FVector& End, FSIInstanceHit& OutHit) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_SIInstanceHitTests);
+
+	const USIAnimationComponent* Animation = AnimationComponent.Get();
+	if (!Animation || !HitShapes.IsValid() || !HitShapes->IsValid())
+		return false;
+
+	FVector Dir;
+	float Length;
+	(End - Start).ToDirectionAndLength(Dir, Length);
+	if (Length <= 0)
+		return false;
+
+	FSIInstanceHitShapes::FPoseOptions Options;
+	Options.bAnimationBlend = (CVarSkinnedInstancingDisableAnimationBlend.GetValueOnAnyThread() == 0);
+	Options.bFrameLerp = (CVarSkinnedInstancingDisableFrameLerp.GetValueOnAnyThread() == 0);
+	Options.InstanceToWorld = GetInstanceToWorld();
+
+	bool bHit = false;
+	Animation->ReadCPUBonePalette([&](const FSIBonePalette& Palette)
+	{
+		const TSharedPtr<const FSIInstanceGrid, ESPMode::ThreadSafe> Grid = GetInstanceGrid(Options.InstanceToWorld, HitShapes->GetBoundsRadius(Palette));
+		float BestDistance = Length;
+
+		// cells in order along the segment, the walk ends once it passed the closest hit
+		Grid->ForEachAlongSegment(Start, Dir, BestDistance, [&](int32 Index)
+		{
+			// the sphere holds the instance in every baked frame, the segment shrinks with each hit
+			if (FMath::PointDistToSegmentSquared(Grid->GetOrigin(Index), Start, Start + Dir * BestDistance) > FMath::Square(Grid->GetRadius(Index)))
+				return;
+
+			const FSIMeshInstanceData& Instance = Instances.InstanceDatas[Index];
+			float Distance;
+			int32 ShapeIndex;
+			FVector Normal;
+			if (HitShapes->RayCast(Palette, Instance, Options, Start, Dir, BestDistance, Distance, ShapeIndex, Normal))
+			{
+				bHit = true;
+				BestDistance = Distance;
+				OutHit.InstanceId = Instances.Handles[Index];
+				OutHit.BoneName = HitShapes->GetShape(ShapeIndex).BoneName;
+				OutHit.Distance = Distance;
+				OutHit.Location = Start + Dir * Distance;
+				OutHit.Normal = Normal;
+			}
+		});
+	});
+
+	return bHit;
+}
+
+int32 USIMeshComponent::OverlapSphereInstances(const FVector& Center, float Radius, TArray<int32>& OutIds) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_SIInstanceHitTests);
+
+	const USIAnimationComponent* Animation = AnimationComponent.Get();
+	if (!Animation || !HitShapes.IsValid() || !HitShapes->IsValid())
+		return 0;
+
+	FSIInstanceHitShapes::FPoseOptions Options;
+	Options.bAnimationBlend = (CVarSkinnedInstancingDisableAnimationBlend.GetValueOnAnyThread() == 0);
+	Options.bFrameLerp = (CVarSkinnedInstancingDisableFrameLerp.GetValueOnAnyThread() == 0);
+	Options.InstanceToWorld = GetInstanceToWorld();
+
+	const int32 NumIds = OutIds.Num();
+	Animation->ReadCPUBonePalette([&](const FSIBonePalette& Palette)
+	{
+		const TSharedPtr<const FSIInstanceGrid, ESPMode::ThreadSafe> Grid = GetInstanceGrid(Options.InstanceToWorld, HitShapes->GetBoundsRadius(Palette));
+
+		Grid->ForEachInSphere(Center, Radius, [&](int32 Index)
+		{
+			if (FVector::DistSquared(Grid->GetOrigin(Index), Center) > FMath::Square(Radius + Grid->GetRadius(Index)))
+				return;
+
+			if (HitShapes->Overlap(Palette, Instances.InstanceDatas[Index], Options, Center, Radius))
+				OutIds.Add(Instances.Handles[Index]);
+		});
+	});
+
+	return OutIds.Num() - NumIds;
+}
+
+TSharedPtr<const FSIInstanceGrid, ESPMode::ThreadSafe> USIMeshComponent::GetInstanceGrid(const FMatrix& InstanceToWorld, float BoundsRadius) const
+{
+	FScopeLock Lock(&InstanceGridLock);
+
+	// the first query after the instances changed pays for the rebuild
+	if (!InstanceGrid.IsValid() || !InstanceGrid->IsBuiltFor(Instances, InstanceToWorld, BoundsRadius))
+	{
+		TSharedRef<FSIInstanceGrid, ESPMode::ThreadSafe> Grid = MakeShared<FSIInstanceGrid, ESPMode::ThreadSafe>();
+		Grid->Build(Instances, InstanceToWorld, BoundsRadius);
+		InstanceGrid = Grid;
+	}
+
+	return InstanceGrid;
+}
+
+void USIMeshComponent::SaveInstances(TArray<uint8>& OutData) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_SIInstanceSnapshots);
+
+	Instances.SaveSnapshot(OutData);
+}
+
+bool USIMeshComponent::RestoreInstances(TArrayView<const uint8> Data)
+{
+	PrepareInstanceWrite();
+
+	SCOPE_CYCLE_COUNTER(STAT_SIInstanceSnapshots);
+
+	// instances of another component's setup or of re-imported sequences would index past its frames, meshes or states
+	FSIInstanceStore::FSnapshotLimits Limits;
+	if (const USIAnimationComponent* Animation = AnimationComponent.Get())
+	{
+		Limits.bCheckSequences = true;
+		for (const UAnimSequence* Sequence : Animation->AnimSequences)
+		{
+			Limits.SequenceNumFrames.Add(Sequence ? Sequence->GetNumberOfFrames() : 0);
+		}
+	}
+	Limits.NumMeshes = 1 + VariantMeshes.Num();
+	Limits.NumStates = StateMachine ? StateMachine->States.Num() : 0;
+	Limits.NumStateParameters = StateMachine ? StateMachine->Parameters.Num() : 0;
+
+	if (!Instances.LoadSnapshot(Data, Limits))
+	{
+		UE_LOG(LogSkinnedInstancing, Warning, TEXT("%s: RestoreInstances got %d bytes that are not a compatible instance snapshot"),
+			*GetPathName(), Data.Num());
+		return false;
+	}
+
+	// notifies of the replaced instances are stale
+	PendingNotifies.Reset();
+	MarkRenderDynamicDataDirty();
+	return true;
+}
+
+void USIMeshComponent::BeginConcurrentWrites(int32 NumWriters)
+{
+	SI_CHECK_INSTANCE_WRITE();
+
+	FlushInstanceCommands();
+
+	// buffers beyond NumWriters stay empty and keep their memory for the next frame
+	for (int32 Writer = CommandBuffers.Num(); Writer < NumWriters; Writer++)
+	{
+		CommandBuffers.Add(MakeUnique<FSIInstanceCommandBuffer>());
+	}
+}
+
+void USIMeshComponent::FlushInstanceCommands()
+{
+	SI_CHECK_INSTANCE_WRITE();
+
+	int32 NumCommands = 0;
+	for (const TUniquePtr<FSIInstanceCommandBuffer>& Buffer : CommandBuffers)
+	{
+		NumCommands += Buffer->NumCommands();
+	}
+
+	if (NumCommands == 0)
+		return;
+
+	PrepareInstanceWrite();
+
+	SCOPE_CYCLE_COUNTER(STAT_SIFlushInstanceCommands);
+	INC_DWORD_STAT_BY(STAT_SIInstanceCommands, NumCommands);
+
+	SyncStateParameters();
+
+	for (const TUniquePtr<FSIInstanceCommandBuffer>& Buffer : CommandBuffers)
+	{
+		Buffer->AddedIds.Reset(Buffer->NumAdds);
+
+		for (const FSIInstanceCommandBuffer::FCommand& Command : Buffer->Commands)
+		{
+			switch (Command.Type)
+			{
+			case ESIInstanceCommand::Add:
+				Buffer->AddedIds.Add(Instances.Add(Buffer->GetTransform(Command.Arg).ToMatrixWithScale()));
+				break;
+			case ESIInstanceCommand::Remove:
+				Instances.Remove(Command.Id);
+				break;
+			case ESIInstanceCommand::SetTransform:
+				SetInstanceTransform(Command.Id, Buffer->GetTransform(Command.Arg));
+				break;
+			case ESIInstanceCommand::CrossFade:
+				CrossFadeInstance(Command.Id, Command.Arg, Command.Value, Command.bLoop);
+				break;
+			case ESIInstanceCommand::SetStateParameter:
+			{
+				const int32 Index = Instances.FindIndex(Command.Id);
+				if (Index != INDEX_NONE && Instances.StateParameters.IsValidIndex(Command.Arg))
+					Instances.StateParameters[Command.Arg][Index] = Command.Value;
+				break;
+			}
+			}
+		}
+
+		Buffer->Reset();
+	}
+
+	Instances.MarkChanged();
+	MarkRenderDynamicDataDirty();
+}
+
+void USIMeshComponent::SetInstanceMesh(int32 Id, int32 MeshIndex)
+{
+	PrepareInstanceWrite();
+
+	int32 Index = Instances.FindIndex(Id);
+	if (Index == INDEX_NONE)
+		return;
+
+	if (MeshIndex < 0 || MeshIndex > VariantMeshes.Num())
+	{
+		UE_LOG(LogSkinnedInstancing, Warning, TEXT("%s: SetInstanceMesh got mesh index %d with %d variant meshes"),
+			*GetPathName(), MeshIndex, VariantMeshes.Num());
+		return;
+	}
+
+	FSIMeshInstanceData& InstanceData = Instances.InstanceDatas[Index];
+	if (InstanceData.MeshIndex == MeshIndex)
+		return;
+
+	InstanceData.MeshIndex = MeshIndex;
+	Instances.MarkChanged();
+	MarkRenderDynamicDataDirty();
+}
+
+int32 USIMeshComponent::GetInstanceMesh(int32 Id) const
+{
+	int32 Index = Instances.FindIndex(Id);
+	if (Index == INDEX_NONE)
+		return -1;
+
+	return Instances.InstanceDatas[Index].MeshIndex;
+}
+
+void USIMeshComponent::GetRenderMeshes(TArray<USkeletalMesh*>& OutMeshes) const
+{
+	OutMeshes.Reset(VariantMeshes.Num() + 1);
+	OutMeshes.Add(SkeletalMesh);
+
+	for (USkeletalMesh* Variant : VariantMeshes)
+	{
+		const bool bValid = Variant && SkeletalMesh && Variant->Skeleton == SkeletalMesh->Skeleton && Variant->GetResourceForRendering();
+		OutMeshes.Add(bValid ? Variant : SkeletalMesh);
+	}
+}
+
+void USIMeshComponent::PlayOnInstances(const TArray<int32>& Ids, int Sequence, float FadeLength, bool Loop)
+{
+	PrepareInstanceWrite();
+
+	UAnimSequence* AnimSequence = GetSequence(Sequence);
+	if (!AnimSequence)
+	{
+		UE_LOG(LogSkinnedInstancing, Warning, TEXT("%s: PlayOnInstances got unknown sequence %d"), *GetPathName(), Sequence);
+		return;
+	}
+
+	FAnimtionPlayer::Sequence Seq(Sequence, AnimSequence->SequenceLength, AnimSequence->GetNumberOfFrames());
+	for (int32 Id : Ids)
+	{
+		int32 Index = Instances.FindIndex(Id);
+		if (Index != INDEX_NONE)
+		{
+			CrossFadeInstanceAtIndex(Index, Seq, FadeLength, Loop);
+		}
+	}
+
+	MarkRenderDynamicDataDirty();
+}
+
+void USIMeshComponent::GatherInstanceDatas(TArray<FSIMeshInstanceData>& OutInstanceDatas) const
+{
+	if (!Batch.IsValid() || Batch->GetLeader() != this)
+	{
+		OutInstanceDatas.Append(Instances.InstanceDatas);
+		return;
+	}
+
+	int32 NumInstances = 0;
+	for (const USIMeshComponent* Member : Batch->GetMembers())
+		NumInstances += Member->Instances.Num();
+	OutInstanceDatas.Reserve(OutInstanceDatas.Num() + NumInstances);
+
+	const FMatrix WorldToLeader = GetInstanceToWorld().Inverse();
+	for (const USIMeshComponent* Member : Batch->GetMembers())
+	{
+		if (Member == this || (!bInstancesInComponentSpace && !Member->bInstancesInComponentSpace))
+		{
+			OutInstanceDatas.Append(Member->Instances.InstanceDatas);
+			continue;
+		}
+
+		// the member's instances are drawn in the leader's instance space
+		const FMatrix MemberToLeader = Member->GetInstanceToWorld() * WorldToLeader;
+		for (const FSIMeshInstanceData& Instance : Member->Instances.InstanceDatas)
+		{
+			FSIMeshInstanceData& BatchedInstance = OutInstanceDatas.Add_GetRef(Instance);
+			BatchedInstance.Transform = Instance.Transform * MemberToLeader;
+		}
+	}
+}
+
+void USIMeshComponent::UpdateMeshObejctDynamicData()
+{
+	SCOPE_CYCLE_COUNTER(STAT_SIUpdateDynamicData);
+	CSV_SCOPED_TIMING_STAT(SkinnedInstancing, UpdateDynamicData);
+
+	// the task built the back buffer from the same instances, it only needs publishing
+	if (DynamicDataTask.IsValid())
+	{
+		const bool bCurrent = DynamicDataTaskRevision == Instances.GetRevision() && !Batch.IsValid();
+		WaitForDynamicDataTask();
+
+		if (bCurrent && MeshObject)
+		{
+			SentInstanceRevision = DynamicDataTaskRevision;
+			MeshObject->EndUpdateDynamicData();
+			return;
+		}
+
+		INC_DWORD_STAT(STAT_SIDiscardedDynamicDataTasks);
+	}
+
+	SentInstanceRevision = Instances.GetRevision();
+
+	if (MeshObject)
+	{
+		FSIMeshObject::FDynamicData& DynamicData = MeshObject->BeginUpdateDynamicData();
+		GatherInstanceDatas(DynamicData.InstanceDatas);
+		PackInstances(DynamicData.InstanceDatas, AnimationComponent.IsValid() ? AnimationComponent->GetAnimationData() : nullptr, DynamicData.Packed);
+		MeshObject->EndUpdateDynamicData();
+	}
+}
+
+bool USIMeshComponent::CanBuildDynamicDataAsync() const
+{
+	// a batch leader reads the instances of its followers, which keep changing while the task would run
+	return MeshObject && !Batch.IsValid() && CVarSkinnedInstancingAsyncDynamicData.GetValueOnGameThread() != 0
+		&& FApp::ShouldUseThreadingForPerformance();
+}
+
+void USIMeshComponent::BeginDynamicDataTask()
+{
+	check(!DynamicDataTask.IsValid());
+
+	FSIMeshObject::FDynamicData* DynamicData = &MeshObject->BeginUpdateDynamicData();
+	const FSIAnimationData* AnimationData = AnimationComponent.IsValid() ? AnimationComponent->GetAnimationData() : nullptr;
+	const FSIInstanceStore* Store = &Instances;
+	DynamicDataTaskRevision = Instances.GetRevision();
+
+	// only reads the store, every write to the instance datas waits for the task first
+	DynamicDataTask = FFunctionGraphTask::CreateAndDispatchWhenReady([DynamicData, AnimationData, Store]()
+	{
+		SCOPE_CYCLE_COUNTER(STAT_SIBuildDynamicDataTask);
+
+		DynamicData->InstanceDatas.Append(Store->InstanceDatas);
+		PackInstances(DynamicData->InstanceDatas, AnimationData, DynamicData->Packed);
+	}, TStatId(), nullptr, ENamedThreads::AnyThread);
+}
+
+void USIMeshComponent::WaitForDynamicDataTask()
+{
+	if (!DynamicDataTask.IsValid())
+		return;
+
+	if (!DynamicDataTask->IsComplete())
+	{
+		SCOPE_CYCLE_COUNTER(STAT_SIWaitForDynamicDataTask);
+		FTaskGraphInterface::Get().WaitUntilTaskCompletes(DynamicDataTask);
+	}
+
+	DynamicDataTask = nullptr;
+}
+
+void USIMeshComponent::PrepareInstanceWrite()
+{
+	SI_CHECK_INSTANCE_WRITE();
+
+	// the pending task read the instances before this write, it is rebuilt when the data is sent
+	WaitForDynamicDataTask();
+}
+
+int32 USIMeshComponent::GetUpdateRateBand(const FVector& Location, const TArray<FVector>& ViewLocations, bool bOnScreen) const
+{
+	if (!bEnableUpdateRateOptimizations)
+		return 0;
+
+	if (!bOnScreen)
+		return FMath::Clamp(OffScreenUpdateRateBand, 0, GNumUpdateRateBands - 1);
+
+	if (ViewLocations.Num() == 0)
+		return 0;
+
+	float MinDistanceSquared = MAX_flt;
+	for (const FVector& ViewLocation : ViewLocations)
+		MinDistanceSquared = FMath::Min(MinDistanceSquared, FVector::DistSquared(Location, ViewLocation));
+
+	int32 Band = 0;
+	for (int32 i = 0; i < UpdateRateBandDistances.Num() && Band < GNumUpdateRateBands - 1; i++)
+	{
+		if (MinDistanceSquared > FMath::Square(UpdateRateBandDistances[i]))
+			Band = i + 1;
+	}
+	return Band;
+}
+
+void USIMeshComponent::TickInstances(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_SITickInstances);
+	CSV_SCOPED_TIMING_STAT(SkinnedInstancing, TickInstances);
+
+	const int32 NumInstances = Instances.Num();
+	if (NumInstances == 0)
+		return;
+
+	// the budget is shared by every component ticking this frame
+	FInstanceUpdateBudget& Budget = GInstanceUpdateBudget;
+	if (Budget.FrameNumber != GFrameCounter)
+	{
+		Budget = FInstanceUpdateBudget();
+		Budget.FrameNumber = GFrameCounter;
+	}
+
+	const double BudgetSeconds = CVarSkinnedInstancingUpdateBudgetMs.GetValueOnGameThread() * 0.001;
+	const int32 MinUpdates = FMath::Max(CVarSkinnedInstancingMinUpdatesPerComponent.GetValueOnGameThread(), 1);
+	const float MaxPendingTime = CVarSkinnedInstancingMaxPendingUpdateTime.GetValueOnGameThread();
+
+	const TArray<FVector>& ViewLocations = GetWorld()->ViewLocationsRenderedLastFrame;
+	const bool bOnScreen = WasRecentlyRendered();
+
+	// nothing is ever seen in server mode, clocks advance every frame so notifies and queries stay exact
+	const bool bUseUpdateRates = bEnableUpdateRateOptimizations && !SIIsServerMode();
+	const FMatrix InstanceToWorld = GetInstanceToWorld();
+	const uint32 Frame = ++UpdateRateFrameCounter;
+
+	int32 NumPerBand[GNumUpdateRateBands] = {};
+
+	const double StartTime = FPlatformTime::Seconds();
+
+	UpdateQueue.Reset();
+
+	const TArrayView<const FSINotifyTrack> NotifyTracks = GetNotifyTracksToSearch();
+
+	for (int32 Index = 0; Index < NumInstances; Index++)
+	{
+		FSIInstanceUpdateState& State = Instances.UpdateStates[Index];
+		State.PendingDeltaTime += DeltaTime;
+		// only instances the budget held back lose time, regular band skips and hitches keep theirs
+		if (MaxPendingTime > 0 && State.bUpdateDeferred)
+			State.PendingDeltaTime = FMath::Min(State.PendingDeltaTime, MaxPendingTime);
+		if (State.FramesSinceUpdate < MAX_uint16)
+			State.FramesSinceUpdate++;
+
+		const int32 Band = bUseUpdateRates
+			? GetUpdateRateBand(InstanceToWorld.TransformPosition(Instances.InstanceDatas[Index].Transform.GetOrigin()), ViewLocations, bOnScreen) : 0;
+		NumPerBand[Band]++;
+
+		// stagger by handle so every 2^Band frames only a slice of the band updates
+		const uint32 RateMask = (1u << Band) - 1;
+		if (!State.bUpdateDeferred && ((Frame + (uint32)Instances.Handles[Index]) & RateMask) != 0)
+			continue;
+
+		// carried over instances first, the longest waiting ahead so none starves under sustained overload,
+		// then fresh ones near and on-screen first
+		const uint64 WaitKey = MAX_uint16 - State.FramesSinceUpdate;
+		const uint64 Key = State.bUpdateDeferred
+			? (WaitKey << 34) | ((uint64)Band << 32) | (uint32)Index
+			: (1ull << 50) | ((uint64)Band << 48) | (WaitKey << 32) | (uint32)Index;
+		UpdateQueue.Add(Key);
+	}
+
+	if (BudgetSeconds > 0)
+		UpdateQueue.Sort();
+
+	int32 NumUpdated = 0;
+	for (; NumUpdated < UpdateQueue.Num(); NumUpdated++)
+	{
+		// the budget is shared in tick order, every component still works off its longest waiting instances
+		if (BudgetSeconds > 0 && NumUpdated >= MinUpdates && (NumUpdated & 15) == 0
+			&& Budget.UsedSeconds + (FPlatformTime::Seconds() - StartTime) > BudgetSeconds)
+		{
+			break;
+		}
+
+		const int32 Index = (int32)(UpdateQueue[NumUpdated] & MAX_uint32);
+		FSIInstanceUpdateState& State = Instances.UpdateStates[Index];
+
+		Instances.TickPlayer(Index, State.PendingDeltaTime, NotifyTracks, PendingNotifies);
+		Instances.UpdateAnimData(Index);
+
+		Budget.MaxLatency = FMath::Max<uint32>(Budget.MaxLatency, State.FramesSinceUpdate);
+		Budget.LatencySum += State.FramesSinceUpdate;
+
+		State.PendingDeltaTime = 0;
+		State.FramesSinceUpdate = 0;
+		State.bUpdateDeferred = false;
+	}
+
+	// out of budget, carry the rest over to the next frame
+	const int32 NumDeferred = UpdateQueue.Num() - NumUpdated;
+	for (int32 QueueIndex = NumUpdated; QueueIndex < UpdateQueue.Num(); QueueIndex++)
+	{
+		const int32 Index = (int32)(UpdateQueue[QueueIndex] & MAX_uint32);
+		Instances.UpdateStates[Index].bUpdateDeferred = true;
+	}
+
+	const double ElapsedSeconds = FPlatformTime::Seconds() - StartTime;
+	const double SavedMs = NumUpdated > 0 ? ElapsedSeconds * 1000.0 / NumUpdated * (NumInstances - NumUpdated) : 0.0;
+
+	Budget.UsedSeconds += ElapsedSeconds;
+	Budget.NumUpdated += NumUpdated;
+
+	INC_DWORD_STAT_BY(STAT_SIUpdateRateBand0, NumPerBand[0]);
+	INC_DWORD_STAT_BY(STAT_SIUpdateRateBand1, NumPerBand[1]);
+	INC_DWORD_STAT_BY(STAT_SIUpdateRateBand2, NumPerBand[2]);
+	INC_DWORD_STAT_BY(STAT_SIUpdateRateBand3, NumPerBand[3]);
+	INC_FLOAT_STAT_BY(STAT_SIUpdateRateTimeSaved, (float)SavedMs);
+	INC_DWORD_STAT_BY(STAT_SIUpdateBudgetOverruns, NumDeferred > 0 ? 1 : 0);
+	INC_DWORD_STAT_BY(STAT_SIDeferredUpdates, NumDeferred);
+	SET_DWORD_STAT(STAT_SIMaxUpdateLatency, Budget.MaxLatency);
+	SET_FLOAT_STAT(STAT_SIAvgUpdateLatency, Budget.NumUpdated > 0 ? (float)Budget.LatencySum / Budget.NumUpdated : 0.0f);
+}
+
+TArrayView<const FSINotifyTrack> USIMeshComponent::GetNotifyTracksToSearch() const
+{
+	const USIAnimationComponent* Animation = AnimationComponent.Get();
+	if (!Animation || !OnInstanceNotifies.IsBound())
+		return TArrayView<const FSINotifyTrack>();
+
+	return Animation->GetNotifyTracks();
+}
+
+void USIMeshComponent::DispatchInstanceNotifies()
+{
+	if (PendingNotifies.Num() == 0)
+		return;
+
+	INC_DWORD_STAT_BY(STAT_SIInstanceNotifies, PendingNotifies.Num());
+
+	// handlers may cross fade instances, which can add notifies for the next broadcast
+	TArray<FSIInstanceNotify> Notifies = MoveTemp(PendingNotifies);
+	PendingNotifies.Reset();
+	OnInstanceNotifies.Broadcast(this, Notifies);
+
+	if (PendingNotifies.Num() == 0)
+	{
+		// hand the allocation back for the next frame
+		Notifies.Reset();
+		PendingNotifies = MoveTemp(Notifies);
+	}
+}
+
+void USIMeshComponent::SetStateMachine(USIAnimStateMachine* NewStateMachine)
+{
+	if (StateMachine == NewStateMachine)
+		return;
+
+	// carry parameter columns over by name
+	TArray<TArray<float>> OldParameters = MoveTemp(Instances.StateParameters);
+	Instances.StateParameters.Reset();
+	Instances.SetNumStateParameters(NewStateMachine ? NewStateMachine->Parameters.Num() : 0);
+
+	for (int32 Parameter = 0; StateMachine && NewStateMachine && Parameter < StateMachine->Parameters.Num(); Parameter++)
+	{
+		const int32 NewParameter = NewStateMachine->FindParameter(StateMachine->Parameters[Parameter]);
+		if (NewParameter != INDEX_NONE && OldParameters.IsValidIndex(Parameter))
+			Instances.StateParameters[NewParameter] = MoveTemp(OldParameters[Parameter]);
+	}
+
+	StateMachine = NewStateMachine;
+	for (int32& State : Instances.AnimStates)
+	{
+		State = INDEX_NONE;
+	}
+}
+
+void USIMeshComponent::SetInstanceStateParameters(int32 Parameter, TArrayView<const int32> Ids, TArrayView<const float> Values)
+{
+	SI_CHECK_INSTANCE_WRITE();
+
+	check(Ids.Num() == Values.Num());
+
+	SyncStateParameters();
+	if (!Instances.StateParameters.IsValidIndex(Parameter))
+		return;
+
+	TArray<float>& Column = Instances.StateParameters[Parameter];
+	for (int32 i = 0; i < Ids.Num(); i++)
+	{
+		const int32 Index = Instances.FindIndex(Ids[i]);
+		if (Index != INDEX_NONE)
+			Column[Index] = Values[i];
+	}
+}
+
+void USIMeshComponent::SetInstanceStateParameter(int32 Id, FName Parameter, float Value)
+{
+	if (!StateMachine)
+		return;
+
+	SetInstanceStateParameters(StateMachine->FindParameter(Parameter), MakeArrayView(&Id, 1), MakeArrayView(&Value, 1));
+}
+
+int32 USIMeshComponent::GetInstanceState(int32 Id) const
+{
+	const int32 Index = Instances.FindIndex(Id);
+	return Index != INDEX_NONE ? Instances.AnimStates[Index] : INDEX_NONE;
+}
+
+void USIMeshComponent::SyncStateParameters()
+{
+	// the asset may have been edited since the columns were made
+	const int32 NumParameters = StateMachine ? StateMachine->Parameters.Num() : 0;
+	if (Instances.StateParameters.Num() != NumParameters)
+		Instances.SetNumStateParameters(NumParameters);
+}
+
+void USIMeshComponent::EvaluateStateMachine()
+{
+	if (!StateMachine || Instances.Num() == 0)
+		return;
+
+	SCOPE_CYCLE_COUNTER(STAT_SIEvaluateStateMachine);
+
+	SyncStateParameters();
+
+	const int32 NumChanges = StateMachine->Evaluate(Instances, StateChanges);
+	if (NumChanges == 0)
+		return;
+
+	INC_DWORD_STAT_BY(STAT_SIStateTransitions, NumChanges);
+
+	// the parallel pass only decides, starting sequences touches the notify buffer and stays on this thread
+	for (int32 Index = 0; Index < StateChanges.Num(); Index++)
+	{
+		const USIAnimStateMachine::FStateChange& Change = StateChanges[Index];
+		if (Change.State == INDEX_NONE)
+			continue;
+
+		Instances.AnimStates[Index] = Change.State;
+
+		const FSIAnimState& State = StateMachine->States[Change.State];
+		UAnimSequence* AnimSequence = GetSequence(State.Sequence);
+		if (!AnimSequence)
+			continue;
+
+		FAnimtionPlayer::Sequence Seq(State.Sequence, AnimSequence->SequenceLength, AnimSequence->GetNumberOfFrames());
+		CrossFadeInstanceAtIndex(Index, Seq, Change.FadeTime, State.bLoop);
+	}
+
+	MarkRenderDynamicDataDirty();
+}
+
+int32 USIMeshComponent::AddInstance(const FTransform & Transform)
+{
+	PrepareInstanceWrite();
+
+	int32 Id = Instances.Add(Transform.ToMatrixWithScale());
+
+	MarkRenderDynamicDataDirty();
+
+	return Id;
+}
+
+void USIMeshComponent::RemoveInstance(int Id)
+{
+	PrepareInstanceWrite();
+
+	if (Instances.Remove(Id))
+	{
+		MarkRenderDynamicDataDirty();
+	}
+}
+
+void USIMeshComponent::SetInstanceTransform(int Id, const FTransform& Transform)
+{
+	PrepareInstanceWrite();
+
+	int32 Index = Instances.FindIndex(Id);
+	if (Index != INDEX_NONE)
+	{
+		FMatrix NewTransform = Transform.ToMatrixWithScale();
+		FMatrix& InstanceTransform = Instances.InstanceDatas[Index].Transform;
+		if (!InstanceTransform.Equals(NewTransform, 0.0f))
+		{
+			InstanceTransform = NewTransform;
+			Instances.MarkChanged();
+		}
+	}
+}
+
+void USIMeshComponent::GetResourceSizeEx(FResourceSizeEx& CumulativeResourceSize)
+{
+	Super::GetResourceSizeEx(CumulativeResourceSize);
+
+	CumulativeResourceSize.AddDedicatedSystemMemoryBytes(Instances.GetAllocatedSize());
+	for (const TUniquePtr<FSIInstanceCommandBuffer>& Buffer : CommandBuffers)
+	{
+		CumulativeResourceSize.AddDedicatedSystemMemoryBytes(sizeof(FSIInstanceCommandBuffer) + Buffer->GetAllocatedSize());
+	}
+
+	if (MeshObject)
+	{
+		CumulativeResourceSize.AddDedicatedSystemMemoryBytes(MeshObject->GetSystemMemorySize());
+		CumulativeResourceSize.AddDedicatedVideoMemoryBytes(MeshObject->GetVideoMemorySize());
+	}
+}
+
+UAnimSequence * USIMeshComponent::GetSequence(int Id)
+{
+	if (AnimationComponent.IsValid())
+	{
+		return AnimationComponent->GetSequence(Id);
+	}
+
+	return nullptr;
+}
+
+FSIMeshInstanceData* USIMeshComponent::GetInstanceData(int Id)
+{
+	PrepareInstanceWrite();
+
+	int32 Index = Instances.FindIndex(Id);
+	if (Index == INDEX_NONE)
+		return nullptr;
+
+	Instances.MarkChanged();
+	return &Instances.InstanceDatas[Index];
+}
+
+void USIMeshComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction * ThisTickFunction)
+{
+	// Tick ActorComponent first.
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+	WaitForDynamicDataTask();
+	FlushInstanceCommands();
+	EvaluateStateMachine();
+	TickInstances(DeltaTime);
+	DispatchInstanceNotifies();
+
+	// no bounds or render data to keep up to date in server mode
+	if (SIIsServerMode())
+		return;
+
+	const uint32 Revision = Instances.GetRevision();
+	if (Revision != BoundsInstanceRevision)
+	{
+		BoundsInstanceRevision = Revision;
+
+		// the leader's bounds cover the whole batch, it recomputes them once after every member ticked
+		if (Batch.IsValid())
+		{
+			Batch->GetLeader()->OnBatchMembersChanged();
+		}
+
+		if (!Batch.IsValid() || IsBatchFollower())
+		{
+			UpdateBounds();
+			MarkRenderTransformDirty();
+		}
+	}
+}
+
+void USIMeshComponent::RegisterComponentTickFunctions(bool bRegister)
+{
+	Super::RegisterComponentTickFunctions(bRegister);
+
+	if (bRegister)
+	{
+		if (SetupActorComponentTickFunction(&DynamicDataTickFunction))
+		{
+			DynamicDataTickFunction.Target = this;
+			DynamicDataTickFunction.AddPrerequisite(this, PrimaryComponentTick);
+		}
+	}
+	else if (DynamicDataTickFunction.IsTickFunctionRegistered())
+	{
+		DynamicDataTickFunction.UnRegisterTickFunction();
+	}
+}
+
+void USIMeshComponent::TickDynamicData()
+{
+	// the leader sends the instances of followers, nothing is sent in server mode
+	if (SIIsServerMode() || IsBatchFollower())
+		return;
+
+	const bool bBatchChanged = bBatchMembersDirty;
+	if (bBatchChanged)
+	{
+		bBatchMembersDirty = false;
+		UpdateBounds();
+		MarkRenderTransformDirty();
+	}
+
+	// nothing moved or changed frame, the renderer still has this data
+	if (!bBatchChanged && Instances.GetRevision() == SentInstanceRevision)
+	{
+		INC_DWORD_STAT(STAT_SISkippedDynamicDataSends);
+		return;
+	}
+
+	// overlaps the end of frame work, the send only publishes the result
+	if (CanBuildDynamicDataAsync() && !DynamicDataTask.IsValid())
+		BeginDynamicDataTask();
+
+	MarkRenderDynamicDataDirty();
+}
+
+void FSIMeshDynamicDataTickFunction::ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent)
+{
+	if (Target && !Target->IsPendingKillOrUnreachable() && Target->IsRegistered())
+	{
+		Target->TickDynamicData();
+	}
+}
+
+FString FSIMeshDynamicDataTickFunction::DiagnosticMessage()
+{
+	return Target ? Target->GetFullName() + TEXT("[TickDynamicData]") : TEXT("<NULL>[TickDynamicData]");
 }
 
 #pragma optimize( "", on )
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "Stats/Stats.h"
+#include "ProfilingDebugging/CsvProfiler.h"
+
+DECLARE_STATS_GROUP(TEXT("SkinnedInstancing"), STATGROUP_SkinnedInstancing, STATCAT_Advanced);
+
+CSV_DECLARE_CATEGORY_EXTERN(SkinnedInstancing);
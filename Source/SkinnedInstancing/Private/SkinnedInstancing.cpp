@@ -4,9 +4,35 @@
 #include "Misc/Paths.h"
 #include "IPluginManager.h"
 #include "ShaderCore.h"
+#include "SIStats.h"
 
 #define LOCTEXT_NAMESPACE "FSkinnedInstancingModule"
 
+DEFINE_LOG_CATEGORY(LogSkinnedInstancing);
+
+CSV_DEFINE_CATEGORY(SkinnedInstancing, true);
+
+static TAutoConsoleVariable<int32> CVarSkinnedInstancingServerMode(
+	TEXT("r.SkinnedInstancing.ServerMode"),
+	0,
+	TEXT("Run components without render resources even where rendering is possible, e.g. for headless simulation. Always on where nothing can render. Cannot be changed at runtime."),
+	ECVF_ReadOnly);
+
+static bool GSIClientModeOverride = false;
+
+bool SIIsServerMode()
+{
+	if (CVarSkinnedInstancingServerMode.GetValueOnAnyThread() != 0 || IsRunningDedicatedServer())
+		return true;
+	return !FApp::CanEverRender() && !GSIClientModeOverride;
+}
+
+void SISetClientModeOverride(bool bOverride)
+{
+	check(IsInGameThread());
+	GSIClientModeOverride = bOverride;
+}
+
 void FSkinnedInstancingModule::StartupModule()
 {
 	// This code will execute after your module is loaded into memory; the exact timing is specified in the .uplugin file per-module
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "SIAnimStateMachine.generated.h"
+
+class FSIInstanceStore;
+
+UENUM(BlueprintType)
+enum class ESIAnimConditionOp : uint8
+{
+	Less,
+	Greater,
+	Equal,
+	NotEqual,
+	/** The parameter is used as a bool, any non zero value is true. */
+	IsTrue,
+	IsFalse,
+};
+
+USTRUCT(BlueprintType)
+struct FSIAnimCondition
+{
+	GENERATED_USTRUCT_BODY()
+
+	/** One of the state machine's parameters. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing")
+	FName Parameter;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing")
+	ESIAnimConditionOp Op = ESIAnimConditionOp::IsTrue;
+
+	/** Compared against by Less, Greater, Equal and NotEqual. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing")
+	float Value = 0;
+};
+
+USTRUCT(BlueprintType)
+struct FSIAnimTransition
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing")
+	FName TargetState;
+
+	/** Cross fade length in seconds. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing", meta = (ClampMin = "0"))
+	float FadeTime = 0.2f;
+
+	/** Only leave once the sequence of the state is within FadeTime of its end. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing")
+	bool bWaitForSequenceEnd = false;
+
+	/** All of them must hold, a transition without conditions is taken as soon as it is allowed. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing")
+	TArray<FSIAnimCondition> Conditions;
+};
+
+USTRUCT(BlueprintType)
+struct FSIAnimState
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing")
+	FName Name;
+
+	/** Index into the AnimSequences of the animation component. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing", meta = (ClampMin = "0"))
+	int32 Sequence = 0;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing")
+	bool bLoop = true;
+
+	/** Checked in order, the first one whose conditions hold is taken. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing")
+	TArray<FSIAnimTransition> Transitions;
+};
+
+/**
+ * Animation states of instances, evaluated for every instance of a mesh component in one parallel pass. Gameplay only
+ * writes the per instance parameters, see USIMeshComponent::SetInstanceStateParameters. The first state is the entry state.
+ */
+UCLASS(BlueprintType)
+class SKINNEDINSTANCING_API USIAnimStateMachine : public UDataAsset
+{
+	GENERATED_UCLASS_BODY()
+
+	/** Float parameters each instance has, bools are stored as 0 and 1. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing")
+	TArray<FName> Parameters;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing")
+	TArray<FSIAnimState> States;
+
+public:
+	/** Resolves names into the flat tables Evaluate reads. Called on load and edit, call it after changing the asset at runtime. */
+	void Compile();
+
+	int32 GetNumStates() const { return CompiledStates.Num(); }
+
+	int32 FindParameter(FName Parameter) const { return Parameters.IndexOfByKey(Parameter); }
+
+	struct FStateChange
+	{
+		/** INDEX_NONE when the instance stays in its state. */
+		int32 State = INDEX_NONE;
+		float FadeTime = 0;
+	};
+
+	/**
+	 * Writes the state change of every instance into OutChanges, indexed like the store. Instances without a state
+	 * enter the first one. Reads the players and parameter columns of the store in parallel chunks, changes nothing.
+	 * Returns the number of instances that change state.
+	 */
+	int32 Evaluate(const FSIInstanceStore& Instances, TArray<FStateChange>& OutChanges) const;
+
+	//~ Begin UObject Interface
+	virtual void PostLoad() override;
+#if WITH_EDITOR
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif
+	//~ End UObject Interface
+
+private:
+	struct FCompiledCondition
+	{
+		int32 Parameter;
+		ESIAnimConditionOp Op;
+		float Value;
+	};
+
+	struct FCompiledTransition
+	{
+		int32 TargetState;
+		float FadeTime;
+		bool bWaitForSequenceEnd;
+		int32 FirstCondition;
+		int32 NumConditions;
+	};
+
+	struct FCompiledState
+	{
+		int32 FirstTransition;
+		int32 NumTransitions;
+	};
+
+	const FCompiledTransition* FindTransition(int32 State, const FSIInstanceStore& Instances, int32 Index) const;
+
+	TArray<FCompiledState> CompiledStates;
+	TArray<FCompiledTransition> CompiledTransitions;
+	TArray<FCompiledCondition> CompiledConditions;
+};
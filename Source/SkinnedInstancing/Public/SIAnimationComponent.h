@@ -4,9 +4,25 @@
 #include "Components/SceneComponent.h"
 #include "Animation/Skeleton.h"
 #include "Animation/AnimSequence.h"
+#include "SIAnimationPlayer.h"
 #include "SIAnimationComponent.generated.h"
 
 class FSIAnimationData;
+struct FSIBonePalette;
+
+USTRUCT(BlueprintType)
+struct FSIAnimationPaletteTier
+{
+	GENERATED_USTRUCT_BODY()
+
+	/** Keep every Nth baked frame, e.g. 2 for a half rate copy of each sequence. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing", meta = (ClampMin = "2"))
+	int32 RateDivisor = 2;
+
+	/** First mesh LOD that reads this tier. Frame lerp is disabled for these instances. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing", meta = (ClampMin = "1"))
+	int32 MinLOD = 1;
+};
 
 UCLASS(hidecategories = (Object, LOD), meta = (BlueprintSpawnableComponent), ClassGroup = Rendering)
 class SKINNEDINSTANCING_API USIAnimationComponent : public USceneComponent
@@ -25,17 +41,54 @@ class SKINNEDINSTANCING_API USIAnimationComponent : public USceneComponent
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing")
 	FName RetargetSource;
 
+	/** Lower sample rate copies of every sequence, read by distant LODs. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing")
+	TArray<FSIAnimationPaletteTier> PaletteTiers;
+
+	/**
+	 * Keep a CPU copy of the full rate palette so bone and socket transforms of instances can be queried and instances
+	 * can be hit tested. Baked without render state in server mode, see SIIsServerMode.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing")
+	bool bKeepCPUBonePalette;
+
+	/** Quantize the CPU palette to rotation, translation and uniform scale, 24 instead of 64 bytes per bone and frame. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing")
+	bool bCompactCPUBonePalette;
+
 	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
 	UAnimSequence* GetSequence(int Id);
 
+	/** Size in bytes of the baked bone palette for a tier, 0 is the full rate palette. */
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	int32 GetPaletteTierMemorySize(int Tier) const;
+
 public:
 	virtual ~USIAnimationComponent();
 
 	const FSIAnimationData* GetAnimationData() const { return AnimationData; }
 
+	/**
+	 * Calls Func with the CPU palette held under a read lock, so queries can run on any thread while the palette
+	 * is rebaked. Returns false without calling Func when bKeepCPUBonePalette is off or nothing is baked yet.
+	 */
+	bool ReadCPUBonePalette(TFunctionRef<void(const FSIBonePalette&)> Func) const;
+
+	/** Root motion of every sequence, indexed like AnimSequences. Baked on register, also without render state. */
+	TArrayView<const FSIRootMotionTrack> GetRootMotionTracks() const { return RootMotionTracks; }
+
+	/** Notifies of every sequence sorted by trigger time, indexed like AnimSequences. Baked on register. */
+	TArrayView<const FSINotifyTrack> GetNotifyTracks() const { return NotifyTracks; }
+
+	//~ Begin UObject Interface
+	virtual void GetResourceSizeEx(FResourceSizeEx& CumulativeResourceSize) override;
+	//~ End UObject Interface
+
 	//~ Override Functions
 protected:
 	//~ Begin UActorComponent Interface
+	virtual void OnRegister() override;
+	virtual void OnUnregister() override;
 	virtual void BeginPlay() override;
 	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 	virtual void CreateRenderState_Concurrent() override;
@@ -45,7 +98,21 @@ protected:
 
 private:
 	void CreateAnimationData();
+	void CreateCPUBonePalette();
+	void GetExistingSequences(TArray<UAnimSequence*>& OutSequences) const;
+	void InitBoneContainer(struct FBoneContainer& OutBoneContainer) const;
+	void BakeSequence(TArray<FMatrix>& BoneMatrices, TArray<FBox>& FrameBoneBounds, int SequenceOffset,
+		UAnimSequence* AnimSequence, const struct FBoneContainer& BoneContainer);
+	void SetCPUBonePalette(const TSharedPtr<FSIBonePalette, ESPMode::ThreadSafe>& NewPalette);
+	void BakeRootMotion();
+	void BakeNotifies();
 
 private:
 	FSIAnimationData* AnimationData;
+
+	mutable FRWLock CPUBonePaletteLock;
+	TSharedPtr<FSIBonePalette, ESPMode::ThreadSafe> CPUBonePalette;
+
+	TArray<FSIRootMotionTrack> RootMotionTracks;
+	TArray<FSINotifyTrack> NotifyTracks;
 };
@@ -1,5 +1,45 @@
 #pragma once
 #include "CoreMinimal.h"
+#include "Templates/Atomic.h"
+#include "SIInstanceStore.h"
+
+struct FSIAnimationPaletteTier;
+
+/** Bone of the compact CPU palette, the rotation is quantized to 16 bits per component and the scale reduced to its largest axis. */
+struct FSICompactBone
+{
+	int16 Rotation[4];
+	FVector Translation;
+	float Scale;
+
+	void Encode(const FMatrix& Bone);
+	FMatrix Decode() const;
+};
+
+/** CPU copy of the full rate palette, sampled by bone and socket queries the way the vertex factory samples the GPU copy. */
+struct SKINNEDINSTANCING_API FSIBonePalette
+{
+	int32 NumBones = 0;
+	TArray<uint32> SequenceOffset;
+	TArray<FMatrix> Matrices;
+	/** Replaces Matrices once the palette is compacted, 24 instead of 64 bytes per bone and frame. */
+	TArray<FSICompactBone> CompactBones;
+	/** Furthest any bone gets from the component origin in any frame. */
+	float MaxBoneDistance = 0;
+
+	/** Call after filling Matrices. */
+	void UpdateMaxBoneDistance();
+
+	/** Moves Matrices into CompactBones. */
+	void Compact();
+
+	FMatrix GetBone(uint32 Offset) const { return CompactBones.Num() > 0 ? CompactBones[Offset].Decode() : Matrices[Offset]; }
+
+	/** Component space transform of a skeleton bone, with both layers, frame lerp and blend weight applied. */
+	FMatrix Sample(const FSIMeshInstanceData::FAnimData* AnimDatas, int32 BoneIndex, bool bAnimationBlend, bool bFrameLerp) const;
+
+	SIZE_T GetAllocatedSize() const { return SequenceOffset.GetAllocatedSize() + Matrices.GetAllocatedSize() + CompactBones.GetAllocatedSize(); }
+};
 
 class FSIAnimationData : public FDeferredCleanupInterface
 {
@@ -8,7 +48,16 @@ public:
 
 	virtual ~FSIAnimationData();
 
-	void Init(int InNumBones, const TArray<int>& InSequenceLength);
+	struct FPaletteTier
+	{
+		uint32 RateDivisor;
+		int32 MinLOD;
+		uint32 NumMatrices;
+		TArray<uint32> SequenceOffset;
+		TArray<uint32> SequenceLength;
+	};
+
+	void Init(int InNumBones, const TArray<int>& InSequenceLength, const TArray<FSIAnimationPaletteTier>& InPaletteTiers);
 
 	void Update(TArray<FMatrix>* ReferenceToLocalMatrices);
 
@@ -20,9 +69,38 @@ public:
 
 	uint32 GetNumBones() const { return NumBones; }
 
-	const TArray<uint32>& GetSequenceOffset() const { return SequenceOffset; }
+	/** Unique per Init, unlike the address it is never reused by another palette. */
+	uint32 GetGeneration() const { return Generation; }
+
+	const TArray<uint32>& GetSequenceOffset() const { return PaletteTiers[0].SequenceOffset; }
+
+	const TArray<uint32>& GetSequenceLength() const { return PaletteTiers[0].SequenceLength; }
+
+	int32 GetNumPaletteTiers() const { return PaletteTiers.Num(); }
+
+	const FPaletteTier& GetPaletteTier(int32 Tier) const { return PaletteTiers[Tier]; }
+
+	/** Coarsest tier allowed for a mesh LOD, 0 when the LOD reads the full rate palette. */
+	int32 GetPaletteTierForLOD(int32 LODIndex) const;
+
+	uint32 GetNumMatrices() const;
 
-	const TArray<uint32>& GetSequenceLength() const { return SequenceLength; }
+	SIZE_T GetPaletteTierMemorySize(int32 Tier) const;
+
+	/** CPU side size of the palette description, the palette itself is GetBufferSize(). */
+	SIZE_T GetResourceSize() const;
+	/** Bytes of the uploaded palette buffer, 0 until the upload ran on the render thread. Any thread. */
+	uint32 GetBufferSize() const { return BufferBytes; }
+
+	/** Bone position boxes of every full rate frame, plus the reference pose box they are compared against. */
+	void SetBoneBounds(TArray<FBox>&& InFrameBoneBounds, const FBox& InRefPoseBoneBounds);
+
+	bool HasBoneBounds() const { return FrameBoneBounds.Num() > 0; }
+
+	const FBox& GetRefPoseBoneBounds() const { return RefPoseBoneBounds; }
+
+	/** Box around the bones of the frames an instance plays, on both layers. */
+	FBox GetPlayedBoneBounds(const FSIMeshInstanceData::FAnimData* AnimDatas) const;
 
 private:
 	void UpdateData_RenderThread(TArray<FMatrix>* InReferenceToLocalMatrices);
@@ -30,9 +108,12 @@ private:
 
 private:
 	uint32 NumBones;
-	TArray<uint32> SequenceOffset;
-	TArray<uint32> SequenceLength;
+	uint32 Generation = 0;
+	TArray<FPaletteTier> PaletteTiers;
+	TArray<FBox> FrameBoneBounds;
+	FBox RefPoseBoneBounds;
 private:
 	FVertexBufferRHIRef VertexBufferRHI;
 	FShaderResourceViewRHIRef VertexBufferSRV;
+	TAtomic<uint32> BufferBytes { 0 };
 };
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Algo/BinarySearch.h"
+
+/**
+ * Root bone motion of a sequence relative to its first frame, baked at the full rate frames so instances can be moved
+ * without evaluating a pose. Empty for sequences without root motion enabled.
+ */
+struct SKINNEDINSTANCING_API FSIRootMotionTrack
+{
+	float Length = 0;
+	float Interval = 0;
+	TArray<FVector> Translations;
+	TArray<FQuat> Rotations;
+
+	bool HasMotion() const { return Translations.Num() > 0; }
+
+	/** Root transform at Time, relative to the first frame. */
+	FTransform Evaluate(float Time) const;
+
+	/** Motion over the PlayedTime leading up to EndTime, wrapping through the end of the sequence when looping. */
+	FTransform Extract(float EndTime, float PlayedTime, bool bLoop) const;
+
+	SIZE_T GetAllocatedSize() const { return Translations.GetAllocatedSize() + Rotations.GetAllocatedSize(); }
+};
+
+/** Notify trigger times of a sequence in ascending order, the notify names are at the same index. */
+struct SKINNEDINSTANCING_API FSINotifyTrack
+{
+	float Length = 0;
+	TArray<float> Times;
+	TArray<FName> Names;
+
+	/**
+	 * Calls Func with the index of every notify in (StartTime, StartTime + DeltaTime], wrapping through the end of the
+	 * sequence when looping. A notify on the first frame fires when a loop wraps onto it.
+	 */
+	template <typename FuncType>
+	void ForEachCrossed(float StartTime, float DeltaTime, bool bLoop, FuncType&& Func) const
+	{
+		if (Times.Num() == 0 || DeltaTime <= 0)
+			return;
+
+		float Start = StartTime;
+		float Remaining = DeltaTime;
+		bool bWrapped = false;
+		while (Remaining > 0)
+		{
+			const float End = FMath::Min(Start + Remaining, Length);
+			const int32 First = bWrapped ? Algo::LowerBound(Times, Start) : Algo::UpperBound(Times, Start);
+			const int32 Last = Algo::UpperBound(Times, End);
+			for (int32 NotifyIndex = First; NotifyIndex < Last; NotifyIndex++)
+			{
+				Func(NotifyIndex);
+			}
+
+			Remaining -= End - Start;
+			if (!bLoop || Length <= 0)
+				break;
+
+			Start = 0;
+			bWrapped = true;
+		}
+	}
+
+	SIZE_T GetAllocatedSize() const { return Times.GetAllocatedSize() + Names.GetAllocatedSize(); }
+};
+
+class FAnimtionPlayer
+{
+public:
+	struct Sequence
+	{
+		int Id;
+		float Time;
+		float Length;
+		int NumFrames;
+		/** Time actually played since root motion was last consumed, not wrapped by looping. */
+		float PlayedTime;
+
+		Sequence() : Id(-1), Time(0), Length(0), NumFrames(0), PlayedTime(0) {}
+		Sequence(int Id, float Length, int NumFrames) : Id(Id), Time(0), Length(Length), NumFrames(NumFrames), PlayedTime(0) {}
+
+		void Tick(float DeltaTime, bool Loop = false)
+		{
+			const float PrevTime = Time;
+			Time += DeltaTime;
+			if (Loop && Length > 0)
+			{
+				Time = FMath::Fmod(Time, Length);
+				PlayedTime += DeltaTime;
+			}
+			else
+			{
+				Time = FMath::Min(Time, Length);
+				PlayedTime += FMath::Max(Time - PrevTime, 0.0f);
+			}
+		}
+	};
+
+public:
+	const Sequence& GetCurrentSeq() const { return CurrentSeq; }
+	const Sequence& GetNextSeq() const { return NextSeq; }
+	float GetFadeTime() const { return FadeTime; }
+	float GetFadeLength() const { return FadeLength; }
+	bool IsLooping() const { return IsLoop; }
+	bool IsNextLooping() const { return NextIsLoop; }
+
+	/** Called once the root motion of the played time was handed out. */
+	void ResetPlayedTime() { CurrentSeq.PlayedTime = NextSeq.PlayedTime = 0; }
+
+public:
+	void Tick(float DeltaTime)
+	{
+		CurrentSeq.Tick(DeltaTime, IsLoop);
+
+		if (FadeTime > 0 && FadeLength > 0)
+		{
+			FadeTime = FMath::Max(FadeTime - DeltaTime, 0.0f);
+
+			NextSeq.Tick(DeltaTime, NextIsLoop);
+
+			if (FadeTime <= 0)
+			{
+				CurrentSeq = NextSeq;
+				IsLoop = NextIsLoop;
+			}
+		}
+	}
+
+	void Play(const Sequence& Seq, bool Loop)
+	{
+		IsLoop = NextIsLoop = Loop;
+		CurrentSeq = NextSeq = Seq;
+		FadeLength = FadeTime = 0;
+	}
+
+	void CrossFade(const Sequence& Seq, bool Loop, float Fade)
+	{
+		if (CurrentSeq.Id < 0 || Fade <= 0)
+		{
+			Play(Seq, Loop);
+			return;
+		}
+		NextSeq = Seq;
+		NextIsLoop = Loop;
+		FadeLength = FadeTime = Fade;
+	}
+
+private:
+	bool IsLoop = false;
+	bool NextIsLoop = false;
+	float FadeLength = 0;
+
+private:
+	Sequence CurrentSeq;
+	Sequence NextSeq;
+	float FadeTime = 0;
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Templates/Atomic.h"
+#include "HAL/PlatformTLS.h"
+
+/** Set by SkinnedInstancing.Build.cs, validates that worker threads only write instances through command buffers. */
+#ifndef SI_CHECK_CONCURRENT_WRITES
+#define SI_CHECK_CONCURRENT_WRITES 0
+#endif
+
+#if SI_CHECK_CONCURRENT_WRITES
+#define SI_CHECK_INSTANCE_WRITE() checkf(IsInGameThread(), TEXT("Instances can only be written on the game thread, record writes from other threads in a FSIInstanceCommandBuffer"))
+#else
+#define SI_CHECK_INSTANCE_WRITE()
+#endif
+
+enum class ESIInstanceCommand : uint8
+{
+	Add,
+	Remove,
+	SetTransform,
+	CrossFade,
+	SetStateParameter,
+};
+
+/**
+ * Instance writes recorded by one worker, see USIMeshComponent::BeginConcurrentWrites. Nothing is shared between
+ * buffers, so each writer records without locks. The component applies the buffers in writer order and every buffer
+ * in the order it was recorded, the result does not depend on how the writers were scheduled.
+ */
+class SKINNEDINSTANCING_API FSIInstanceCommandBuffer
+{
+public:
+	struct FCommand
+	{
+		ESIInstanceCommand Type;
+		bool bLoop;
+		/** Instance id, the add index for adds. */
+		int32 Id;
+		/** Transform index, sequence or state parameter. */
+		int32 Arg;
+		/** Fade length or state parameter value. */
+		float Value;
+	};
+
+	/** Returns the add index, GetAddedIds holds the id of the instance once the buffer was applied. */
+	int32 Add(const FTransform& Transform)
+	{
+		CheckWriter();
+		const int32 AddIndex = NumAdds++;
+		Commands.Add({ ESIInstanceCommand::Add, false, AddIndex, Transforms.Add(Transform), 0 });
+		return AddIndex;
+	}
+
+	void Remove(int32 Id)
+	{
+		CheckWriter();
+		Commands.Add({ ESIInstanceCommand::Remove, false, Id, 0, 0 });
+	}
+
+	void SetTransform(int32 Id, const FTransform& Transform)
+	{
+		CheckWriter();
+		Commands.Add({ ESIInstanceCommand::SetTransform, false, Id, Transforms.Add(Transform), 0 });
+	}
+
+	void CrossFade(int32 Id, int32 Sequence, float FadeLength, bool bLoop)
+	{
+		CheckWriter();
+		Commands.Add({ ESIInstanceCommand::CrossFade, bLoop, Id, Sequence, FadeLength });
+	}
+
+	/** Parameter indexes the state machine's Parameters. */
+	void SetStateParameter(int32 Id, int32 Parameter, float Value)
+	{
+		CheckWriter();
+		Commands.Add({ ESIInstanceCommand::SetStateParameter, false, Id, Parameter, Value });
+	}
+
+	int32 NumCommands() const { return Commands.Num(); }
+
+	TArrayView<const FCommand> GetCommands() const { return Commands; }
+
+	const FTransform& GetTransform(int32 TransformIndex) const { return Transforms[TransformIndex]; }
+
+	/** Ids of the instances added when the buffer was last applied, indexed by add index. */
+	TArrayView<const int32> GetAddedIds() const { return AddedIds; }
+
+	/** Drops the recorded commands and keeps their memory. The added ids of the last apply are kept until the next one. */
+	void Reset()
+	{
+		Commands.Reset();
+		Transforms.Reset();
+		NumAdds = 0;
+#if SI_CHECK_CONCURRENT_WRITES
+		WriterThreadId = 0;
+#endif
+	}
+
+	SIZE_T GetAllocatedSize() const
+	{
+		return Commands.GetAllocatedSize() + Transforms.GetAllocatedSize() + AddedIds.GetAllocatedSize();
+	}
+
+private:
+	void CheckWriter()
+	{
+#if SI_CHECK_CONCURRENT_WRITES
+		// the first writer owns the buffer until it is reset, atomic so race detectors see the handover
+		uint32 Owner = 0;
+		const uint32 ThreadId = FPlatformTLS::GetCurrentThreadId();
+		WriterThreadId.CompareExchange(Owner, ThreadId);
+		checkf(Owner == 0 || Owner == ThreadId, TEXT("Instance command buffer written by threads %u and %u, every writer needs its own buffer"), Owner, ThreadId);
+#endif
+	}
+
+	TArray<FCommand> Commands;
+	TArray<FTransform> Transforms;
+	int32 NumAdds = 0;
+
+	TArray<int32> AddedIds;
+
+#if SI_CHECK_CONCURRENT_WRITES
+	TAtomic<uint32> WriterThreadId { 0 };
+#endif
+
+	friend class USIMeshComponent;
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "SIAnimationPlayer.h"
+
+struct FSIMeshInstanceData
+{
+	struct FAnimData
+	{
+		int Sequence;
+		int PrevFrame;
+		int NextFrame;
+		float FrameLerp;
+		float BlendWeight;
+	};
+	FMatrix Transform;
+	FAnimData AnimDatas[2];
+	/** Which of the component's meshes draws the instance, see USIMeshComponent::VariantMeshes. */
+	int32 MeshIndex;
+};
+
+/** Read-only view of an element every Stride bytes, e.g. one member of a simulation's array of structs. */
+template <typename ElementType>
+struct TSIStridedView
+{
+	TSIStridedView()
+		: Data(nullptr), Stride(sizeof(ElementType)), Num(0)
+	{
+	}
+
+	TSIStridedView(TArrayView<const ElementType> View)
+		: Data((const uint8*)View.GetData()), Stride(sizeof(ElementType)), Num(View.Num())
+	{
+	}
+
+	TSIStridedView(const void* InData, int32 InStride, int32 InNum)
+		: Data((const uint8*)InData), Stride(InStride), Num(InNum)
+	{
+	}
+
+	const ElementType& operator[](int32 Index) const
+	{
+		return *(const ElementType*)(Data + (SIZE_T)Index * Stride);
+	}
+
+	const uint8* Data;
+	int32 Stride;
+	int32 Num;
+};
+
+struct FSIInstanceUpdateState
+{
+	/** Time not yet applied to the player because the instance skipped updates. */
+	float PendingDeltaTime = 0;
+
+	/** Frames since the player was last advanced. */
+	uint16 FramesSinceUpdate = 0;
+
+	/** The update was due but ran out of budget, it is carried over to the next frame. */
+	bool bUpdateDeferred = false;
+};
+
+/** A notify an instance crossed while its player advanced. */
+struct FSIInstanceNotify
+{
+	int32 InstanceId;
+	int32 Sequence;
+	FName NotifyName;
+};
+
+/** Instances of a mesh component, stored as parallel arrays indexed by a dense index. */
+class SKINNEDINSTANCING_API FSIInstanceStore
+{
+public:
+	FSIInstanceStore();
+
+	/** Makes room for NumInstances more instances without reallocating in Add. */
+	void Reserve(int32 NumInstances);
+
+	int32 Add(const FMatrix& Transform);
+
+	bool Remove(int32 Handle);
+
+	void Empty();
+
+	int32 Num() const { return Handles.Num(); }
+
+	int32 FindIndex(int32 Handle) const
+	{
+		const int32* Index = HandleToIndex.Find(Handle);
+		return Index ? *Index : INDEX_NONE;
+	}
+
+	SIZE_T GetAllocatedSize() const;
+
+	/** Bumped whenever instance data visible to the renderer may have changed. */
+	uint32 GetRevision() const { return Revision; }
+
+	/** Call after writing InstanceDatas directly. */
+	void MarkChanged() { ++Revision; }
+
+	/**
+	 * Writes transforms composed from separate position, rotation and optional scale arrays straight into the
+	 * instance matrices, in parallel chunks. Unknown handles are skipped, handles must not repeat.
+	 * Returns false without changing anything when the array lengths do not match.
+	 */
+	bool SetTransforms(TArrayView<const int32> InHandles, const TSIStridedView<FVector>& Positions,
+		const TSIStridedView<FQuat>& Rotations, const TSIStridedView<FVector>& Scales);
+
+	/**
+	 * Writes the root motion each player produced since the last call into OutDeltas, blending both layers by the
+	 * cross fade weight, and resets the played time. Identity for unknown handles, handles must not repeat.
+	 */
+	void ConsumeRootMotion(TArrayView<const int32> InHandles, TArrayView<const FSIRootMotionTrack> Tracks, TArrayView<FTransform> OutDeltas);
+
+	/**
+	 * Advances the player of an instance. Notifies crossed on the layer with the larger blend weight are added to
+	 * OutNotifies, nothing is searched when NotifyTracks is empty.
+	 */
+	void TickPlayer(int32 Index, float DeltaTime, TArrayView<const FSINotifyTrack> NotifyTracks, TArray<FSIInstanceNotify>& OutNotifies);
+
+	/** What the owner of the store can play, snapshot instances outside of it are rejected. */
+	struct FSnapshotLimits
+	{
+		/** Frame count of every sequence instances may play, frames and player lengths must match. */
+		TArray<int32> SequenceNumFrames;
+		/** Off when the owner has no sequences to check against. */
+		bool bCheckSequences = false;
+		int32 NumMeshes = 1;
+		int32 NumStates = 0;
+		int32 NumStateParameters = 0;
+	};
+
+	/**
+	 * Appends a versioned binary snapshot of every instance to Out: handles, transforms, animation data, players, states,
+	 * time not yet played and state parameters, each as one contiguous 16 byte aligned block. The snapshot starts at the
+	 * next 16 byte boundary of Out. Only valid for builds with the same layouts and byte order.
+	 */
+	void SaveSnapshot(TArray<uint8>& Out) const;
+
+	/**
+	 * Replaces all instances with a snapshot, e.g. straight from a memory mapped file, with one bulk copy per block.
+	 * Handles keep their values. Returns false and changes nothing when Data is not a compatible snapshot or refers to
+	 * sequences, meshes, states or parameters beyond Limits.
+	 */
+	bool LoadSnapshot(TArrayView<const uint8> Data, const FSnapshotLimits& Limits);
+
+	/** Sets how many state machine parameters every instance has, new parameters start at 0. */
+	void SetNumStateParameters(int32 NumParameters);
+
+	/** Applies any pending delta time to the player, e.g. before it is given a new sequence. */
+	void FlushPendingTime(int32 Index, TArrayView<const FSINotifyTrack> NotifyTracks, TArray<FSIInstanceNotify>& OutNotifies);
+
+	/** Writes the player state of an instance into its GPU facing animation data. */
+	void UpdateAnimData(int32 Index);
+
+public:
+	TArray<int32> Handles;
+	TArray<FSIMeshInstanceData> InstanceDatas;
+	TArray<FAnimtionPlayer> Players;
+	TArray<FSIInstanceUpdateState> UpdateStates;
+
+	/** State machine state of every instance, INDEX_NONE until it entered one. */
+	TArray<int32> AnimStates;
+
+	/** One column per state machine parameter, indexed like the other arrays. */
+	TArray<TArray<float>> StateParameters;
+
+private:
+	TMap<int32, int32> HandleToIndex;
+	int32 NextHandle;
+	uint32 Revision;
+};
@@ -2,24 +2,72 @@
 
 #include "CoreMinimal.h"
 #include "Components/MeshComponent.h"
+#include "Async/TaskGraphInterfaces.h"
 #include "Engine/SkeletalMesh.h"
 #include "SIAnimationComponent.h"
+#include "SIInstanceStore.h"
+#include "SIAnimStateMachine.h"
+#include "SIInstanceCommandBuffer.h"
 #include "SIMeshComponent.generated.h"
 
-struct FSIMeshInstanceData
+class FSIMeshBatch;
+class FSIInstanceHitShapes;
+class FSIInstanceBounds;
+class FSIInstanceGrid;
+class USIMeshComponent;
+
+/** Closest instance a trace hit, see USIMeshComponent::LineTraceInstances. */
+USTRUCT(BlueprintType)
+struct FSIInstanceHit
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(BlueprintReadOnly, Category = "SkinnedInstancing")
+	int32 InstanceId = INDEX_NONE;
+
+	/** Bone of the physics asset body that was hit. */
+	UPROPERTY(BlueprintReadOnly, Category = "SkinnedInstancing")
+	FName BoneName;
+
+	UPROPERTY(BlueprintReadOnly, Category = "SkinnedInstancing")
+	float Distance = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "SkinnedInstancing")
+	FVector Location = FVector::ZeroVector;
+
+	UPROPERTY(BlueprintReadOnly, Category = "SkinnedInstancing")
+	FVector Normal = FVector::ZeroVector;
+};
+
+/**
+ * Late tick of a mesh component, starts building the renderer's instance data once gameplay wrote the instances for
+ * the frame, so the build does not stall on or get discarded by writes from later ticks.
+ */
+USTRUCT()
+struct FSIMeshDynamicDataTickFunction : public FTickFunction
+{
+	GENERATED_USTRUCT_BODY()
+
+	USIMeshComponent* Target = nullptr;
+
+	//~ Begin FTickFunction Interface
+	virtual void ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent) override;
+	virtual FString DiagnosticMessage() override;
+	//~ End FTickFunction Interface
+};
+
+template<>
+struct TStructOpsTypeTraits<FSIMeshDynamicDataTickFunction> : public TStructOpsTypeTraitsBase2<FSIMeshDynamicDataTickFunction>
 {
-	struct FAnimData
+	enum
 	{
-		int Sequence;
-		int PrevFrame;
-		int NextFrame;
-		float FrameLerp;
-		float BlendWeight;
+		WithCopy = false
 	};
-	FMatrix Transform;
-	FAnimData AnimDatas[2];
 };
 
+/** Every notify the instances of a component crossed this frame, in the order their players advanced. */
+DECLARE_MULTICAST_DELEGATE_TwoParams(FSIOnInstanceNotifies, USIMeshComponent*, TArrayView<const FSIInstanceNotify>);
+
 UCLASS(hidecategories = (Object, LOD), meta = (BlueprintSpawnableComponent), ClassGroup = Rendering)
 class SKINNEDINSTANCING_API USIMeshComponent : public UMeshComponent
 {
@@ -36,10 +84,12 @@ private:
 	//~ End UMeshComponent Interface.
 
 	//~ Begin UObject Interface
+	virtual void GetResourceSizeEx(FResourceSizeEx& CumulativeResourceSize) override;
 	//~ End UObject Interface.
 
 	//~ Begin USceneComponent Interface.
 	virtual FBoxSphereBounds CalcBounds(const FTransform& LocalToWorld) const override;
+	virtual void OnUpdateTransform(EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport = ETeleportType::None) override;
 	//~ Begin USceneComponent Interface.
 
 protected:
@@ -51,6 +101,7 @@ protected:
 	virtual void DestroyRenderState_Concurrent() override;
 	virtual bool RequiresGameThreadEndOfFrameRecreate() const override { return false; }
 	virtual void TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction *ThisTickFunction) override;
+	virtual void RegisterComponentTickFunctions(bool bRegister) override;
 	virtual UObject const* AdditionalStatObject() const override { return SkeletalMesh; }
 	//~ End UActorComponent Interface
 
@@ -60,31 +111,310 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SkinnedInstancing")
 	USkeletalMesh* SkeletalMesh;
 
+	/**
+	 * Outfits or other variants drawn by the same component, they must use the skeleton of SkeletalMesh. Mesh index 0
+	 * is SkeletalMesh and index i is VariantMeshes[i - 1]. All variants share one instance and animation upload.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SkinnedInstancing")
+	TArray<USkeletalMesh*> VariantMeshes;
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SkinnedInstancing")
 	TWeakObjectPtr<USIAnimationComponent> AnimationComponent;
 
+	/** Drives the sequences of all instances from their state parameters, evaluated every tick before they advance. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing")
+	USIAnimStateMachine* StateMachine;
+
 	/** Object responsible for sending bone transforms, morph target state etc. to render thread. */
 	class FSIMeshObject* MeshObject;
 
+	/** Whether distant or off-screen instances advance their animation less often. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SkinnedInstancing|UpdateRate")
+	bool bEnableUpdateRateOptimizations;
+
+	/** Distances to the closest view beyond which instances update every 2nd, 4th and 8th frame. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SkinnedInstancing|UpdateRate")
+	TArray<float> UpdateRateBandDistances;
+
+	/** Band used while the component was not rendered recently, instances update every 2^Band frames. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SkinnedInstancing|UpdateRate", meta = (ClampMin = "0", ClampMax = "3"))
+	int32 OffScreenUpdateRateBand;
+
+	/** Maximum instances drawn per view, the ones with the smallest screen size are dropped. 0 uses r.SkinnedInstancing.MaxDrawnInstances. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SkinnedInstancing|Rendering", meta = (ClampMin = "0"))
+	int32 MaxDrawnInstances;
+
+	/** Number of least significant drawn instances that fade out when the budget is hit, needs r.SkinnedInstancing.DrawBudgetFade. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SkinnedInstancing|Rendering", meta = (ClampMin = "0"))
+	int32 DrawBudgetFadeInstances;
+
+	/**
+	 * Instance transforms are relative to this component and the shader composes them with the component transform,
+	 * so moving the component moves every instance without re-uploading them. Otherwise they are world space.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing")
+	bool bInstancesInComponentSpace;
+
+	/**
+	 * Draw the instances of every batching component in this world that shares the skeletal mesh, animation component
+	 * and materials through a single proxy. Each component keeps its own instances and ids, the rendering settings
+	 * of the first component registered are used for the whole batch.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SkinnedInstancing|Rendering")
+	bool bBatchWithOtherComponents;
+
+	/** Switches instance space, existing instances are converted so they keep their world placement. */
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	void SetInstancesInComponentSpace(bool bInComponentSpace);
+
+	/** Transform from instance space to world space. */
+	FMatrix GetInstanceToWorld() const;
+
+	/** Batched, and another component draws the instances of this one. */
+	bool IsBatchFollower() const;
+
+	/**
+	 * Called on the batch leader when members joined, left or changed their instances. Only marks the batch, the
+	 * leader recomputes its bounds and resends the instances once per frame in its late tick.
+	 */
+	void OnBatchMembersChanged() { bBatchMembersDirty = true; }
+
+	/** Converts a world transform to the space instance transforms are given in. */
+	FTransform WorldToInstanceSpace(const FTransform& WorldTransform) const
+	{
+		return bInstancesInComponentSpace ? WorldTransform.GetRelativeTransform(GetComponentTransform()) : WorldTransform;
+	}
+
 	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
 	void SetAnimationComponent(USIAnimationComponent* _AnimationComponent);
 
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	void CrossFadeInstance(int32 Id, int Sequence, float FadeLength, bool Loop);
+
+	// Instances can be driven directly as lightweight agents through their id, without a USIUnitComponent per unit.
+
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	int32 GetNumInstances() const { return Instances.Num(); }
+
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	bool IsValidInstance(int32 Id) const { return Instances.FindIndex(Id) != INDEX_NONE; }
+
+	/** Returns false and leaves OutTransform untouched for unknown ids. */
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	bool GetInstanceTransform(int32 Id, FTransform& OutTransform) const;
+
+	/** Sequence the instance is playing or fading to, -1 for unknown ids. */
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	int32 GetInstanceSequence(int32 Id) const;
+
+	/** Adds one instance per transform and returns their ids in the same order. */
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	TArray<int32> AddInstances(const TArray<FTransform>& Transforms);
+
+	/** Removes every instance in Ids, unknown ids are ignored. */
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	void RemoveInstances(const TArray<int32>& Ids);
+
+	/** Sets Transforms[i] on instance Ids[i], both arrays must have the same length. */
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	void UpdateInstanceTransforms(const TArray<int32>& Ids, const TArray<FTransform>& Transforms);
+
+	/**
+	 * Sets instance transforms from a simulation's position, rotation and optional scale arrays, without
+	 * building FTransforms. Ids[i] receives element i, ids must not repeat.
+	 */
+	void SetInstanceTransforms(TArrayView<const int32> Ids, TArrayView<const FVector> Positions,
+		TArrayView<const FQuat> Rotations, TArrayView<const FVector> Scales = TArrayView<const FVector>());
+
+	/** Strided variant, for positions and rotations that live inside an array of structs. */
+	void SetInstanceTransforms(TArrayView<const int32> Ids, const TSIStridedView<FVector>& Positions,
+		const TSIStridedView<FQuat>& Rotations, const TSIStridedView<FVector>& Scales = TSIStridedView<FVector>());
+
+	/**
+	 * World transform of a bone or socket of an instance, sampled from the baked palette with the same layers, frame lerp
+	 * and blend weight as the vertex factory. Sockets come from the mesh the instance is drawn with, see VariantMeshes.
+	 * Needs bKeepCPUBonePalette on the animation component. Returns false for unknown ids and names. Safe to call from several threads as long as instances are not modified meanwhile.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	bool GetInstanceBoneTransform(int32 Id, FName BoneOrSocketName, FTransform& OutTransform) const;
+
+	/** Batched variant, OutTransforms[i] receives the transform of Ids[i]. Returns how many ids were found. */
+	int32 GetInstanceBoneTransforms(TArrayView<const int32> Ids, FName BoneOrSocketName, TArrayView<FTransform> OutTransforms) const;
+
+	/**
+	 * Root motion each instance played since the last call, from the baked root motion tracks of the animation component
+	 * and blended across cross fades. OutDeltas[i] is relative to the current transform of Ids[i], identity for unknown
+	 * ids and sequences without root motion. Needs no pose evaluation, ids must not repeat.
+	 */
+	void ConsumeRootMotion(TArrayView<const int32> Ids, TArrayView<FTransform> OutDeltas);
+
+	/** Moves every instance in Ids by the root motion it played since the last call, see ConsumeRootMotion. */
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	void ApplyRootMotion(const TArray<int32>& Ids);
+
+	/**
+	 * Broadcast once per tick with the notifies of all instances, after they advanced. Notifies are only searched while
+	 * something is bound, instances that skipped updates report theirs when they catch up.
+	 */
+	FSIOnInstanceNotifies OnInstanceNotifies;
+
+	/** Every instance restarts from the entry state of the new state machine, parameters are kept where the names match. */
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	void SetStateMachine(USIAnimStateMachine* NewStateMachine);
+
+	/** Writes Values[i] into a parameter of instance Ids[i], see USIAnimStateMachine::FindParameter. */
+	void SetInstanceStateParameters(int32 Parameter, TArrayView<const int32> Ids, TArrayView<const float> Values);
+
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	void SetInstanceStateParameter(int32 Id, FName Parameter, float Value);
+
+	/** State machine state of the instance, -1 for unknown ids and instances that did not enter a state yet. */
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	int32 GetInstanceState(int32 Id) const;
+
+	/**
+	 * Closest instance hit by the segment from Start to End, against the capsules and spheres of the SkeletalMesh physics
+	 * asset posed at each instance's current frame. Needs bKeepCPUBonePalette on the animation component, which also
+	 * works without rendering. Needs no physics bodies and is safe to call from several threads while instances are
+	 * not modified.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	bool LineTraceInstances(const FVector& Start, const FVector& End, FSIInstanceHit& OutHit) const;
+
+	/** Adds the ids of every instance whose posed capsules touch the sphere to OutIds, see LineTraceInstances. Returns how many were added. */
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	int32 OverlapSphereInstances(const FVector& Center, float Radius, TArray<int32>& OutIds) const;
+
+	/** Appends a binary snapshot of every instance for save games, streaming and replays, see FSIInstanceStore::SaveSnapshot. */
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	void SaveInstances(TArray<uint8>& OutData) const;
+
+	/**
+	 * Replaces all instances with a snapshot in one bulk copy, keeping their ids, without recreating the render state.
+	 * Data can point straight into a memory mapped file. Returns false and keeps the instances for incompatible data,
+	 * including snapshots playing sequences, meshes or states this component does not have.
+	 */
+	bool RestoreInstances(TArrayView<const uint8> Data);
+
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing", meta = (DisplayName = "Restore Instances"))
+	bool RestoreInstancesFromBytes(const TArray<uint8>& Data) { return RestoreInstances(Data); }
+
+	/**
+	 * Opens NumWriters command buffers so worker tasks, e.g. the indices of a ParallelFor, can write instances without
+	 * touching the component. Game thread only, before the writers start. Commands still pending are flushed first.
+	 */
+	void BeginConcurrentWrites(int32 NumWriters);
+
+	/** Command buffer of one writer, each writer must only use its own. */
+	FSIInstanceCommandBuffer& GetCommandBuffer(int32 Writer) { return *CommandBuffers[Writer]; }
+
+	/**
+	 * Applies every recorded command, buffer by buffer in writer order, on the game thread once the writers finished.
+	 * Runs at the start of every tick, so commands recorded during a frame are drawn the same frame.
+	 */
+	void FlushInstanceCommands();
+
+	/** Selects the mesh an instance is drawn with, see VariantMeshes. */
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	void SetInstanceMesh(int32 Id, int32 MeshIndex);
+
+	/** Mesh index of the instance, -1 for unknown ids. */
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	int32 GetInstanceMesh(int32 Id) const;
+
+	/**
+	 * Meshes drawn by this component, indexed by instance mesh index. Missing variants and variants with another
+	 * skeleton are replaced by SkeletalMesh so indices stay stable.
+	 */
+	void GetRenderMeshes(TArray<USkeletalMesh*>& OutMeshes) const;
+
+	/** Cross fades every instance in Ids to the same sequence. */
+	UFUNCTION(BlueprintCallable, Category = "Components|SkinnedInstancing")
+	void PlayOnInstances(const TArray<int32>& Ids, int Sequence, float FadeLength, bool Loop);
+
 private:
+	void GatherInstanceDatas(TArray<FSIMeshInstanceData>& OutInstanceDatas) const;
 	void UpdateMeshObejctDynamicData();
+	bool CanBuildDynamicDataAsync() const;
+	/** Gathers and packs the instances for the renderer in a task, published by the next UpdateMeshObejctDynamicData. */
+	void BeginDynamicDataTask();
+	/** Runs in DynamicDataTickFunction, after the instances ticked and gameplay wrote them. */
+	void TickDynamicData();
+	void WaitForDynamicDataTask();
+	/** Call before writing instance datas on the game thread. */
+	void PrepareInstanceWrite();
+	void TickInstances(float DeltaTime);
+	void CrossFadeInstanceAtIndex(int32 Index, const FAnimtionPlayer::Sequence& Seq, float FadeLength, bool Loop);
+	int32 GetUpdateRateBand(const FVector& Location, const TArray<FVector>& ViewLocations, bool bOnScreen) const;
+	TArrayView<const FSINotifyTrack> GetNotifyTracksToSearch() const;
+	void DispatchInstanceNotifies();
+	void SyncStateParameters();
+	void EvaluateStateMachine();
+	void BuildHitShapes();
+	/** The grid the hit tests search, rebuilt here when the instances, the component transform or the shapes changed. Any thread. */
+	TSharedPtr<const FSIInstanceGrid, ESPMode::ThreadSafe> GetInstanceGrid(const FMatrix& InstanceToWorld, float BoundsRadius) const;
+	/** The cached local bounds of the instances, rebuilt here when the palette they were built from changed. */
+	const FSIInstanceBounds& GetInstanceBounds() const;
 
 private:
-	TMap<int, FSIMeshInstanceData> PerInstanceSMData;
-	int InstanceIdIncrease;
+	FSIInstanceStore Instances;
+	uint32 UpdateRateFrameCounter;
+	TArray<uint64> UpdateQueue;
+
+	/** Notifies gathered since the last broadcast. */
+	TArray<FSIInstanceNotify> PendingNotifies;
+
+	TArray<USIAnimStateMachine::FStateChange> StateChanges;
+
+	/** Instance store revision last handed to the mesh object. */
+	uint32 SentInstanceRevision;
+
+	/** Instance store revision the bounds were last computed for. */
+	uint32 BoundsInstanceRevision;
+
+	/** Leader only, a member changed since the batch bounds and instances were last sent. */
+	bool bBatchMembersDirty;
+
+	/** Builds the mesh object's back buffer from the instances at DynamicDataTaskRevision. */
+	FGraphEventRef DynamicDataTask;
+	uint32 DynamicDataTaskRevision;
+
+	/** Sends the instances once per frame in TG_LastDemotable, after the primary tick. */
+	FSIMeshDynamicDataTickFunction DynamicDataTickFunction;
+
+	TSharedPtr<FSIMeshBatch> Batch;
+
+	/** Separate allocations, so writers filling neighbouring buffers do not share cache lines. */
+	TArray<TUniquePtr<FSIInstanceCommandBuffer>> CommandBuffers;
+
+	/** Physics asset shapes of SkeletalMesh, built on register and when the animation component changes. */
+	TSharedPtr<FSIInstanceHitShapes, ESPMode::ThreadSafe> HitShapes;
+
+	/** Broadphase of the hit tests, replaced rather than modified so queries on other threads keep theirs. */
+	mutable TSharedPtr<const FSIInstanceGrid, ESPMode::ThreadSafe> InstanceGrid;
+	mutable FCriticalSection InstanceGridLock;
+
+	/** Instance bounds of the render meshes for CalcBounds, reset on register and when the animation component changes. */
+	mutable TSharedPtr<FSIInstanceBounds> InstanceBounds;
+	/** The palette InstanceBounds was built from, see FSIAnimationData::GetGeneration. */
+	mutable const FSIAnimationData* InstanceBoundsAnimationData;
+	mutable uint32 InstanceBoundsGeneration;
+	mutable bool bInstanceBoundsHaveBones;
 
 public:
 	int32 AddInstance(const FTransform& Transform);
 
 	void RemoveInstance(int Id);
+
+	void SetInstanceTransform(int Id, const FTransform& Transform);
 	
 	UAnimSequence* GetSequence(int Id);
 
+	/** Mutable access, the instance is assumed to change. */
 	FSIMeshInstanceData* GetInstanceData(int Id);
 
 private:
 	friend class FSIMeshSceneProxy;
+	friend class USIBenchmarkCommandlet;
+	friend struct FSIMeshDynamicDataTickFunction;
 };
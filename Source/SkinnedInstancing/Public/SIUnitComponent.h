@@ -18,9 +18,8 @@ public:
 	//~ Override Functions
 protected:
 	//~ Begin UActorComponent Interface
-	virtual void CreateRenderState_Concurrent() override;
-	virtual void SendRenderDynamicData_Concurrent() override;
-	virtual void DestroyRenderState_Concurrent() override;
+	virtual void OnRegister() override;
+	virtual void OnUnregister() override;
 	virtual void TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction *ThisTickFunction) override;
 	//~ End UActorComponent Interface
 
@@ -35,10 +34,9 @@ private:
 	void RecreateInstance();
 	void RemoveInstance();
 
-public:
-	class FAnimtionPlayer;
-
 private:
 	int InstanceId;
-	FAnimtionPlayer* AnimtionPlayer;
+	TWeakObjectPtr<USIMeshComponent> InstanceOwner;
+
+	friend class USIBenchmarkCommandlet;
 };
@@ -5,6 +5,20 @@
 #include "CoreMinimal.h"
 #include "Modules/ModuleManager.h"
 
+DECLARE_LOG_CATEGORY_EXTERN(LogSkinnedInstancing, Log, All);
+
+/**
+ * Components keep their instances and animation clocks but create no render resources and queue no render thread
+ * work. Always on where nothing can render, e.g. dedicated servers, and forced by r.SkinnedInstancing.ServerMode.
+ */
+SKINNEDINSTANCING_API bool SIIsServerMode();
+
+/**
+ * Keeps client behaviour, batching and update rates included, where nothing can render but tools such as commandlets
+ * measure it. Dedicated servers and r.SkinnedInstancing.ServerMode still run in server mode. Set before components register.
+ */
+SKINNEDINSTANCING_API void SISetClientModeOverride(bool bOverride);
+
 class FSkinnedInstancingModule : public IModuleInterface
 {
 public:
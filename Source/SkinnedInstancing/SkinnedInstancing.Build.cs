@@ -1,5 +1,6 @@
 // Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
 
+using System;
 using UnrealBuildTool;
 
 public class SkinnedInstancing : ModuleRules
@@ -7,6 +8,12 @@ public class SkinnedInstancing : ModuleRules
 	public SkinnedInstancing(ReadOnlyTargetRules Target) : base(Target)
 	{
 		PCHUsage = ModuleRules.PCHUsageMode.UseExplicitOrSharedPCHs;
+
+		// checks that worker threads only write instances through command buffers, set SI_CHECK_CONCURRENT_WRITES=1
+		// in the environment for thread sanitizer builds
+		bool bCheckConcurrentWrites = Target.Configuration == UnrealTargetConfiguration.Debug
+			|| Environment.GetEnvironmentVariable("SI_CHECK_CONCURRENT_WRITES") == "1";
+		PublicDefinitions.Add("SI_CHECK_CONCURRENT_WRITES=" + (bCheckConcurrentWrites ? "1" : "0"));
 		
 		PublicIncludePaths.AddRange(
 			new string[] {